@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <cstring>
+
+#include "拡散視覚化/diffusion_eq.h"
+#include "拡散視覚化/advection_diffusion.h"
+
+// 移流拡散 (拡散視覚化/advection_diffusion.h) のテスト
+//
+//   make check
+//
+// 速度が0なら移流は何もしないので、境界の方針と分割の方法によらず
+// 拡散方程式だけを進めた結果とビットまで同じになる。
+
+static int failures = 0;
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%s %s (%s)\n", ok ? "PASS" : "FAIL", name, detail);
+	if (!ok) {
+		failures++;
+	}
+}
+
+static void initialize(DiffEquation &diff, BoundaryKind kind) {
+	static const int W = 48, H = 40;
+	diff.initParams(W, H, 0.2);
+	diff.boundary().setAll(kind, 0.25);
+	for (int y = 1; y < 12; y++) {
+		for (int x = 1; x < 9; x++) {
+			diff.set(x, y, 1.0);
+		}
+	}
+	diff.start();
+}
+
+static void testZeroVelocity(const char *name, BoundaryKind kind, SplittingScheme splitting) {
+	static const int STEPS = 200;
+	DiffEquation plain, advected;
+	initialize(plain, kind);
+	initialize(advected, kind);
+
+	AdvectionDiffusion advection(advected);
+	advection.setParams(1.0, 1.0, 0.2);
+	advection.setSplitting(splitting);
+	for (int i = 0; i < STEPS; i++) {
+		plain.step();
+		advection.step();
+	}
+
+	int differing = 0;
+	for (int y = 0; y < plain.yCells(); y++) {
+		for (int x = 0; x < plain.xCells(); x++) {
+			const double a = plain.get(x, y), b = advected.get(x, y);
+			if (std::memcmp(&a, &b, sizeof(double)) != 0) {
+				differing++;
+			}
+		}
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "%s, %d steps, %d cells differ",
+		splitting == SPLITTING_STRANG ? "strang" : "lie", STEPS, differing);
+	report(name, differing == 0, detail);
+}
+
+int main() {
+	static const SplittingScheme SCHEMES[] = { SPLITTING_LIE, SPLITTING_STRANG };
+	for (int i = 0; i < 2; i++) {
+		testZeroVelocity("zero velocity keeps mirror", BOUNDARY_MIRROR_NEGATE, SCHEMES[i]);
+		testZeroVelocity("zero velocity keeps neumann", BOUNDARY_NEUMANN, SCHEMES[i]);
+		testZeroVelocity("zero velocity keeps dirichlet", BOUNDARY_DIRICHLET, SCHEMES[i]);
+		testZeroVelocity("zero velocity keeps periodic", BOUNDARY_PERIODIC, SCHEMES[i]);
+	}
+
+	if (failures > 0) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,273 @@
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "water_eq.h"
+#include "拡散視覚化/diffusion_eq.h"
+
+// 境界条件 (stencil.h の EdgeBoundary) のテスト
+//
+//   make check
+//
+// 方針ごとに1つずつ確かめて結果を表示する。1つでも失敗すれば終了コードは1になる。
+
+static int failures = 0;
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%s %s (%s)\n", ok ? "PASS" : "FAIL", name, detail);
+	if (!ok) {
+		failures++;
+	}
+}
+
+// 内側のセルの合計
+template <class Equation>
+double interiorSum(const Equation &eq) {
+	double sum = 0.0;
+	for (int y = 1; y < eq.yCells() - 1; y++) {
+		for (int x = 1; x < eq.xCells() - 1; x++) {
+			sum += eq.get(x, y);
+		}
+	}
+	return sum;
+}
+
+// 内側のセルの2乗の合計 (波のエネルギーの目安)
+template <class Equation>
+double interiorEnergy(const Equation &eq) {
+	double sum = 0.0;
+	for (int y = 1; y < eq.yCells() - 1; y++) {
+		for (int x = 1; x < eq.xCells() - 1; x++) {
+			sum += eq.get(x, y) * eq.get(x, y);
+		}
+	}
+	return sum;
+}
+
+// 境界の方針を入れる前の波動方程式 (符号を反転する境界だけ) をそのまま書いたもの
+class ReferenceWave {
+	int width_, height_;
+	double speed_, dx_, dt_, loss_;
+	std::vector<double> curr_, prev_, next_;
+
+public:
+	ReferenceWave(int width, int height, double speed, double dx, double dt, double loss)
+		: width_(width)
+		, height_(height)
+		, speed_(speed)
+		, dx_(dx)
+		, dt_(dt)
+		, loss_(loss)
+		, curr_(width * height, 0.0)
+		, prev_(width * height, 0.0)
+		, next_(width * height, 0.0) {
+	}
+
+	void set(int x, int y, double height) {
+		curr_[y * width_ + x] = height;
+	}
+
+	double get(int x, int y) const {
+		return curr_[y * width_ + x];
+	}
+
+	void start() {
+		prev_ = curr_;
+	}
+
+	void step() {
+		static const int NN = 4;
+		static const int ddx[] = { -1, 1, 0, 0 };
+		static const int ddy[] = { 0, 0, -1, 1 };
+		const double coef = speed_ * speed_ * dt_ * dt_ / (dx_ * dx_);
+
+		for (int y = 1; y < height_ - 1; y++) {
+			for (int x = 1; x < width_ - 1; x++) {
+				const int i = y * width_ + x;
+				double sum = 0.0;
+				for (int k = 0; k < NN; k++) {
+					sum += curr_[(y + ddy[k]) * width_ + x + ddx[k]] - curr_[i];
+				}
+				next_[i] = curr_[i] + (1.0 - loss_) * (curr_[i] - prev_[i] + coef * sum);
+			}
+		}
+
+		for (int x = 0; x < width_; x++) {
+			next_[0 * width_ + x] = -next_[1 * width_ + x];
+			next_[(height_ - 1) * width_ + x] = -next_[(height_ - 2) * width_ + x];
+		}
+		for (int y = 0; y < height_; y++) {
+			next_[y * width_ + 0] = -next_[y * width_ + 1];
+			next_[y * width_ + (width_ - 1)] = -next_[y * width_ + (width_ - 2)];
+		}
+
+		prev_.swap(curr_);
+		curr_.swap(next_);
+	}
+};
+
+// 法線方向の勾配が0なら内側の合計 (質量) は変わらない
+static void testNeumann() {
+	static const int W = 64, H = 48;
+	DiffEquation diff;
+	diff.initParams(W, H, 0.2);
+	diff.boundary().setAll(BOUNDARY_NEUMANN);
+	for (int y = 5; y < 15; y++) {
+		for (int x = 3; x < 9; x++) {
+			diff.set(x, y, 1.0);
+		}
+	}
+	diff.start();
+
+	const double mass0 = interiorSum(diff);
+	for (int i = 0; i < 2000; i++) {
+		diff.step();
+	}
+	const double mass = interiorSum(diff);
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "mass %.12g -> %.12g", mass0, mass);
+	report("neumann conserves mass", std::fabs(mass - mass0) <= 1e-9 * mass0, detail);
+}
+
+// 境界の値を固定すれば全体がその値に落ち着く
+static void testDirichlet() {
+	static const int W = 64, H = 48;
+	static const double VALUE = 0.5;
+	DiffEquation diff;
+	diff.initParams(W, H, 0.2);
+	diff.boundary().setAll(BOUNDARY_DIRICHLET, VALUE);
+	diff.start();
+	for (int i = 0; i < 20000; i++) {
+		diff.step();
+	}
+
+	double maxError = 0.0;
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			maxError = std::max(maxError, std::fabs(diff.get(x, y) - VALUE));
+		}
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "max |u - %g| = %g", VALUE, maxError);
+	report("dirichlet relaxes to value", maxError <= 1e-6, detail);
+}
+
+// 周期境界なら初期値をずらした結果は、ずらさない結果をずらしたものと同じになる
+static void testPeriodic() {
+	static const int W = 64, H = 48, SHIFT = 10;
+	static const int IW = W - 2, IH = H - 2;
+	WaveEquation a, b;
+	a.setParams(W, H, 0.5, 0.01, 0.005);
+	b.setParams(W, H, 0.5, 0.01, 0.005);
+	a.boundary().setAll(BOUNDARY_PERIODIC);
+	b.boundary().setAll(BOUNDARY_PERIODIC);
+	for (int y = 1; y < H - 1; y++) {
+		for (int x = 1; x < W - 1; x++) {
+			const double vx = (x - 6) * 0.01, vy = (y - 20) * 0.01;
+			const double h = std::exp(-500.0 * (vx * vx + vy * vy));
+			a.set(x, y, h);
+			b.set(1 + (x - 1 + SHIFT) % IW, 1 + (y - 1 + SHIFT) % IH, h);
+		}
+	}
+	a.start();
+	b.start();
+	for (int i = 0; i < 300; i++) {
+		a.step();
+		b.step();
+	}
+
+	double maxDiff = 0.0;
+	for (int y = 1; y < H - 1; y++) {
+		for (int x = 1; x < W - 1; x++) {
+			const double shifted = b.get(1 + (x - 1 + SHIFT) % IW, 1 + (y - 1 + SHIFT) % IH);
+			maxDiff = std::max(maxDiff, std::fabs(a.get(x, y) - shifted));
+		}
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "max shifted diff %g", maxDiff);
+	report("periodic is shift invariant", maxDiff <= 1e-12, detail);
+}
+
+// 中央の山から出た波が辺に届いたあとに残るエネルギーの割合
+static double remainingEnergy(BoundaryKind kind) {
+	static const int N = 200;
+	WaveEquation wave;
+	wave.setParams(N, N, 0.5, 0.01, 0.01, 0.0);
+	wave.boundary().setAll(kind);
+	for (int y = 0; y < N; y++) {
+		for (int x = 0; x < N; x++) {
+			const double vx = (x - N / 2) * 0.01, vy = (y - N / 2) * 0.01;
+			wave.set(x, y, std::exp(-200.0 * (vx * vx + vy * vy)));
+		}
+	}
+	wave.start();
+
+	const double energy0 = interiorEnergy(wave);
+	for (int i = 0; i < 800; i++) {
+		wave.step();
+	}
+	return interiorEnergy(wave) / energy0;
+}
+
+// 吸収境界は反射する境界より波を大幅に減らす
+static void testAbsorbing() {
+	const double mirror = remainingEnergy(BOUNDARY_MIRROR_NEGATE);
+	const double absorbing = remainingEnergy(BOUNDARY_ABSORBING);
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "energy ratio absorbing %g, mirror %g", absorbing, mirror);
+	report("absorbing energy << mirror", absorbing < 0.1 * mirror, detail);
+}
+
+// 既定 (符号の反転) は境界の方針を入れる前と同じ結果になる (和の順番が違うので丸め誤差の分だけずれる)
+static void testMirror() {
+	static const int W = 97, H = 71;
+	WaveEquation wave;
+	ReferenceWave reference(W, H, 0.5, 0.01, 0.005, 0.001);
+	wave.setParams(W, H, 0.5, 0.01, 0.005, 0.001);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			const double vx = (x - W / 2) * 0.01, vy = (y - H / 3) * 0.01;
+			const double h = 2.0 * std::exp(-50.0 * (vx * vx + vy * vy));
+			wave.set(x, y, h);
+			reference.set(x, y, h);
+		}
+	}
+	wave.start();
+	reference.start();
+	for (int i = 0; i < 500; i++) {
+		wave.step();
+		reference.step();
+	}
+
+	double maxDiff = 0.0, peak = 0.0;
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			maxDiff = std::max(maxDiff, std::fabs(wave.get(x, y) - reference.get(x, y)));
+			peak = std::max(peak, std::fabs(reference.get(x, y)));
+		}
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "max diff %g (peak %g)", maxDiff, peak);
+	report("mirror matches the old output", maxDiff <= 1e-12 * peak, detail);
+}
+
+int main() {
+	testNeumann();
+	testDirichlet();
+	testPeriodic();
+	testAbsorbing();
+	testMirror();
+
+	if (failures > 0) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
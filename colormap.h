@@ -0,0 +1,124 @@
+#ifndef _COLORMAP_H_
+#define _COLORMAP_H_
+
+#include <cstdio>
+#include <cmath>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COLORMAP_USE_SSE2
+#endif
+
+#include "stb_image.h"
+#include "parallel.h"
+
+// hue.pngなどの1次元テクスチャを使って、高さをCPU上で色に変換するクラス
+// シェーダ (glsl.frag) の texture(u_texture, h) と同じく、
+// 線形補間 + GL_CLAMP_TO_EDGE でサンプリングした結果になる
+class Colormap {
+public:
+	// 高さ[0, 1]をこの数に分割した表を作っておく
+	static const int LUT_SIZE = 4096;
+
+	Colormap() {
+	}
+
+	bool load(const std::string &filename) {
+		int texWidth, texHeight, channels;
+		unsigned char *bytes = stbi_load(filename.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
+		if (!bytes) {
+			fprintf(stderr, "Failed to load image file: %s\n", filename.c_str());
+			return false;
+		}
+
+		// 1行目をテクスチャとして使う
+		build(bytes, texWidth);
+		stbi_image_free(bytes);
+		return true;
+	}
+
+	// RGBAのテクセル列から表を作る
+	void build(const unsigned char *texels, int texWidth) {
+		lut_.resize(LUT_SIZE);
+		for (int i = 0; i < LUT_SIZE; i++) {
+			const double h = (double)i / (LUT_SIZE - 1);
+			const double u = h * texWidth - 0.5;
+			const int i0 = (int)std::floor(u);
+			const double t = u - i0;
+			const int a = std::min(std::max(i0, 0), texWidth - 1);
+			const int b = std::min(std::max(i0 + 1, 0), texWidth - 1);
+
+			uint32_t rgb = 0;
+			for (int c = 0; c < 3; c++) {
+				const double v = (1.0 - t) * texels[a * 4 + c] + t * texels[b * 4 + c];
+				rgb |= (uint32_t)std::min(255.0, std::floor(v + 0.5)) << (8 * c);
+			}
+			lut_[i] = rgb;
+		}
+	}
+
+	bool isLoaded() const {
+		return !lut_.empty();
+	}
+
+	// heights (xCells x yCells、行の間隔はpitch。0ならxCells) をRGB画像に変換する
+	// flipY = trueなら画像の上の行をy = yCells - 1にする
+	void apply(const double *heights, int xCells, int yCells, uint8_t *rgb, bool flipY = true, int pitch = 0) const {
+		const size_t stride = pitch > 0 ? pitch : xCells;
+		parallelFor(0, yCells, [&](int lo, int hi) {
+			for (int y = lo; y < hi; y++) {
+				const int row = flipY ? yCells - 1 - y : y;
+				applyRow(heights + (size_t)y * stride, xCells, rgb + (size_t)row * xCells * 3);
+			}
+		});
+	}
+
+private:
+	void applyRow(const double *h, int n, uint8_t *rgb) const {
+		const uint32_t *lut = &lut_[0];
+		int x = 0;
+
+#if defined(COLORMAP_USE_SSE2)
+		// 2要素ずつ表のインデックスを計算する
+		const __m128d scale = _mm_set1_pd(LUT_SIZE - 1);
+		const __m128d half = _mm_set1_pd(0.5);
+		const __m128d lower = _mm_setzero_pd();
+		const __m128d upper = _mm_set1_pd(LUT_SIZE - 1);
+		for (; x + 4 <= n; x += 4) {
+			__m128d v0 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(h + x), scale), half);
+			__m128d v1 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(h + x + 2), scale), half);
+			v0 = _mm_min_pd(_mm_max_pd(v0, lower), upper);
+			v1 = _mm_min_pd(_mm_max_pd(v1, lower), upper);
+			const __m128i i0 = _mm_cvttpd_epi32(v0);
+			const __m128i i1 = _mm_cvttpd_epi32(v1);
+
+			int idx[4];
+			_mm_storel_epi64((__m128i *)idx, i0);
+			_mm_storel_epi64((__m128i *)(idx + 2), i1);
+			for (int k = 0; k < 4; k++) {
+				const uint32_t c = lut[idx[k]];
+				rgb[(x + k) * 3 + 0] = (uint8_t)c;
+				rgb[(x + k) * 3 + 1] = (uint8_t)(c >> 8);
+				rgb[(x + k) * 3 + 2] = (uint8_t)(c >> 16);
+			}
+		}
+#endif
+
+		for (; x < n; x++) {
+			double v = h[x] * (LUT_SIZE - 1) + 0.5;
+			v = v >= 0.0 ? std::min(v, (double)(LUT_SIZE - 1)) : 0.0;
+			const uint32_t c = lut[(int)v];
+			rgb[x * 3 + 0] = (uint8_t)c;
+			rgb[x * 3 + 1] = (uint8_t)(c >> 8);
+			rgb[x * 3 + 2] = (uint8_t)(c >> 16);
+		}
+	}
+
+	std::vector<uint32_t> lut_;
+};
+
+#endif  // _COLORMAP_H_
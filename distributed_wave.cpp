@@ -0,0 +1,425 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "domain_decomp.h"
+
+// 波動方程式を領域分割して複数のプロセスで計算する
+//
+//   distributed_wave [--ranks N] [--block W,H] [--steps S] [--transport shm|tcp] [--port P]
+//                    [--threads T] [--boundary SPEC] [--no-overlap] [--verify]
+//   distributed_wave --weak-scaling 1,2,4,8 [...]
+//   distributed_wave --rank R --hosts FILE [...]
+//
+// 1つ目の形はN個のプロセスをfork()して、shm (共有メモリ) かtcp (localhostの basePort + ランク) で
+// 袖領域を交換する。各ランクは W x H の内部のセルを受け持つので、全体の格子はランク数とともに大きくなる。
+// --weak-scaling はランク数を変えて同じ計算を繰り返し、最初のランク数のときに対する効率を表示する (弱スケーリング)。
+// 3つ目の形は複数のホストで1つずつ起動する。FILEには各ランクが待ち受ける host:port を1行ずつ書く。
+// --verify はランク0に全体を集め、1つのプロセスで全体を計算した結果と比べる。
+
+struct RunOptions {
+	int blockX, blockY;
+	int steps;
+	int threads;           // 0ならコア数をランク数で分ける
+	int basePort;
+	bool tcp;
+	bool overlap;
+	bool verify;
+	EdgeBoundary boundary;
+
+	RunOptions()
+		: blockX(1024)
+		, blockY(1024)
+		, steps(200)
+		, threads(0)
+		, basePort(47000)
+		, tcp(false)
+		, overlap(true)
+		, verify(false) {
+	}
+};
+
+// ランク0が親プロセスに返す結果 (fork() の前に共有メモリに確保する)
+struct RunResult {
+	int ok;
+	int px, py;
+	int globalX, globalY;
+	double seconds;        // 全ランクの最大
+	double waitSeconds;    // 交換を待っていた時間の全ランクの最大
+	double maxDiff;        // --verify の差の最大値
+};
+
+static const double SPEED = 0.5;
+static const double DX = 0.01;
+static const double DT = 0.005;
+static const double LOSS = 0.001;
+
+// 全体の中央にガウス型の山を置く
+static double initialHeight(int x, int y, int globalX, int globalY) {
+	const double cx = 0.5 * (globalX - 1);
+	const double cy = 0.5 * (globalY - 1);
+	const double sigma = std::min(globalX, globalY) / 16.0;
+	const double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+	return std::exp(-r2 / (2.0 * sigma * sigma));
+}
+
+// 1つのランクの計算
+static bool runRank(HaloTransport &transport, const RunOptions &options, RunResult *result) {
+	const int ranks = transport.size();
+	int px, py;
+	chooseProcessGrid(ranks, options.blockX, options.blockY, px, py);
+	const int globalX = options.blockX * px + 2;
+	const int globalY = options.blockY * py + 2;
+
+	DistributedWave wave(transport);
+	if (!wave.setup(globalX, globalY, px, py, SPEED, DX, DT, LOSS, options.boundary)) {
+		return false;
+	}
+	wave.initialize([=](int x, int y) {
+		return initialHeight(x, y, globalX, globalY);
+	});
+
+	if (!transport.barrier()) {
+		return false;
+	}
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int s = 0; s < options.steps; s++) {
+		if (!wave.step(options.overlap)) {
+			return false;
+		}
+	}
+	if (!wave.finish()) {
+		return false;
+	}
+	double times[2] = {
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+		wave.waitSeconds()
+	};
+	if (!transport.allreduce(times, 2, true)) {
+		return false;
+	}
+
+	double maxDiff = 0.0;
+	if (options.verify) {
+		std::vector<double> global;
+		if (!wave.gather(global)) {
+			return false;
+		}
+		if (transport.rank() == 0) {
+			WaveEquation reference;
+			reference.setParams(globalX, globalY, SPEED, DX, DT, LOSS);
+			reference.boundary() = options.boundary;
+			reference.boundary().setCourant(SPEED * DT / DX);
+			for (int y = 0; y < globalY; y++) {
+				for (int x = 0; x < globalX; x++) {
+					reference.set(x, y, initialHeight(x, y, globalX, globalY));
+				}
+			}
+			reference.start();
+			for (int s = 0; s < options.steps; s++) {
+				reference.step();
+			}
+			for (int y = 1; y < globalY - 1; y++) {
+				for (int x = 1; x < globalX - 1; x++) {
+					maxDiff = std::max(maxDiff, std::fabs(global[(size_t)y * globalX + x] - reference.get(x, y)));
+				}
+			}
+		}
+	}
+
+	if (transport.rank() == 0 && result != NULL) {
+		result->ok = 1;
+		result->px = px;
+		result->py = py;
+		result->globalX = globalX;
+		result->globalY = globalY;
+		result->seconds = times[0];
+		result->waitSeconds = times[1];
+		result->maxDiff = maxDiff;
+	}
+	return true;
+}
+
+static void setRankThreads(const RunOptions &options, int ranks) {
+	const int cores = std::max(1, (int)std::thread::hardware_concurrency());
+	ThreadPool::sharedSize() = options.threads > 0 ? options.threads : std::max(1, cores / ranks);
+}
+
+// まだ終わっていないランクを止める (shmの相手を待っているランクもすぐに抜けられるように中止フラグも立てる)
+static void stopRanks(ShmTransport &shm, const std::vector<pid_t> &children, const std::vector<bool> &exited) {
+	shm.abort();
+	for (size_t i = 0; i < children.size(); i++) {
+		if (!exited[i]) {
+			kill(children[i], SIGKILL);
+		}
+	}
+}
+
+// ranks個のプロセスをfork()して計算する (結果はランク0がresultに書く)
+static bool runLocal(int ranks, const RunOptions &options, RunResult &result) {
+	RunResult *shared = (RunResult *)mmap(NULL, sizeof(RunResult), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		fprintf(stderr, "Failed to allocate shared memory\n");
+		return false;
+	}
+	std::memset(shared, 0, sizeof(RunResult));
+
+	ShmTransport shm;
+	if (!options.tcp && !shm.create(ranks)) {
+		munmap(shared, sizeof(RunResult));
+		return false;
+	}
+
+	// スレッドはfork()で引き継がれないので、親ではスレッドプールを使わない
+	fflush(stdout);
+	fflush(stderr);
+	std::vector<pid_t> children;
+	for (int r = 0; r < ranks; r++) {
+		const pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "Failed to start rank %d\n", r);
+			break;
+		}
+		if (pid == 0) {
+			setRankThreads(options, ranks);
+			bool ok;
+			if (options.tcp) {
+				std::vector<std::string> hosts;
+				for (int i = 0; i < ranks; i++) {
+					char address[64];
+					sprintf(address, "127.0.0.1:%d", options.basePort + i);
+					hosts.push_back(address);
+				}
+				TcpTransport tcp;
+				ok = tcp.connect(r, hosts) && runRank(tcp, options, shared);
+			}
+			else {
+				shm.setRank(r);
+				ok = runRank(shm, options, shared);
+				if (!ok) {
+					shm.abort();
+				}
+			}
+			fflush(stdout);
+			fflush(stderr);
+			_exit(ok ? 0 : 1);
+		}
+		children.push_back(pid);
+	}
+
+	// 1つのランクが失敗したら (またはfork()できなかったら) 残りのランクは待たずに止める
+	std::vector<bool> exited(children.size(), false);
+	bool ok = (int)children.size() == ranks;
+	if (!ok) {
+		stopRanks(shm, children, exited);
+	}
+	for (size_t running = children.size(); running > 0; ) {
+		int status = 0;
+		const pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ok = false;
+			break;
+		}
+		const size_t i = std::find(children.begin(), children.end(), pid) - children.begin();
+		if (i == children.size()) {
+			continue;
+		}
+		exited[i] = true;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			if (ok) {
+				fprintf(stderr, "Rank %d failed, stopping the other ranks\n", (int)i);
+				stopRanks(shm, children, exited);
+			}
+			ok = false;
+		}
+	}
+	result = *shared;
+	munmap(shared, sizeof(RunResult));
+	return ok && result.ok;
+}
+
+static void printResult(int ranks, const RunOptions &options, const RunResult &result, double efficiency) {
+	const double cells = (double)(result.globalX - 2) * (result.globalY - 2) * options.steps;
+	printf("%5d  %2dx%-2d  %6dx%-6d  %8.3f  %9.1f  %6.1f%%", ranks, result.px, result.py,
+		result.globalX, result.globalY, result.seconds, cells / result.seconds * 1e-6,
+		100.0 * result.waitSeconds / result.seconds);
+	if (efficiency > 0.0) {
+		printf("  %6.1f%%", 100.0 * efficiency);
+	}
+	if (options.verify) {
+		printf("  diff %.3g", result.maxDiff);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void printHeader(bool weakScaling) {
+	printf("ranks  blocks  grid           seconds  Mcells/s   wait%s\n", weakScaling ? "  efficiency" : "");
+}
+
+static bool parseList(const std::string &text, std::vector<int> &values) {
+	values.clear();
+	size_t begin = 0;
+	while (begin < text.size()) {
+		size_t comma = text.find(',', begin);
+		if (comma == std::string::npos) {
+			comma = text.size();
+		}
+		const int value = atoi(text.substr(begin, comma - begin).c_str());
+		if (value <= 0) {
+			return false;
+		}
+		values.push_back(value);
+		begin = comma + 1;
+	}
+	return !values.empty();
+}
+
+static bool loadHosts(const std::string &filename, std::vector<std::string> &hosts) {
+	FILE *fp = fopen(filename.c_str(), "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", filename.c_str());
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		std::string text(line);
+		text.erase(text.find_last_not_of(" \r\n") + 1);
+		if (!text.empty() && text[0] != '#') {
+			hosts.push_back(text);
+		}
+	}
+	fclose(fp);
+	return !hosts.empty();
+}
+
+int main(int argc, char **argv) {
+	RunOptions options;
+	int ranks = 4;
+	int rank = -1;
+	std::string hostsFile;
+	std::vector<int> weakScaling;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--ranks" && i + 1 < argc) {
+			ranks = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--block" && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d,%d", &options.blockX, &options.blockY) != 2 ||
+				options.blockX < 2 || options.blockY < 2) {
+				fprintf(stderr, "Invalid block size: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "--steps" && i + 1 < argc) {
+			options.steps = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--transport" && i + 1 < argc) {
+			const std::string transport = argv[++i];
+			if (transport != "shm" && transport != "tcp") {
+				fprintf(stderr, "Invalid transport: %s\n", transport.c_str());
+				return 1;
+			}
+			options.tcp = transport == "tcp";
+		}
+		else if (arg == "--port" && i + 1 < argc) {
+			options.basePort = atoi(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--boundary" && i + 1 < argc) {
+			if (!parseEdgeBoundary(argv[++i], options.boundary)) {
+				fprintf(stderr, "Invalid boundary: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "--no-overlap") {
+			options.overlap = false;
+		}
+		else if (arg == "--verify") {
+			options.verify = true;
+		}
+		else if (arg == "--weak-scaling" && i + 1 < argc) {
+			if (!parseList(argv[++i], weakScaling)) {
+				fprintf(stderr, "Invalid rank list: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "--rank" && i + 1 < argc) {
+			rank = atoi(argv[++i]);
+		}
+		else if (arg == "--hosts" && i + 1 < argc) {
+			hostsFile = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	// ホストをまたぐ場合はこのプロセスが1つのランクになる
+	if (rank >= 0 || !hostsFile.empty()) {
+		std::vector<std::string> hosts;
+		if (hostsFile.empty() || !loadHosts(hostsFile, hosts) || rank < 0 || rank >= (int)hosts.size()) {
+			fprintf(stderr, "--rank R and --hosts FILE must be given together (0 <= R < number of hosts)\n");
+			return 1;
+		}
+		setRankThreads(options, 1);
+		TcpTransport tcp;
+		RunResult result;
+		std::memset(&result, 0, sizeof(result));
+		if (!tcp.connect(rank, hosts) || !runRank(tcp, options, &result)) {
+			return 1;
+		}
+		if (rank == 0) {
+			printHeader(false);
+			printResult((int)hosts.size(), options, result, 0.0);
+		}
+		return 0;
+	}
+
+	if (weakScaling.empty()) {
+		weakScaling.push_back(ranks);
+	}
+	fprintf(stderr, "%d x %d cells per rank, %d steps, %s transport%s\n", options.blockX, options.blockY,
+		options.steps, options.tcp ? "tcp" : "shm", options.overlap ? "" : ", no overlap");
+	printHeader(weakScaling.size() > 1);
+
+	double baseSeconds = 0.0;
+	bool ok = true;
+	for (size_t i = 0; i < weakScaling.size(); i++) {
+		RunResult result;
+		if (!runLocal(weakScaling[i], options, result)) {
+			fprintf(stderr, "Run with %d ranks failed\n", weakScaling[i]);
+			ok = false;
+			continue;
+		}
+		// 弱スケーリングの効率 (1ランクあたりの仕事は同じなので、最初のランク数のときとの時間の比)
+		if (baseSeconds == 0.0) {
+			baseSeconds = result.seconds;
+		}
+		const double efficiency = weakScaling.size() > 1 ? baseSeconds / result.seconds : 0.0;
+		printResult(weakScaling[i], options, result, efficiency);
+		if (options.verify && result.maxDiff != 0.0) {
+			ok = false;
+		}
+	}
+	return ok ? 0 : 1;
+}
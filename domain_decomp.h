@@ -0,0 +1,1004 @@
+#ifndef _DOMAIN_DECOMP_H_
+#define _DOMAIN_DECOMP_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "water_eq.h"
+
+// 格子を2次元のブロックに分けて複数のプロセスで計算する (領域分割)
+//
+// 全体の格子 (外周のゴーストセルを含む globalX x globalY) の内部のセルを px x py 個のブロックに分け、
+// 各ランク (プロセス) は自分のブロックの周りに幅1の袖領域 (ゴーストセル) を付けた
+// WaveEquationを持つ。毎ステップ、ブロックの端の行・列を隣のランクに送り、
+// 隣から受け取った値を袖領域に書き込む。全体の外周は全体と同じ境界の方針、
+// 分割の内側の辺は BOUNDARY_HALO (何もしない) になる。
+// 5点のラプラシアンの計算は1つのプロセスで全体を計算した場合と同じ値になる。
+//
+// 通信はMPIのように、ランクと (相手, タグ) で区別したメッセージの送受信で行う。
+// 外部のライブラリやサービスは使わず、次の2つを用意してある:
+//   ShmTransport  1つのホストの中 (fork() したプロセスの間の共有メモリ)
+//   TcpTransport  TCP (ホストをまたぐ場合。localhostで試せる)
+
+// 1つのメッセージ (送信なら data から、受信なら data へ bytes バイト)
+struct HaloMessage {
+	int peer;
+	int tag;
+	void *data;
+	size_t bytes;
+};
+
+inline HaloMessage haloMessage(int peer, int tag, void *data, size_t bytes) {
+	HaloMessage message;
+	message.peer = peer;
+	message.tag = tag;
+	message.data = data;
+	message.bytes = bytes;
+	return message;
+}
+
+static const int HALO_NUM_TAGS = 5;          // 袖領域の4方向 (BoundaryEdge) と集団通信
+static const int HALO_TAG_COLLECTIVE = 4;
+static const int HALO_TIMEOUT_MS = 10000;    // この間どのメッセージも進まなければ失敗にする
+
+class HaloTransport {
+public:
+	virtual ~HaloTransport() {
+	}
+
+	virtual int rank() const = 0;
+	virtual int size() const = 0;
+
+	// sendsとrecvsがすべて終わるまで進める (どの順番で呼び合ってもデッドロックしない)
+	// 1回の呼び出しで同じ (相手, タグ) に送る・から受け取るメッセージは1つまで
+	virtual bool exchange(const std::vector<HaloMessage> &sends, const std::vector<HaloMessage> &recvs) = 0;
+
+	// 全ランクのvaluesの和または最大値を全ランクに配る (ランク0に集めてから配る)
+	bool allreduce(double *values, int n, bool useMax) {
+		const size_t bytes = sizeof(double) * n;
+		std::vector<HaloMessage> sends, recvs;
+		if (rank() == 0) {
+			std::vector<double> all((size_t)n * size());
+			for (int r = 1; r < size(); r++) {
+				recvs.push_back(haloMessage(r, HALO_TAG_COLLECTIVE, &all[(size_t)r * n], bytes));
+			}
+			if (!exchange(sends, recvs)) {
+				return false;
+			}
+			for (int r = 1; r < size(); r++) {
+				for (int i = 0; i < n; i++) {
+					const double v = all[(size_t)r * n + i];
+					values[i] = useMax ? std::max(values[i], v) : values[i] + v;
+				}
+			}
+			recvs.clear();
+			for (int r = 1; r < size(); r++) {
+				sends.push_back(haloMessage(r, HALO_TAG_COLLECTIVE, values, bytes));
+			}
+		}
+		else {
+			sends.push_back(haloMessage(0, HALO_TAG_COLLECTIVE, values, bytes));
+			if (!exchange(sends, recvs)) {
+				return false;
+			}
+			sends.clear();
+			recvs.push_back(haloMessage(0, HALO_TAG_COLLECTIVE, values, bytes));
+		}
+		return exchange(sends, recvs);
+	}
+
+	bool barrier() {
+		double value = 0.0;
+		return allreduce(&value, 1, false);
+	}
+};
+
+#if !defined(_WIN32)
+
+// 共有メモリを使う通信 (1つのホストの中)
+//
+// (送信元, 送信先, タグ) ごとに1つのスロットを持ち、スロットより大きいメッセージは分けて送る。
+// create() でfork()の前に無名の共有メモリを確保し、子プロセスでsetRank()を呼ぶ。
+// 相手が終了してもスロットからは分からないので、失敗したランク (または親プロセス) が abort() で
+// 共有の中止フラグを立て、待っている側は HALO_TIMEOUT_MS 進まないか中止フラグを見たら失敗を返す。
+class ShmTransport : public HaloTransport {
+public:
+	static const size_t SLOT_BYTES = 32 << 10;
+
+	ShmTransport()
+		: rank_(0)
+		, size_(0)
+		, header_(NULL)
+		, slots_(NULL)
+		, bytes_(0) {
+	}
+
+	virtual ~ShmTransport() {
+		if (header_ != NULL) {
+			munmap(header_, bytes_);
+		}
+	}
+
+	bool create(int size) {
+		size_ = size;
+		bytes_ = sizeof(Header) + sizeof(Slot) * size * size * HALO_NUM_TAGS;
+		void *ptr = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) {
+			fprintf(stderr, "Failed to allocate shared memory (%.1f MB)\n", bytes_ / (1024.0 * 1024.0));
+			return false;
+		}
+		header_ = (Header *)ptr;  // 0で初期化されている (中止フラグもスロットもすべて空)
+		slots_ = (Slot *)(header_ + 1);
+		return true;
+	}
+
+	// 全ランクの exchange() を失敗させる
+	void abort() {
+		if (header_ != NULL) {
+			header_->aborted.store(1, std::memory_order_release);
+		}
+	}
+
+	bool aborted() const {
+		return header_ != NULL && header_->aborted.load(std::memory_order_acquire) != 0;
+	}
+
+	void setRank(int rank) {
+		rank_ = rank;
+	}
+
+	virtual int rank() const {
+		return rank_;
+	}
+
+	virtual int size() const {
+		return size_;
+	}
+
+	virtual bool exchange(const std::vector<HaloMessage> &sends, const std::vector<HaloMessage> &recvs) {
+		std::vector<size_t> sent(sends.size(), 0), received(recvs.size(), 0);
+		std::chrono::steady_clock::time_point lastProgress = std::chrono::steady_clock::now();
+		for (;;) {
+			bool finished = true;
+			bool progressed = false;
+
+			// 空いているスロットに次の部分を書き込む
+			for (size_t i = 0; i < sends.size(); i++) {
+				const HaloMessage &m = sends[i];
+				if (sent[i] == m.bytes) {
+					continue;
+				}
+				finished = false;
+				Slot &slot = this->slot(rank_, m.peer, m.tag);
+				if (slot.full.load(std::memory_order_acquire) == 0) {
+					const size_t n = std::min(SLOT_BYTES, m.bytes - sent[i]);
+					std::memcpy(slot.data, (const char *)m.data + sent[i], n);
+					slot.bytes = (uint32_t)n;
+					slot.full.store(1, std::memory_order_release);
+					sent[i] += n;
+					progressed = true;
+				}
+			}
+
+			// 埋まっているスロットから読み出す
+			for (size_t i = 0; i < recvs.size(); i++) {
+				const HaloMessage &m = recvs[i];
+				if (received[i] == m.bytes) {
+					continue;
+				}
+				finished = false;
+				Slot &slot = this->slot(m.peer, rank_, m.tag);
+				if (slot.full.load(std::memory_order_acquire) != 0) {
+					const size_t n = std::min<size_t>(slot.bytes, m.bytes - received[i]);
+					std::memcpy((char *)m.data + received[i], slot.data, n);
+					slot.full.store(0, std::memory_order_release);
+					received[i] += n;
+					progressed = true;
+				}
+			}
+
+			if (finished) {
+				return true;
+			}
+			if (progressed) {
+				lastProgress = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			if (aborted()) {
+				fprintf(stderr, "Rank %d: halo exchange aborted\n", rank_);
+				return false;
+			}
+			if (std::chrono::steady_clock::now() - lastProgress > std::chrono::milliseconds(HALO_TIMEOUT_MS)) {
+				fprintf(stderr, "Rank %d: halo exchange timed out\n", rank_);
+				abort();
+				return false;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	ShmTransport(const ShmTransport &);
+	ShmTransport & operator=(const ShmTransport &);
+
+	struct Header {
+		std::atomic<uint32_t> aborted;
+		char padding[60];
+	};
+
+	struct Slot {
+		std::atomic<uint32_t> full;
+		uint32_t bytes;
+		char padding[56];
+		char data[SLOT_BYTES];
+	};
+
+	Slot &slot(int from, int to, int tag) {
+		return slots_[((size_t)from * size_ + to) * HALO_NUM_TAGS + tag];
+	}
+
+	int rank_, size_;
+	Header *header_;
+	Slot *slots_;
+	size_t bytes_;
+};
+
+// TCPを使う通信
+//
+// ランクrは hosts[r] ("host:port") で待ち受け、自分より小さいランクには自分から接続する。
+// メッセージには (タグ, バイト数) のヘッダを付け、ソケットはノンブロッキングにして
+// poll() で送れるもの・受け取れるものから進める。
+class TcpTransport : public HaloTransport {
+public:
+	TcpTransport()
+		: rank_(0)
+		, size_(0) {
+	}
+
+	virtual ~TcpTransport() {
+		close();
+	}
+
+	bool connect(int rank, const std::vector<std::string> &hosts, double timeoutSeconds = 30.0) {
+		close();
+		rank_ = rank;
+		size_ = (int)hosts.size();
+		sockets_.assign(size_, -1);
+
+		const int listener = listenOn(hosts[rank_]);
+		if (listener < 0) {
+			return false;
+		}
+
+		// 小さいランクへは自分から接続する (相手がまだ待ち受けていなければ待つ)
+		bool ok = true;
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds((long long)(timeoutSeconds * 1000.0));
+		for (int r = 0; ok && r < rank_; r++) {
+			for (;;) {
+				sockets_[r] = connectTo(hosts[r]);
+				if (sockets_[r] >= 0 || std::chrono::steady_clock::now() > deadline) {
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+			const int32_t id = rank_;
+			ok = sockets_[r] >= 0 && writeAll(sockets_[r], &id, sizeof(id));
+		}
+
+		// 大きいランクからの接続を受け付ける
+		for (int i = rank_ + 1; ok && i < size_; i++) {
+			const int fd = accept(listener, NULL, NULL);
+			int32_t id = -1;
+			if (fd < 0 || !readAll(fd, &id, sizeof(id)) || id <= rank_ || id >= size_ || sockets_[id] >= 0) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+				ok = false;
+				break;
+			}
+			sockets_[id] = fd;
+		}
+		::close(listener);
+
+		if (!ok) {
+			fprintf(stderr, "Rank %d: failed to connect to the other ranks\n", rank_);
+			close();
+			return false;
+		}
+
+		for (int r = 0; r < size_; r++) {
+			if (sockets_[r] >= 0) {
+				const int one = 1;
+				setsockopt(sockets_[r], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				fcntl(sockets_[r], F_SETFL, fcntl(sockets_[r], F_GETFL) | O_NONBLOCK);
+			}
+		}
+		return true;
+	}
+
+	void close() {
+		for (size_t i = 0; i < sockets_.size(); i++) {
+			if (sockets_[i] >= 0) {
+				::close(sockets_[i]);
+			}
+		}
+		sockets_.clear();
+	}
+
+	virtual int rank() const {
+		return rank_;
+	}
+
+	virtual int size() const {
+		return size_;
+	}
+
+	virtual bool exchange(const std::vector<HaloMessage> &sends, const std::vector<HaloMessage> &recvs) {
+		// 相手ごとに、送るもの (ヘッダと本体) と受け取るものを並べる
+		std::vector<std::vector<Outgoing> > outgoing(size_);
+		std::vector<std::vector<size_t> > incoming(size_);
+		std::vector<size_t> received(recvs.size(), 0);
+		std::vector<bool> done(recvs.size(), false);
+
+		for (size_t i = 0; i < sends.size(); i++) {
+			const HaloMessage &m = sends[i];
+			if (m.peer == rank_) {
+				// 自分宛てはそのままコピーする
+				for (size_t j = 0; j < recvs.size(); j++) {
+					if (recvs[j].peer == rank_ && recvs[j].tag == m.tag && !done[j]) {
+						std::memcpy(recvs[j].data, m.data, std::min(m.bytes, recvs[j].bytes));
+						done[j] = true;
+						break;
+					}
+				}
+				continue;
+			}
+			Outgoing out;
+			out.header.tag = (uint32_t)m.tag;
+			out.header.reserved = 0;
+			out.header.bytes = m.bytes;
+			out.data = (const char *)m.data;
+			out.offset = 0;
+			outgoing[m.peer].push_back(out);
+		}
+		for (size_t j = 0; j < recvs.size(); j++) {
+			if (recvs[j].peer != rank_) {
+				incoming[recvs[j].peer].push_back(j);
+			}
+		}
+
+		// 相手ごとの受信中のメッセージ (ヘッダを読み終わるまでは-1)
+		std::vector<Header> headers(size_);
+		std::vector<size_t> headerBytes(size_, 0);
+		std::vector<int> current(size_, -1);
+
+		for (;;) {
+			std::vector<pollfd> fds;
+			for (int r = 0; r < size_; r++) {
+				short events = 0;
+				if (!outgoing[r].empty()) {
+					events |= POLLOUT;
+				}
+				if (!incoming[r].empty()) {
+					events |= POLLIN;
+				}
+				if (events != 0) {
+					pollfd fd;
+					fd.fd = sockets_[r];
+					fd.events = events;
+					fd.revents = 0;
+					fds.push_back(fd);
+				}
+			}
+			if (fds.empty()) {
+				return true;
+			}
+			if (poll(&fds[0], fds.size(), HALO_TIMEOUT_MS) <= 0) {
+				fprintf(stderr, "Rank %d: halo exchange timed out\n", rank_);
+				return false;
+			}
+
+			for (size_t f = 0; f < fds.size(); f++) {
+				const int r = peerOf(fds[f].fd);
+				if (fds[f].revents & (POLLERR | POLLNVAL)) {
+					fprintf(stderr, "Rank %d: connection to rank %d failed\n", rank_, r);
+					return false;
+				}
+				if ((fds[f].revents & POLLOUT) && !sendSome(r, outgoing[r])) {
+					return false;
+				}
+				if ((fds[f].revents & (POLLIN | POLLHUP)) &&
+					!receiveSome(r, recvs, incoming[r], headers[r], headerBytes[r], current[r], received)) {
+					return false;
+				}
+			}
+		}
+	}
+
+private:
+	TcpTransport(const TcpTransport &);
+	TcpTransport & operator=(const TcpTransport &);
+
+	struct Header {
+		uint32_t tag;
+		uint32_t reserved;
+		uint64_t bytes;
+	};
+
+	struct Outgoing {
+		Header header;
+		const char *data;
+		size_t offset;  // ヘッダと本体を合わせて送った量
+	};
+
+	int peerOf(int fd) const {
+		for (int r = 0; r < size_; r++) {
+			if (sockets_[r] == fd) {
+				return r;
+			}
+		}
+		return -1;
+	}
+
+	// 先頭のメッセージから送れるだけ送る
+	bool sendSome(int r, std::vector<Outgoing> &queue) {
+		while (!queue.empty()) {
+			Outgoing &out = queue.front();
+			const size_t total = sizeof(Header) + out.header.bytes;
+			const char *ptr;
+			size_t n;
+			if (out.offset < sizeof(Header)) {
+				ptr = (const char *)&out.header + out.offset;
+				n = sizeof(Header) - out.offset;
+			}
+			else {
+				ptr = out.data + (out.offset - sizeof(Header));
+				n = total - out.offset;
+			}
+			const ssize_t written = n > 0 ? send(sockets_[r], ptr, n, MSG_NOSIGNAL) : 0;
+			if (written < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+					return true;
+				}
+				fprintf(stderr, "Rank %d: failed to send to rank %d\n", rank_, r);
+				return false;
+			}
+			out.offset += written;
+			if (out.offset == total) {
+				queue.erase(queue.begin());
+			}
+			else if (written == 0 || (size_t)written < n) {
+				return true;
+			}
+		}
+		return true;
+	}
+
+	// 読めるだけ読む (受け取る予定のメッセージが終わったら、次のステップの分は読まずに残す)
+	bool receiveSome(int r, const std::vector<HaloMessage> &recvs, std::vector<size_t> &pending,
+		Header &header, size_t &headerBytes, int &current, std::vector<size_t> &received) {
+		while (!pending.empty()) {
+			char *ptr;
+			size_t n;
+			if (current < 0) {
+				ptr = (char *)&header + headerBytes;
+				n = sizeof(Header) - headerBytes;
+			}
+			else {
+				ptr = (char *)recvs[current].data + received[current];
+				n = recvs[current].bytes - received[current];
+			}
+
+			ssize_t got = 0;
+			if (n > 0) {
+				got = recv(sockets_[r], ptr, n, 0);
+				if (got == 0) {
+					fprintf(stderr, "Rank %d: rank %d closed the connection\n", rank_, r);
+					return false;
+				}
+				if (got < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+						return true;
+					}
+					fprintf(stderr, "Rank %d: failed to receive from rank %d\n", rank_, r);
+					return false;
+				}
+			}
+
+			if (current < 0) {
+				headerBytes += got;
+				if (headerBytes < sizeof(Header)) {
+					return true;
+				}
+				headerBytes = 0;
+				for (size_t k = 0; k < pending.size(); k++) {
+					if (recvs[pending[k]].tag == (int)header.tag) {
+						current = (int)pending[k];
+						break;
+					}
+				}
+				if (current < 0 || recvs[current].bytes != header.bytes) {
+					fprintf(stderr, "Rank %d: unexpected message from rank %d (tag %u, %llu bytes)\n",
+						rank_, r, header.tag, (unsigned long long)header.bytes);
+					return false;
+				}
+			}
+			else {
+				received[current] += got;
+			}
+
+			if (received[current] == recvs[current].bytes) {
+				pending.erase(std::find(pending.begin(), pending.end(), (size_t)current));
+				current = -1;
+			}
+		}
+		return true;
+	}
+
+	static bool resolve(const std::string &address, bool passive, addrinfo **result) {
+		const size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			fprintf(stderr, "Invalid address (expected host:port): %s\n", address.c_str());
+			return false;
+		}
+		const std::string host = address.substr(0, colon);
+		const std::string port = address.substr(colon + 1);
+
+		addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = passive ? AI_PASSIVE : 0;
+		if (getaddrinfo(passive ? NULL : host.c_str(), port.c_str(), &hints, result) != 0) {
+			fprintf(stderr, "Failed to resolve %s\n", address.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	static int listenOn(const std::string &address) {
+		addrinfo *info = NULL;
+		if (!resolve(address, true, &info)) {
+			return -1;
+		}
+		const int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		const int one = 1;
+		if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+			bind(fd, info->ai_addr, info->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+			fprintf(stderr, "Failed to listen on %s\n", address.c_str());
+			if (fd >= 0) {
+				::close(fd);
+			}
+			freeaddrinfo(info);
+			return -1;
+		}
+		freeaddrinfo(info);
+		return fd;
+	}
+
+	static int connectTo(const std::string &address) {
+		addrinfo *info = NULL;
+		if (!resolve(address, false, &info)) {
+			return -1;
+		}
+		int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (fd >= 0 && ::connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+			::close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(info);
+		return fd;
+	}
+
+	static bool writeAll(int fd, const void *data, size_t bytes) {
+		const char *ptr = (const char *)data;
+		while (bytes > 0) {
+			const ssize_t n = send(fd, ptr, bytes, MSG_NOSIGNAL);
+			if (n <= 0) {
+				return false;
+			}
+			ptr += n;
+			bytes -= n;
+		}
+		return true;
+	}
+
+	static bool readAll(int fd, void *data, size_t bytes) {
+		char *ptr = (char *)data;
+		while (bytes > 0) {
+			const ssize_t n = recv(fd, ptr, bytes, 0);
+			if (n <= 0) {
+				return false;
+			}
+			ptr += n;
+			bytes -= n;
+		}
+		return true;
+	}
+
+	int rank_, size_;
+	std::vector<int> sockets_;  // ランクごとの接続 (自分は-1)
+};
+
+#endif  // !_WIN32
+
+// 1つのランクが受け持つブロック
+struct DomainBlock {
+	int px, py;          // ブロックの並び
+	int bx, by;          // このブロックの位置
+	int x0, y0;          // 全体の内部のセルの中での位置 (全体の格子ではセル (x0 + 1, y0 + 1) から)
+	int nx, ny;          // 内部のセルの数
+	int neighbor[4];     // 辺 (BoundaryEdge) ごとの隣のランク (全体の外周なら-1)
+};
+
+// 内部のセル innerX x innerY をほぼ等分する (ランクは x が先に進む順)
+// 周期境界の向きは反対側のブロックを隣とする
+inline DomainBlock decomposeDomain(int innerX, int innerY, int px, int py, int rank,
+	bool periodicX = false, bool periodicY = false) {
+	DomainBlock block;
+	block.px = px;
+	block.py = py;
+	block.bx = rank % px;
+	block.by = rank / px;
+	block.x0 = (int)((long long)innerX * block.bx / px);
+	block.y0 = (int)((long long)innerY * block.by / py);
+	block.nx = (int)((long long)innerX * (block.bx + 1) / px) - block.x0;
+	block.ny = (int)((long long)innerY * (block.by + 1) / py) - block.y0;
+
+	const int bx = block.bx, by = block.by;
+	block.neighbor[EDGE_LEFT] = bx > 0 ? rank - 1 : (periodicX ? rank + px - 1 : -1);
+	block.neighbor[EDGE_RIGHT] = bx < px - 1 ? rank + 1 : (periodicX ? rank - px + 1 : -1);
+	block.neighbor[EDGE_TOP] = by > 0 ? rank - px : (periodicY ? rank + px * (py - 1) : -1);
+	block.neighbor[EDGE_BOTTOM] = by < py - 1 ? rank + px : (periodicY ? rank - px * (py - 1) : -1);
+	return block;
+}
+
+// ranks個のブロックの並びを、ブロックが正方形に近くなるように選ぶ
+inline void chooseProcessGrid(int ranks, int innerX, int innerY, int &px, int &py) {
+	px = ranks;
+	py = 1;
+	double best = -1.0;
+	for (int x = 1; x <= ranks; x++) {
+		if (ranks % x != 0) {
+			continue;
+		}
+		const int y = ranks / x;
+		const double w = (double)innerX / x;
+		const double h = (double)innerY / y;
+		const double score = std::min(w, h) / std::max(w, h);
+		if (score > best) {
+			best = score;
+			px = x;
+			py = y;
+		}
+	}
+}
+
+// 領域分割した波動方程式の1つのランク
+//
+// step() は前のステップで始めた袖領域の交換が終わるのを待ち、外周の帯を計算してから
+// その端の行・列を送る交換を別スレッドで始め、交換と並行して内側を計算する
+// (WaveEquation::stepPipelined())。次のステップの袖領域は、このステップの内側を計算している間に届く。
+// 5点のラプラシアン (袖領域の幅1) だけに対応する。
+class DistributedWave {
+public:
+	explicit DistributedWave(HaloTransport &transport)
+		: transport_(transport)
+		, globalX_(0)
+		, globalY_(0)
+		, target_(NULL)
+		, pending_(false)
+		, exchangeStarted_(false)
+		, exchangeDone_(false)
+		, exchangeOk_(true)
+		, stopping_(false)
+		, computeSeconds_(0.0)
+		, waitSeconds_(0.0) {
+		std::memset(&block_, 0, sizeof(block_));
+	}
+
+	virtual ~DistributedWave() {
+		finish();
+		if (thread_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			cond_.notify_all();
+			thread_.join();
+		}
+	}
+
+	// 全体の格子 globalX x globalY (外周のゴーストセルを含む) をpx x pyに分けた、このランクの部分を用意する
+	bool setup(int globalX, int globalY, int px, int py, double speed, double dx, double dt, double loss,
+		const EdgeBoundary &boundary) {
+		if (px * py != transport_.size()) {
+			fprintf(stderr, "%d x %d blocks do not match %d ranks\n", px, py, transport_.size());
+			return false;
+		}
+
+		globalX_ = globalX;
+		globalY_ = globalY;
+		const bool periodicX = boundary.kind(EDGE_LEFT) == BOUNDARY_PERIODIC;
+		const bool periodicY = boundary.kind(EDGE_TOP) == BOUNDARY_PERIODIC;
+		block_ = decomposeDomain(globalX - 2, globalY - 2, px, py, transport_.rank(), periodicX, periodicY);
+		if (block_.nx < 2 || block_.ny < 2) {
+			fprintf(stderr, "Blocks must have at least 2 x 2 cells\n");
+			return false;
+		}
+
+		solver_.setParams(block_.nx + 2, block_.ny + 2, speed, dx, dt, loss);
+		solver_.boundary() = boundary;
+		solver_.boundary().setCourant(speed * dt / dx);
+		for (int e = 0; e < 4; e++) {
+			if (block_.neighbor[e] >= 0) {
+				solver_.boundary().set((BoundaryEdge)e, BOUNDARY_HALO);
+			}
+		}
+
+		const int lengths[4] = { block_.ny, block_.ny, block_.nx, block_.nx };
+		for (int e = 0; e < 4; e++) {
+			sendBuffer_[e].assign(lengths[e], 0.0);
+			recvBuffer_[e].assign(lengths[e], 0.0);
+		}
+
+		// 袖領域の交換は毎ステップ同じなので、メッセージの並びを作っておく
+		// 自分の辺eの値はタグeで送り、隣は反対側の辺の袖領域として受け取る
+		static const int opposite[4] = { EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM, EDGE_TOP };
+		sends_.clear();
+		recvs_.clear();
+		for (int e = 0; e < 4; e++) {
+			if (block_.neighbor[e] >= 0) {
+				sends_.push_back(haloMessage(block_.neighbor[e], e, &sendBuffer_[e][0], sizeof(double) * lengths[e]));
+				recvs_.push_back(haloMessage(block_.neighbor[e], opposite[e], &recvBuffer_[e][0], sizeof(double) * lengths[e]));
+			}
+		}
+
+		if (!thread_.joinable()) {
+			thread_ = std::thread(&DistributedWave::exchangeLoop, this);
+		}
+		return true;
+	}
+
+	// 全体の座標 (gx, gy) の値を返す関数で、袖領域を含むこのランクの部分を初期化する
+	template <class Func>
+	void initialize(Func func) {
+		for (int y = 0; y < block_.ny + 2; y++) {
+			for (int x = 0; x < block_.nx + 2; x++) {
+				solver_.set(x, y, func(block_.x0 + x, block_.y0 + y));
+			}
+		}
+		solver_.start();
+	}
+
+	// 1ステップ進める (overlap = falseなら交換を終えてから全体を計算する)
+	bool step(bool overlap = true) {
+		const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		if (!overlap) {
+			bool ok = finish();
+			packHalo(solver_.currentGrid());
+			ok = transport_.exchange(sends_, recvs_) && ok;
+			unpackHalo(solver_.currentGrid());
+			const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+			solver_.stepRect(1, 1, block_.nx + 1, block_.ny + 1);
+			solver_.finishStep();
+			waitSeconds_ += std::chrono::duration<double>(t1 - t0).count();
+			computeSeconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+			return ok;
+		}
+
+		// 最初のステップでは初期値の袖領域を交換する
+		if (!pending_) {
+			packHalo(solver_.currentGrid());
+			startExchange(solver_.currentGrid());
+		}
+		const bool ok = finish();
+		const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+		// 帯と境界ができたら送り始め、内側の計算と重ねる
+		solver_.stepPipelined([this](const Grid2D<double> &next) {
+			packHalo(next);
+			startExchange(next);
+		});
+
+		waitSeconds_ += std::chrono::duration<double>(t1 - t0).count();
+		computeSeconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+		return ok;
+	}
+
+	// 送り始めた交換が終わるのを待つ (transportを他の通信に使う前に呼ぶ)
+	bool finish() {
+		if (!pending_) {
+			return true;
+		}
+		pending_ = false;
+		std::unique_lock<std::mutex> lock(mutex_);
+		cond_.wait(lock, [this] { return exchangeDone_; });
+		return exchangeOk_;
+	}
+
+	// 全体の内部の値をランク0に集める (ランク0の global に globalX x globalY で入る。外周は0)
+	bool gather(std::vector<double> &global) {
+		if (!finish()) {
+			return false;
+		}
+		std::vector<double> local((size_t)block_.nx * block_.ny);
+		for (int y = 0; y < block_.ny; y++) {
+			for (int x = 0; x < block_.nx; x++) {
+				local[(size_t)y * block_.nx + x] = solver_.get(x + 1, y + 1);
+			}
+		}
+
+		std::vector<HaloMessage> sends, recvs;
+		if (transport_.rank() != 0) {
+			sends.push_back(haloMessage(0, HALO_TAG_COLLECTIVE, &local[0], sizeof(double) * local.size()));
+			return transport_.exchange(sends, recvs);
+		}
+
+		std::vector<std::vector<double> > parts(transport_.size());
+		for (int r = 1; r < transport_.size(); r++) {
+			const DomainBlock b = decomposeDomain(globalX_ - 2, globalY_ - 2, block_.px, block_.py, r);
+			parts[r].resize((size_t)b.nx * b.ny);
+			recvs.push_back(haloMessage(r, HALO_TAG_COLLECTIVE, &parts[r][0], sizeof(double) * parts[r].size()));
+		}
+		parts[0].swap(local);
+		if (!transport_.exchange(sends, recvs)) {
+			return false;
+		}
+
+		global.assign((size_t)globalX_ * globalY_, 0.0);
+		for (int r = 0; r < transport_.size(); r++) {
+			const DomainBlock b = decomposeDomain(globalX_ - 2, globalY_ - 2, block_.px, block_.py, r);
+			for (int y = 0; y < b.ny; y++) {
+				std::memcpy(&global[(size_t)(b.y0 + 1 + y) * globalX_ + b.x0 + 1],
+					&parts[r][(size_t)y * b.nx], sizeof(double) * b.nx);
+			}
+		}
+		return true;
+	}
+
+	const DomainBlock &block() const {
+		return block_;
+	}
+
+	WaveEquation &solver() {
+		return solver_;
+	}
+
+	// 計算にかかった時間と、交換を待っていた時間 (秒)
+	double computeSeconds() const {
+		return computeSeconds_;
+	}
+
+	double waitSeconds() const {
+		return waitSeconds_;
+	}
+
+private:
+	DistributedWave(const DistributedWave &);
+	DistributedWave & operator=(const DistributedWave &);
+
+	// gridの端の行・列を送信バッファに詰める
+	void packHalo(const Grid2D<double> &grid) {
+		const int nx = block_.nx;
+		const int ny = block_.ny;
+		for (int y = 0; y < ny; y++) {
+			sendBuffer_[EDGE_LEFT][y] = grid.at(1, y + 1);
+			sendBuffer_[EDGE_RIGHT][y] = grid.at(nx, y + 1);
+		}
+		std::memcpy(&sendBuffer_[EDGE_TOP][0], &grid.at(1, 1), sizeof(double) * nx);
+		std::memcpy(&sendBuffer_[EDGE_BOTTOM][0], &grid.at(1, ny), sizeof(double) * nx);
+	}
+
+	// 受け取った値をgridの袖領域に書き込む
+	// (内側の計算は袖領域を読まず、境界処理は送り始める前に終わっているので、計算中に書き込んでよい)
+	void unpackHalo(const Grid2D<double> &grid) {
+		const int nx = block_.nx;
+		const int ny = block_.ny;
+		for (int e = 0; e < 4; e++) {
+			if (block_.neighbor[e] < 0) {
+				continue;
+			}
+			const double *values = &recvBuffer_[e][0];
+			if (e == EDGE_LEFT || e == EDGE_RIGHT) {
+				const int x = e == EDGE_LEFT ? 0 : nx + 1;
+				for (int y = 0; y < ny; y++) {
+					grid.at(x, y + 1) = values[y];
+				}
+			}
+			else {
+				const int y = e == EDGE_TOP ? 0 : ny + 1;
+				std::memcpy(&grid.at(1, y), values, sizeof(double) * nx);
+			}
+		}
+	}
+
+	// 通信用のスレッドで交換を始め、受け取った値はtargetの袖領域に書き込む
+	void startExchange(const Grid2D<double> &target) {
+		pending_ = true;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			target_ = &target;
+			exchangeStarted_ = true;
+			exchangeDone_ = false;
+		}
+		cond_.notify_all();
+	}
+
+	// 通信用のスレッド
+	void exchangeLoop() {
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				cond_.wait(lock, [this] { return exchangeStarted_ || stopping_; });
+				if (stopping_) {
+					return;
+				}
+				exchangeStarted_ = false;
+			}
+
+			const bool ok = transport_.exchange(sends_, recvs_);
+			if (ok) {
+				unpackHalo(*target_);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				exchangeOk_ = ok;
+				exchangeDone_ = true;
+			}
+			cond_.notify_all();
+		}
+	}
+
+	HaloTransport &transport_;
+	int globalX_, globalY_;
+	DomainBlock block_;
+	WaveEquation solver_;
+	std::vector<double> sendBuffer_[4];
+	std::vector<double> recvBuffer_[4];
+	std::vector<HaloMessage> sends_;
+	std::vector<HaloMessage> recvs_;
+
+	const Grid2D<double> *target_;  // 交換中の袖領域の書き込み先
+	bool pending_;                  // 交換を始めて、まだ終わるのを待っていない
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool exchangeStarted_;
+	bool exchangeDone_;
+	bool exchangeOk_;
+	bool stopping_;
+
+	double computeSeconds_;
+	double waitSeconds_;
+};
+
+#endif  // _DOMAIN_DECOMP_H_
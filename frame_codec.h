@@ -0,0 +1,639 @@
+#ifndef _FRAME_CODEC_H_
+#define _FRAME_CODEC_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "parallel.h"
+
+// heights()の時系列を圧縮して保存する形式
+//
+// 1. フレームごとの最小値とスケールで16ビットに量子化する
+// 2. 前のフレームの復元値から予測した値との差分をとる
+//    (キーフレームでは同じ行の左隣との差分をとる)
+// 3. 差分をジグザグ符号化して下位バイトと上位バイトの面に分け、それぞれをRLEで圧縮する
+//
+// フレームは行方向のタイルに分けて、タイルごとに独立に (並列に) 符号化する。
+// キーフレームは他のフレームを参照しないので、そこから復号を始めればどのフレームにも移動できる。
+//
+// ファイルの形式
+//   [FrameFileHeader]
+//   [FrameHeader][タイルのバイト数 x numTiles][タイルのデータ] の繰り返し
+//   [フレームの索引 (FrameIndexEntry x numFrames)][FrameFileTrailer]
+
+static const uint32_t FRAME_FILE_MAGIC = 0x43524d46;   // "FMRC"
+static const uint32_t FRAME_FILE_VERSION = 1;
+static const uint32_t FRAME_HEADER_MAGIC = 0x4d524643;  // "CFRM"
+static const uint32_t FRAME_TRAILER_MAGIC = 0x58444e49; // "INDX"
+
+struct FrameFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t xCells;
+	int32_t yCells;
+	int32_t tileRows;
+	int32_t keyframeInterval;
+};
+
+struct FrameHeader {
+	uint32_t magic;
+	uint32_t keyframe;
+	uint64_t step;
+	double offset;  // 量子化の原点 (フレームの最小値)
+	double scale;   // 量子化の幅
+	uint32_t numTiles;
+	uint32_t reserved;
+};
+
+struct FrameIndexEntry {
+	uint64_t fileOffset;
+	uint64_t step;
+	uint32_t keyframe;
+	uint32_t reserved;
+};
+
+struct FrameFileTrailer {
+	uint64_t indexOffset;
+	uint64_t numFrames;
+	uint32_t magic;
+	uint32_t reserved;
+};
+
+namespace frame_codec {
+
+inline uint16_t zigzag(uint16_t d) {
+	const int16_t s = (int16_t)d;
+	return (uint16_t)((s << 1) ^ (s >> 15));
+}
+
+inline uint16_t unzigzag(uint16_t z) {
+	return (uint16_t)((z >> 1) ^ (uint16_t)(-(int)(z & 1)));
+}
+
+// RLE符号化
+//   制御バイト c < 128  : 続くc+1バイトをそのままコピー
+//   制御バイト c >= 128 : 続く1バイトを(c-128)+3回繰り返す
+inline void rleEncode(const uint8_t *src, size_t n, std::vector<uint8_t> &out) {
+	static const size_t MAX_LITERAL = 128;
+	static const size_t MIN_RUN = 3;
+	static const size_t MAX_RUN = 127 + MIN_RUN;
+
+	size_t i = 0;
+	size_t literalStart = 0;
+	while (i < n) {
+		size_t run = 1;
+		while (i + run < n && run < MAX_RUN && src[i + run] == src[i]) {
+			run++;
+		}
+
+		if (run >= MIN_RUN) {
+			// 溜まっているリテラルを出力してから繰り返しを出力する
+			while (literalStart < i) {
+				const size_t len = std::min(MAX_LITERAL, i - literalStart);
+				out.push_back((uint8_t)(len - 1));
+				out.insert(out.end(), src + literalStart, src + literalStart + len);
+				literalStart += len;
+			}
+			out.push_back((uint8_t)(128 + run - MIN_RUN));
+			out.push_back(src[i]);
+			i += run;
+			literalStart = i;
+		}
+		else {
+			i += run;
+		}
+	}
+
+	while (literalStart < n) {
+		const size_t len = std::min(MAX_LITERAL, n - literalStart);
+		out.push_back((uint8_t)(len - 1));
+		out.insert(out.end(), src + literalStart, src + literalStart + len);
+		literalStart += len;
+	}
+}
+
+// RLE復号 (読み進めたバイト数を返す。壊れていれば0)
+inline size_t rleDecode(const uint8_t *src, size_t srcBytes, uint8_t *dst, size_t n) {
+	size_t pos = 0;
+	size_t i = 0;
+	while (i < n) {
+		if (pos >= srcBytes) {
+			return 0;
+		}
+		const uint8_t c = src[pos++];
+		if (c < 128) {
+			const size_t len = (size_t)c + 1;
+			if (pos + len > srcBytes || i + len > n) {
+				return 0;
+			}
+			std::memcpy(dst + i, src + pos, len);
+			pos += len;
+			i += len;
+		}
+		else {
+			const size_t len = (size_t)c - 128 + 3;
+			if (pos >= srcBytes || i + len > n) {
+				return 0;
+			}
+			std::memset(dst + i, src[pos++], len);
+			i += len;
+		}
+	}
+	return pos;
+}
+
+// 前のフレームの復元値を今のフレームの量子化で表した値 (予測値)
+inline uint16_t predict(uint16_t prevQ, double prevOffset, double prevScale,
+	double offset, double invScale) {
+	const double v = ((prevQ * prevScale + prevOffset) - offset) * invScale;
+	return (uint16_t)std::min(65535.0, std::max(0.0, std::floor(v + 0.5)));
+}
+
+// 1タイル分の残差をバイト面に分けてRLE符号化する
+inline void encodePlanes(const uint16_t *residual, size_t n, std::vector<uint8_t> &out) {
+	std::vector<uint8_t> plane(n);
+	for (int b = 0; b < 2; b++) {
+		for (size_t i = 0; i < n; i++) {
+			plane[i] = (uint8_t)(residual[i] >> (8 * b));
+		}
+		rleEncode(&plane[0], n, out);
+	}
+}
+
+inline bool decodePlanes(const uint8_t *src, size_t srcBytes, uint16_t *residual, size_t n) {
+	std::vector<uint8_t> plane(n);
+	size_t pos = 0;
+	for (int b = 0; b < 2; b++) {
+		const size_t used = rleDecode(src + pos, srcBytes - pos, &plane[0], n);
+		if (used == 0 && n > 0) {
+			return false;
+		}
+		pos += used;
+		for (size_t i = 0; i < n; i++) {
+			if (b == 0) {
+				residual[i] = plane[i];
+			}
+			else {
+				residual[i] |= (uint16_t)(plane[i] << 8);
+			}
+		}
+	}
+	return true;
+}
+
+// 64ビットの位置でのシーク (longが32ビットの環境でも2GBを超える位置に移動できるように)
+inline bool seek64(FILE *fp, int64_t offset, int whence) {
+#if defined(_WIN32)
+	return _fseeki64(fp, offset, whence) == 0;
+#else
+	return fseeko(fp, (off_t)offset, whence) == 0;
+#endif
+}
+
+// ファイルの大きさ (位置は末尾になる。失敗したら-1)
+inline int64_t fileSize(FILE *fp) {
+	if (!seek64(fp, 0, SEEK_END)) {
+		return -1;
+	}
+#if defined(_WIN32)
+	return _ftelli64(fp);
+#else
+	return (int64_t)ftello(fp);
+#endif
+}
+
+}  // namespace frame_codec
+
+class FrameEncoder {
+public:
+	FrameEncoder()
+		: fp_(NULL)
+		, xCells_(0)
+		, yCells_(0)
+		, tileRows_(0)
+		, keyframeInterval_(0)
+		, prevOffset_(0.0)
+		, prevScale_(0.0)
+		, bytesWritten_(0) {
+	}
+
+	virtual ~FrameEncoder() {
+		close();
+	}
+
+	bool open(const char *filename, int xCells, int yCells,
+		int keyframeInterval = 30, int tileRows = 64) {
+		close();
+
+		fp_ = fopen(filename, "wb");
+		if (fp_ == NULL) {
+			fprintf(stderr, "Failed to open an output file: %s\n", filename);
+			return false;
+		}
+
+		xCells_ = xCells;
+		yCells_ = yCells;
+		tileRows_ = std::max(1, tileRows);
+		keyframeInterval_ = std::max(1, keyframeInterval);
+		prevQ_.assign((size_t)xCells_ * yCells_, 0);
+		index_.clear();
+
+		FrameFileHeader header;
+		std::memset(&header, 0, sizeof(FrameFileHeader));
+		header.magic = FRAME_FILE_MAGIC;
+		header.version = FRAME_FILE_VERSION;
+		header.xCells = xCells_;
+		header.yCells = yCells_;
+		header.tileRows = tileRows_;
+		header.keyframeInterval = keyframeInterval_;
+		if (fwrite(&header, sizeof(FrameFileHeader), 1, fp_) != 1) {
+			fprintf(stderr, "Failed to write an output file: %s\n", filename);
+			close();
+			return false;
+		}
+		bytesWritten_ = sizeof(FrameFileHeader);
+		return true;
+	}
+
+	bool isOpen() const {
+		return fp_ != NULL;
+	}
+
+	// heightsの行の間隔はpitch (0ならxCells)
+	bool encode(const double *heights, uint64_t step, int pitch = 0) {
+		using namespace frame_codec;
+
+		if (fp_ == NULL) {
+			return false;
+		}
+
+		const size_t stride = pitch > 0 ? pitch : xCells_;
+		const bool keyframe = index_.size() % keyframeInterval_ == 0;
+
+		// 量子化の範囲
+		double minValue = heights[0];
+		double maxValue = heights[0];
+		for (int y = 0; y < yCells_; y++) {
+			const double *row = heights + y * stride;
+			for (int x = 0; x < xCells_; x++) {
+				minValue = std::min(minValue, row[x]);
+				maxValue = std::max(maxValue, row[x]);
+			}
+		}
+
+		FrameHeader header;
+		std::memset(&header, 0, sizeof(FrameHeader));
+		header.magic = FRAME_HEADER_MAGIC;
+		header.keyframe = keyframe ? 1 : 0;
+		header.step = step;
+		header.offset = minValue;
+		header.scale = maxValue > minValue ? (maxValue - minValue) / 65535.0 : 1.0;
+		header.numTiles = (uint32_t)((yCells_ + tileRows_ - 1) / tileRows_);
+
+		// タイルごとに並列に符号化する
+		const double invScale = 1.0 / header.scale;
+		std::vector<std::vector<uint8_t> > tiles(header.numTiles);
+		parallelFor(0, (int)header.numTiles, [&](int lo, int hi) {
+			std::vector<uint16_t> residual((size_t)tileRows_ * xCells_);
+			for (int t = lo; t < hi; t++) {
+				const int y0 = t * tileRows_;
+				const int y1 = std::min(yCells_, y0 + tileRows_);
+				for (int y = y0; y < y1; y++) {
+					uint16_t left = 0;
+					for (int x = 0; x < xCells_; x++) {
+						const size_t i = (size_t)y * xCells_ + x;
+						const double v = (heights[y * stride + x] - header.offset) * invScale;
+						const uint16_t q = (uint16_t)std::min(65535.0, std::max(0.0, std::floor(v + 0.5)));
+
+						uint16_t pred = left;
+						if (!keyframe) {
+							pred = predict(prevQ_[i], prevOffset_, prevScale_, header.offset, invScale);
+						}
+						residual[(size_t)(y - y0) * xCells_ + x] = zigzag((uint16_t)(q - pred));
+						left = q;
+						prevQ_[i] = q;
+					}
+				}
+				tiles[t].clear();
+				encodePlanes(&residual[0], (size_t)(y1 - y0) * xCells_, tiles[t]);
+			}
+		});
+
+		prevOffset_ = header.offset;
+		prevScale_ = header.scale;
+
+		// 書き出し
+		FrameIndexEntry entry;
+		std::memset(&entry, 0, sizeof(FrameIndexEntry));
+		entry.fileOffset = bytesWritten_;
+		entry.step = step;
+		entry.keyframe = header.keyframe;
+
+		std::vector<uint32_t> tileBytes(header.numTiles);
+		for (uint32_t t = 0; t < header.numTiles; t++) {
+			tileBytes[t] = (uint32_t)tiles[t].size();
+		}
+
+		bool ok = fwrite(&header, sizeof(FrameHeader), 1, fp_) == 1;
+		ok = ok && fwrite(&tileBytes[0], sizeof(uint32_t), header.numTiles, fp_) == header.numTiles;
+		bytesWritten_ += sizeof(FrameHeader) + sizeof(uint32_t) * header.numTiles;
+		for (uint32_t t = 0; ok && t < header.numTiles; t++) {
+			ok = fwrite(&tiles[t][0], 1, tiles[t].size(), fp_) == tiles[t].size();
+			bytesWritten_ += tiles[t].size();
+		}
+
+		if (!ok) {
+			fprintf(stderr, "Failed to write a compressed frame!\n");
+			return false;
+		}
+		index_.push_back(entry);
+		return true;
+	}
+
+	// 索引を書き出してから閉じる
+	void close() {
+		if (fp_ == NULL) {
+			return;
+		}
+
+		FrameFileTrailer trailer;
+		std::memset(&trailer, 0, sizeof(FrameFileTrailer));
+		trailer.indexOffset = bytesWritten_;
+		trailer.numFrames = index_.size();
+		trailer.magic = FRAME_TRAILER_MAGIC;
+
+		if (!index_.empty()) {
+			fwrite(&index_[0], sizeof(FrameIndexEntry), index_.size(), fp_);
+		}
+		fwrite(&trailer, sizeof(FrameFileTrailer), 1, fp_);
+		fclose(fp_);
+		fp_ = NULL;
+	}
+
+	int numFrames() const {
+		return (int)index_.size();
+	}
+
+	uint64_t bytesWritten() const {
+		return bytesWritten_;
+	}
+
+private:
+	FrameEncoder(const FrameEncoder &);
+	FrameEncoder & operator=(const FrameEncoder &);
+
+	FILE *fp_;
+	int xCells_, yCells_;
+	int tileRows_;
+	int keyframeInterval_;
+	std::vector<uint16_t> prevQ_;
+	double prevOffset_, prevScale_;
+	std::vector<FrameIndexEntry> index_;
+	uint64_t bytesWritten_;
+};
+
+class FrameDecoder {
+public:
+	FrameDecoder()
+		: fp_(NULL)
+		, current_(-1)
+		, prevOffset_(0.0)
+		, prevScale_(0.0) {
+		std::memset(&header_, 0, sizeof(FrameFileHeader));
+	}
+
+	virtual ~FrameDecoder() {
+		close();
+	}
+
+	bool open(const char *filename) {
+		close();
+
+		fp_ = fopen(filename, "rb");
+		if (fp_ == NULL) {
+			fprintf(stderr, "Failed to open a compressed frame file: %s\n", filename);
+			return false;
+		}
+
+		if (fread(&header_, sizeof(FrameFileHeader), 1, fp_) != 1 ||
+			header_.magic != FRAME_FILE_MAGIC || header_.version != FRAME_FILE_VERSION ||
+			header_.xCells <= 0 || header_.yCells <= 0 || header_.tileRows <= 0) {
+			fprintf(stderr, "Invalid compressed frame file: %s\n", filename);
+			close();
+			return false;
+		}
+
+		if (!readIndex()) {
+			// 索引がない (書き込み途中で終了した) 場合は先頭から走査する
+			scanFrames();
+		}
+
+		q_.assign((size_t)header_.xCells * header_.yCells, 0);
+		current_ = -1;
+		return true;
+	}
+
+	void close() {
+		if (fp_ != NULL) {
+			fclose(fp_);
+			fp_ = NULL;
+		}
+		index_.clear();
+		current_ = -1;
+	}
+
+	int numFrames() const {
+		return (int)index_.size();
+	}
+
+	int xCells() const {
+		return header_.xCells;
+	}
+
+	int yCells() const {
+		return header_.yCells;
+	}
+
+	uint64_t step(int frame) const {
+		return index_[frame].step;
+	}
+
+	// frame番目のフレームを復号する
+	// 直前のキーフレーム (あるいは前回復号したフレーム) から順に復号する
+	bool decode(int frame, double *heights) {
+		if (frame < 0 || frame >= (int)index_.size()) {
+			return false;
+		}
+
+		int start = frame;
+		while (start > 0 && index_[start].keyframe == 0) {
+			start--;
+		}
+		if (current_ >= start && current_ <= frame) {
+			start = current_ + 1;
+		}
+
+		for (int f = start; f <= frame; f++) {
+			if (!decodeFrame(f)) {
+				current_ = -1;
+				return false;
+			}
+			current_ = f;
+		}
+
+		const size_t numCells = q_.size();
+		for (size_t i = 0; i < numCells; i++) {
+			heights[i] = q_[i] * prevScale_ + prevOffset_;
+		}
+		return true;
+	}
+
+private:
+	FrameDecoder(const FrameDecoder &);
+	FrameDecoder & operator=(const FrameDecoder &);
+
+	bool readIndex() {
+		using namespace frame_codec;
+
+		FrameFileTrailer trailer;
+		if (!seek64(fp_, -(int64_t)sizeof(FrameFileTrailer), SEEK_END) ||
+			fread(&trailer, sizeof(FrameFileTrailer), 1, fp_) != 1 ||
+			trailer.magic != FRAME_TRAILER_MAGIC) {
+			return false;
+		}
+
+		index_.resize((size_t)trailer.numFrames);
+		if (trailer.numFrames == 0) {
+			return true;
+		}
+		if (!seek64(fp_, (int64_t)trailer.indexOffset, SEEK_SET) ||
+			fread(&index_[0], sizeof(FrameIndexEntry), index_.size(), fp_) != index_.size()) {
+			index_.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// 書き込み途中で終了したファイルでは最後のフレームが途中で切れていることがあるので、
+	// 中身がすべてファイルに収まっているフレームだけを索引に入れる
+	void scanFrames() {
+		using namespace frame_codec;
+
+		index_.clear();
+		const int64_t size = fileSize(fp_);
+		if (size < 0) {
+			return;
+		}
+		uint64_t pos = sizeof(FrameFileHeader);
+		for (;;) {
+			FrameHeader frame;
+			if (!seek64(fp_, (int64_t)pos, SEEK_SET) ||
+				fread(&frame, sizeof(FrameHeader), 1, fp_) != 1 ||
+				frame.magic != FRAME_HEADER_MAGIC) {
+				break;
+			}
+
+			std::vector<uint32_t> tileBytes(frame.numTiles);
+			if (frame.numTiles > 0 &&
+				fread(&tileBytes[0], sizeof(uint32_t), frame.numTiles, fp_) != frame.numTiles) {
+				break;
+			}
+
+			uint64_t end = pos + sizeof(FrameHeader) + sizeof(uint32_t) * frame.numTiles;
+			for (uint32_t t = 0; t < frame.numTiles; t++) {
+				end += tileBytes[t];
+			}
+			if (end > (uint64_t)size) {
+				break;
+			}
+
+			FrameIndexEntry entry;
+			std::memset(&entry, 0, sizeof(FrameIndexEntry));
+			entry.fileOffset = pos;
+			entry.step = frame.step;
+			entry.keyframe = frame.keyframe;
+			index_.push_back(entry);
+
+			pos = end;
+		}
+	}
+
+	bool decodeFrame(int f) {
+		using namespace frame_codec;
+
+		FrameHeader frame;
+		if (!seek64(fp_, (int64_t)index_[f].fileOffset, SEEK_SET) ||
+			fread(&frame, sizeof(FrameHeader), 1, fp_) != 1 ||
+			frame.magic != FRAME_HEADER_MAGIC) {
+			return false;
+		}
+
+		const int xCells = header_.xCells;
+		const int yCells = header_.yCells;
+		const int tileRows = header_.tileRows;
+		if (frame.numTiles != (uint32_t)((yCells + tileRows - 1) / tileRows)) {
+			return false;
+		}
+
+		std::vector<uint32_t> tileBytes(frame.numTiles);
+		if (fread(&tileBytes[0], sizeof(uint32_t), frame.numTiles, fp_) != frame.numTiles) {
+			return false;
+		}
+
+		std::vector<size_t> tileStart(frame.numTiles + 1, 0);
+		for (uint32_t t = 0; t < frame.numTiles; t++) {
+			tileStart[t + 1] = tileStart[t] + tileBytes[t];
+		}
+
+		std::vector<uint8_t> data(tileStart[frame.numTiles]);
+		if (!data.empty() && fread(&data[0], 1, data.size(), fp_) != data.size()) {
+			return false;
+		}
+
+		const bool keyframe = frame.keyframe != 0;
+		const double invScale = 1.0 / frame.scale;
+		std::vector<char> tileOk(frame.numTiles, 1);
+		parallelFor(0, (int)frame.numTiles, [&](int lo, int hi) {
+			std::vector<uint16_t> residual((size_t)tileRows * xCells);
+			for (int t = lo; t < hi; t++) {
+				const int y0 = t * tileRows;
+				const int y1 = std::min(yCells, y0 + tileRows);
+				if (!decodePlanes(&data[tileStart[t]], tileBytes[t], &residual[0], (size_t)(y1 - y0) * xCells)) {
+					tileOk[t] = 0;
+					continue;
+				}
+
+				for (int y = y0; y < y1; y++) {
+					uint16_t left = 0;
+					for (int x = 0; x < xCells; x++) {
+						const size_t i = (size_t)y * xCells + x;
+						uint16_t pred = left;
+						if (!keyframe) {
+							pred = predict(q_[i], prevOffset_, prevScale_, frame.offset, invScale);
+						}
+						const uint16_t q = (uint16_t)(pred + unzigzag(residual[(size_t)(y - y0) * xCells + x]));
+						q_[i] = q;
+						left = q;
+					}
+				}
+			}
+		});
+
+		prevOffset_ = frame.offset;
+		prevScale_ = frame.scale;
+		return std::find(tileOk.begin(), tileOk.end(), 0) == tileOk.end();
+	}
+
+	FILE *fp_;
+	FrameFileHeader header_;
+	std::vector<FrameIndexEntry> index_;
+	std::vector<uint16_t> q_;
+	int current_;
+	double prevOffset_, prevScale_;
+};
+
+#endif  // _FRAME_CODEC_H_
@@ -0,0 +1,372 @@
+#ifndef _FRAME_WRITER_H_
+#define _FRAME_WRITER_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// 時系列データ (heights()のコピー) をバックグラウンドで書き出すクラス
+//
+// submit()はデータをプール済みのバッファにコピーして書き込みスレッドに渡すだけなので、
+// ソルバはディスクへの書き込みを待たずに次のステップへ進むことができる。
+// 空きバッファがない (ディスクが追いつかない) 場合は、方針に従って
+// 書き込みを待つか、そのフレームを捨てる。
+//
+// ファイルの形式
+//   [FrameRecordHeader][データ][ゼロ埋め (FRAME_WRITER_ALIGNバイトまで)] の繰り返し
+// レコードを揃えてあるので、O_DIRECTを使っても使わなくても同じファイルになる
+
+static const uint32_t FRAME_RECORD_MAGIC = 0x4d415246;  // "FRAM"
+static const size_t FRAME_WRITER_ALIGN = 4096;
+
+struct FrameRecordHeader {
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t step;
+	uint64_t bytes;        // データ部のバイト数
+	uint64_t recordBytes;  // ゼロ埋めを含むレコード全体のバイト数
+};
+
+enum FrameWriterPolicy {
+	FRAME_WRITER_BLOCK = 0,  // 空きバッファができるまで待つ
+	FRAME_WRITER_DROP = 1    // フレームを捨てる
+};
+
+class FrameWriter {
+public:
+	FrameWriter()
+		: fd_(-1)
+		, fp_(NULL)
+		, maxBytes_(0)
+		, recordBytes_(0)
+		, policy_(FRAME_WRITER_BLOCK)
+		, preallocBytes_(0)
+		, preallocEnd_(0)
+		, fileOffset_(0)
+		, stopping_(false)
+		, failed_(false)
+		, framesSubmitted_(0)
+		, framesWritten_(0)
+		, framesDropped_(0)
+		, bytesWritten_(0) {
+	}
+
+	virtual ~FrameWriter() {
+		close();
+	}
+
+	// maxBytes: 1フレームの最大バイト数
+	// numBuffers: プールするバッファの数 (2でダブルバッファ)
+	// directIO: O_DIRECTでページキャッシュを通さずに書く
+	// preallocBytes: 0より大きければ、この単位でfallocateして領域を先に確保する
+	bool open(const char *filename, size_t maxBytes, int numBuffers = 2,
+		FrameWriterPolicy policy = FRAME_WRITER_BLOCK,
+		bool directIO = false, uint64_t preallocBytes = 0) {
+		close();
+
+		maxBytes_ = maxBytes;
+		recordBytes_ = alignUp(sizeof(FrameRecordHeader) + maxBytes);
+		policy_ = policy;
+		preallocBytes_ = alignUp((size_t)preallocBytes);
+		preallocEnd_ = 0;
+		fileOffset_ = 0;
+		failed_ = false;
+
+#if !defined(_WIN32)
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+		if (directIO) {
+			fd_ = ::open(filename, flags | O_DIRECT, 0644);
+			if (fd_ < 0) {
+				// tmpfsなどO_DIRECTに対応していないファイルシステムでは通常の書き込みにする
+				fprintf(stderr, "O_DIRECT is not available, falling back to buffered I/O: %s\n", filename);
+			}
+		}
+#endif
+		if (fd_ < 0) {
+			fd_ = ::open(filename, flags, 0644);
+		}
+		if (fd_ < 0) {
+			fprintf(stderr, "Failed to open an output file: %s\n", filename);
+			return false;
+		}
+#else
+		fp_ = fopen(filename, "wb");
+		if (fp_ == NULL) {
+			fprintf(stderr, "Failed to open an output file: %s\n", filename);
+			return false;
+		}
+#endif
+
+		// バッファの確保 (O_DIRECTのためにアラインしておく)
+		for (int i = 0; i < numBuffers; i++) {
+			char *buffer = (char *)alignedAlloc(recordBytes_);
+			std::memset(buffer, 0, recordBytes_);
+			buffers_.push_back(buffer);
+			freeList_.push_back(buffer);
+		}
+
+		stopping_ = false;
+		thread_ = std::thread(&FrameWriter::run, this);
+		return true;
+	}
+
+	bool isOpen() const {
+		return thread_.joinable();
+	}
+
+	// フレームを書き込み待ちに追加する
+	// フレームを捨てた場合 (あるいは書き込みに失敗している場合) はfalseを返す
+	bool submit(const void *data, size_t bytes, uint64_t step) {
+		return submitRows(data, bytes, bytes, 1, step);
+	}
+
+	// 行の間に余白がある配列 (rowBytesずつ、pitchBytes間隔でrows行) を詰めて1フレームにする
+	bool submitRows(const void *data, size_t rowBytes, size_t pitchBytes, int rows, uint64_t step) {
+		const size_t bytes = rowBytes * rows;
+		if (!isOpen() || bytes > maxBytes_) {
+			return false;
+		}
+
+		char *buffer = NULL;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			framesSubmitted_++;
+			if (failed_) {
+				framesDropped_++;
+				return false;
+			}
+
+			if (freeList_.empty()) {
+				if (policy_ == FRAME_WRITER_DROP) {
+					framesDropped_++;
+					return false;
+				}
+				freeCond_.wait(lock, [this] { return !freeList_.empty() || failed_; });
+				if (failed_) {
+					framesDropped_++;
+					return false;
+				}
+			}
+
+			buffer = freeList_.front();
+			freeList_.pop_front();
+		}
+
+		// コピーはロックの外で行う
+		FrameRecordHeader header;
+		std::memset(&header, 0, sizeof(FrameRecordHeader));
+		header.magic = FRAME_RECORD_MAGIC;
+		header.step = step;
+		header.bytes = bytes;
+		header.recordBytes = alignUp(sizeof(FrameRecordHeader) + bytes);
+		std::memcpy(buffer, &header, sizeof(FrameRecordHeader));
+		for (int y = 0; y < rows; y++) {
+			std::memcpy(buffer + sizeof(FrameRecordHeader) + rowBytes * y,
+				(const char *)data + pitchBytes * y, rowBytes);
+		}
+		std::memset(buffer + sizeof(FrameRecordHeader) + bytes, 0,
+			header.recordBytes - sizeof(FrameRecordHeader) - bytes);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			readyQueue_.push_back(buffer);
+		}
+		readyCond_.notify_one();
+		return true;
+	}
+
+	// 書き込み待ちのフレームをすべて書き出してからファイルを閉じる
+	void close() {
+		if (thread_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			readyCond_.notify_one();
+			thread_.join();
+		}
+
+#if !defined(_WIN32)
+		if (fd_ >= 0) {
+			// fallocateで確保した余分な領域を切り詰める
+			if (preallocEnd_ > fileOffset_) {
+				if (ftruncate(fd_, (off_t)fileOffset_) != 0) {
+					fprintf(stderr, "Failed to truncate an output file\n");
+				}
+			}
+			::close(fd_);
+			fd_ = -1;
+		}
+#else
+		if (fp_ != NULL) {
+			fclose(fp_);
+			fp_ = NULL;
+		}
+#endif
+
+		for (size_t i = 0; i < buffers_.size(); i++) {
+			alignedFree(buffers_[i]);
+		}
+		buffers_.clear();
+		freeList_.clear();
+		readyQueue_.clear();
+	}
+
+	uint64_t framesSubmitted() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return framesSubmitted_;
+	}
+
+	uint64_t framesWritten() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return framesWritten_;
+	}
+
+	uint64_t framesDropped() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return framesDropped_;
+	}
+
+	uint64_t bytesWritten() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return bytesWritten_;
+	}
+
+private:
+	FrameWriter(const FrameWriter &);
+	FrameWriter & operator=(const FrameWriter &);
+
+	static size_t alignUp(size_t n) {
+		return (n + FRAME_WRITER_ALIGN - 1) / FRAME_WRITER_ALIGN * FRAME_WRITER_ALIGN;
+	}
+
+	static void * alignedAlloc(size_t bytes) {
+#if !defined(_WIN32)
+		void *ptr = NULL;
+		if (posix_memalign(&ptr, FRAME_WRITER_ALIGN, bytes) != 0) {
+			fprintf(stderr, "Failed to allocate an output buffer!\n");
+			exit(1);
+		}
+		return ptr;
+#else
+		return _aligned_malloc(bytes, FRAME_WRITER_ALIGN);
+#endif
+	}
+
+	static void alignedFree(void *ptr) {
+#if !defined(_WIN32)
+		free(ptr);
+#else
+		_aligned_free(ptr);
+#endif
+	}
+
+	// 書き込みスレッド
+	void run() {
+		for (;;) {
+			char *buffer = NULL;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				readyCond_.wait(lock, [this] { return !readyQueue_.empty() || stopping_; });
+				if (readyQueue_.empty()) {
+					return;
+				}
+				buffer = readyQueue_.front();
+				readyQueue_.pop_front();
+			}
+
+			const FrameRecordHeader *header = (const FrameRecordHeader *)buffer;
+			const bool ok = !failed_ && writeRecord(buffer, (size_t)header->recordBytes);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (ok) {
+					framesWritten_++;
+					bytesWritten_ += header->recordBytes;
+				}
+				else {
+					failed_ = true;
+					framesDropped_++;
+				}
+				freeList_.push_back(buffer);
+			}
+			freeCond_.notify_one();
+		}
+	}
+
+	bool writeRecord(const char *data, size_t bytes) {
+#if !defined(_WIN32)
+		// 必要になったら大きめの単位で領域を確保しておく
+		if (preallocBytes_ > 0 && fileOffset_ + bytes > preallocEnd_) {
+			const uint64_t length = std::max<uint64_t>(preallocBytes_, bytes);
+			if (posix_fallocate(fd_, (off_t)fileOffset_, (off_t)length) == 0) {
+				preallocEnd_ = fileOffset_ + length;
+			}
+			else {
+				preallocBytes_ = 0;
+			}
+		}
+
+		size_t done = 0;
+		while (done < bytes) {
+			const ssize_t n = ::write(fd_, data + done, bytes - done);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				fprintf(stderr, "Failed to write a frame: %s\n", strerror(errno));
+				return false;
+			}
+			done += (size_t)n;
+		}
+#else
+		if (fwrite(data, 1, bytes, fp_) != bytes) {
+			fprintf(stderr, "Failed to write a frame!\n");
+			return false;
+		}
+#endif
+		fileOffset_ += bytes;
+		return true;
+	}
+
+	int fd_;
+	FILE *fp_;
+	size_t maxBytes_;
+	size_t recordBytes_;
+	FrameWriterPolicy policy_;
+	uint64_t preallocBytes_;
+	uint64_t preallocEnd_;
+	uint64_t fileOffset_;
+
+	std::vector<char *> buffers_;
+	std::deque<char *> freeList_;
+	std::deque<char *> readyQueue_;
+
+	std::thread thread_;
+	mutable std::mutex mutex_;
+	std::condition_variable freeCond_;
+	std::condition_variable readyCond_;
+	bool stopping_;
+	bool failed_;
+
+	uint64_t framesSubmitted_;
+	uint64_t framesWritten_;
+	uint64_t framesDropped_;
+	uint64_t bytesWritten_;
+};
+
+#endif  // _FRAME_WRITER_H_
@@ -0,0 +1,242 @@
+#ifndef _GPU_SOLVER_H_
+#define _GPU_SOLVER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "snapshot.h"
+#include "shader_program.h"
+
+// 波動方程式・拡散方程式をコンピュートシェーダ (OpenGL 4.3) で解くクラス
+//
+// 値はシェーダストレージバッファ (SSBO、float) に置いたまま、ステップごとに
+// 役割を入れ替えて使う (波動方程式は3つ、拡散方程式は2つ)。描画は
+// currentBuffer() を頂点シェーダから直接読むので、フレームごとの転送はない。
+// CPUへの読み出しはスナップショットの保存 (readback/saveSnapshot) のときだけ行う。
+//
+// シェーダは1つのファイルに内部の更新 (u_pass = 0) と境界条件 (u_pass = 1) を書く。
+// バッファの結合番号は 0: 前の値, 1: 現在の値, 2: 次の値
+// プログラムは呼び出し側 (ShaderManager) が作って持つ。
+class GpuSolver {
+public:
+	// コンピュートシェーダのワークグループの大きさ (シェーダ側と合わせる)
+	static const int LOCAL_SIZE = 16;
+
+	GpuSolver()
+		: kind_(SNAPSHOT_KIND_WAVE)
+		, programId_(0)
+		, xCells_(0)
+		, yCells_(0)
+		, numBuffers_(0)
+		, current_(0)
+		, speed_(0.0)
+		, dx_(0.0)
+		, dt_(0.0)
+		, loss_(0.0)
+		, diffNum_(0.0)
+		, steps_(0) {
+		buffers_[0] = buffers_[1] = buffers_[2] = 0;
+	}
+
+	virtual ~GpuSolver() {
+		release();
+	}
+
+	// 波動方程式 (curr, prevはCPU側のソルバの値)
+	bool initWave(GLuint programId, int xCells, int yCells,
+		const double *curr, const double *prev,
+		double speed, double dx, double dt, double loss, unsigned long long step) {
+		kind_ = SNAPSHOT_KIND_WAVE;
+		speed_ = speed;
+		dx_ = dx;
+		dt_ = dt;
+		loss_ = loss;
+		diffNum_ = 0.0;
+		return init(programId, xCells, yCells, 3, curr, prev, step);
+	}
+
+	// 拡散方程式
+	bool initDiffusion(GLuint programId, int xCells, int yCells,
+		const double *curr, double diffNum, unsigned long long step) {
+		kind_ = SNAPSHOT_KIND_DIFFUSION;
+		speed_ = dx_ = dt_ = loss_ = 0.0;
+		diffNum_ = diffNum;
+		return init(programId, xCells, yCells, 2, curr, curr, step);
+	}
+
+	void release() {
+		if (numBuffers_ != 0) {
+			glDeleteBuffers(numBuffers_, buffers_);
+		}
+		programId_ = 0;
+		numBuffers_ = 0;
+		buffers_[0] = buffers_[1] = buffers_[2] = 0;
+	}
+
+	// プログラムを差し替える (シェーダを読み込み直したときなど)
+	// ステップ中に変わらないuniform変数はここで設定しておく
+	void setProgram(GLuint programId) {
+		programId_ = programId;
+		program_.attach(programId_);
+		glUseProgram(programId_);
+		glUniform1i(program_.location("u_xCells"), xCells_);
+		glUniform1i(program_.location("u_yCells"), yCells_);
+		if (kind_ == SNAPSHOT_KIND_WAVE) {
+			glUniform1f(program_.location("u_coef"), (float)(speed_ * speed_ * dt_ * dt_ / (dx_ * dx_)));
+			glUniform1f(program_.location("u_loss"), (float)loss_);
+		}
+		else {
+			glUniform1f(program_.location("u_diffNum"), (float)diffNum_);
+		}
+		glUseProgram(0);
+	}
+
+	bool isReady() const {
+		return programId_ != 0;
+	}
+
+	// nステップ進める (GPU上で完結する)
+	void step(int n = 1) {
+		glUseProgram(programId_);
+		const GLint passLoc = program_.location("u_pass");
+
+		const GLuint groupsX = (xCells_ - 2 + LOCAL_SIZE - 1) / LOCAL_SIZE;
+		const GLuint groupsY = (yCells_ - 2 + LOCAL_SIZE - 1) / LOCAL_SIZE;
+		const GLuint boundaryGroups = (2 * (xCells_ + yCells_) + LOCAL_SIZE * LOCAL_SIZE - 1) / (LOCAL_SIZE * LOCAL_SIZE);
+
+		for (int i = 0; i < n; i++) {
+			const GLuint next = buffers_[(current_ + 1) % numBuffers_];
+			const GLuint prev = buffers_[(current_ + numBuffers_ - 1) % numBuffers_];
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, prev);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers_[current_]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, next);
+
+			// 内部の更新 -> 境界条件 (内部の新しい値を使う)
+			glUniform1i(passLoc, 0);
+			glDispatchCompute(groupsX, groupsY, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			glUniform1i(passLoc, 1);
+			glDispatchCompute(boundaryGroups, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			current_ = (current_ + 1) % numBuffers_;
+			steps_++;
+		}
+
+		glUseProgram(0);
+	}
+
+	// 現在の値が入っているバッファ (描画に使う)
+	GLuint currentBuffer() const {
+		return buffers_[current_];
+	}
+
+	// 1つのセルの値を書き換える (マウスでの操作など、まれにしか呼ばない処理向け)
+	void set(int x, int y, double value) {
+		const float v = (float)value;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers_[current_]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * ((size_t)y * xCells_ + x), sizeof(float), &v);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// 現在の値と1つ前の値をCPU側に読み出す
+	void readback(std::vector<double> &curr, std::vector<double> &prev) const {
+		const GLuint prevBuffer = buffers_[(current_ + numBuffers_ - 1) % numBuffers_];
+		read(buffers_[current_], curr);
+		read(prevBuffer, prev);
+	}
+
+	// CPU側のソルバと同じ形式でスナップショットを保存する
+	bool saveSnapshot(const char *filename) const {
+		std::vector<double> curr, prev;
+		readback(curr, prev);
+
+		SnapshotHeader header = makeSnapshotHeader((SnapshotKind)kind_, xCells_, yCells_, 2);
+		header.step = steps_;
+		header.dx = dx_;
+		header.dt = dt_;
+		header.speed = speed_;
+		header.loss = loss_;
+		header.diff_num = diffNum_;
+
+		const double *arrays[] = { &curr[0], &prev[0] };
+		return writeSnapshot(filename, header, arrays);
+	}
+
+	int xCells() const {
+		return xCells_;
+	}
+
+	int yCells() const {
+		return yCells_;
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+private:
+	GpuSolver(const GpuSolver &);
+	GpuSolver & operator=(const GpuSolver &);
+
+	bool init(GLuint programId, int xCells, int yCells, int numBuffers,
+		const double *curr, const double *prev, unsigned long long step) {
+		release();
+		if (programId == 0) {
+			return false;
+		}
+
+		xCells_ = xCells;
+		yCells_ = yCells;
+		numBuffers_ = numBuffers;
+		current_ = 1;
+		steps_ = step;
+		setProgram(programId);
+
+		// バッファ0に1つ前の値、バッファ1に現在の値を入れる
+		const size_t n = (size_t)xCells_ * yCells_;
+		std::vector<float> values(n);
+		glGenBuffers(numBuffers_, buffers_);
+		for (int i = 0; i < numBuffers_; i++) {
+			const double *src = i == 0 ? prev : curr;
+			for (size_t k = 0; k < n; k++) {
+				values[k] = (float)src[k];
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers_[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * n, &values[0], GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return true;
+	}
+
+	void read(GLuint buffer, std::vector<double> &out) const {
+		const size_t n = (size_t)xCells_ * yCells_;
+		std::vector<float> values(n);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * n, &values[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		out.resize(n);
+		for (size_t k = 0; k < n; k++) {
+			out[k] = values[k];
+		}
+	}
+
+	int kind_;
+	GLuint programId_;
+	ShaderProgram program_;
+	GLuint buffers_[3];
+	int xCells_, yCells_;
+	int numBuffers_;
+	int current_;
+	double speed_, dx_, dt_, loss_;
+	double diffNum_;
+	unsigned long long steps_;
+};
+
+#endif  // _GPU_SOLVER_H_
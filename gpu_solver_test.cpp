@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <glad/gl.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "gpu_solver.h"
+#include "shader_manager.h"
+#include "water_eq.h"
+#include "拡散視覚化/diffusion_eq.h"
+
+// GpuSolver (コンピュートシェーダ) とCPU側のソルバの結果を比べるテスト
+//
+//   make check-gpu
+//
+// ウィンドウを作らずに、EGLの surfaceless プラットフォームで OpenGL 4.3 のコンテキストを作る。
+// GPUがなくても Mesa の llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) で動く。
+// GPU側は float で計算するので、double のCPU側とは丸め誤差の分だけずれる。
+
+static const char *WAVE_SHADER = "shaders/wave_step.comp";
+static const char *DIFFUSION_SHADER = "拡散視覚化/シェーダ/diffusion_step.comp";
+
+static int failures = 0;
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%s %s (%s)\n", ok ? "PASS" : "FAIL", name, detail);
+	if (!ok) {
+		failures++;
+	}
+}
+
+// 描画先のないコンテキストを作って、カレントにする
+static bool createContext() {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL) {
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY || eglInitialize(display, NULL, NULL) == EGL_FALSE) {
+		fprintf(stderr, "Failed to initialize EGL\n");
+		return false;
+	}
+
+	if (eglBindAPI(EGL_OPENGL_API) == EGL_FALSE) {
+		fprintf(stderr, "EGL does not support OpenGL\n");
+		return false;
+	}
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) == EGL_FALSE || numConfigs == 0) {
+		fprintf(stderr, "No EGL config for OpenGL\n");
+		return false;
+	}
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Failed to create an OpenGL 4.3 context\n");
+		return false;
+	}
+	if (eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_FALSE) {
+		fprintf(stderr, "Failed to make the context current (EGL_KHR_surfaceless_context is required)\n");
+		return false;
+	}
+
+	const int version = gladLoadGL((GLADloadfunc)eglGetProcAddress);
+	if (version == 0) {
+		fprintf(stderr, "Failed to load OpenGL 4.x libraries!\n");
+		return false;
+	}
+	printf("Load OpenGL %d.%d (%s)\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version),
+		(const char *)glGetString(GL_RENDERER));
+	return true;
+}
+
+// 波動方程式: 誤差は少しずつ増えるので、山の高さに対する割合で比べる
+static void testWave(GLuint program) {
+	static const int W = 64, H = 48, STEPS = 300;
+	WaveEquation wave;
+	wave.setParams(W, H, 0.5, 0.01, 0.005, 0.001);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			const double vx = (x - W / 2) * 0.01, vy = (y - H / 3) * 0.01;
+			wave.set(x, y, std::exp(-500.0 * (vx * vx + vy * vy)));
+		}
+	}
+	wave.start();
+
+	std::vector<double> curr((size_t)W * H), prev((size_t)W * H);
+	wave.copyHeights(&curr[0]);
+	wave.copyPreviousHeights(&prev[0]);
+	GpuSolver gpu;
+	if (!gpu.initWave(program, W, H, &curr[0], &prev[0],
+		wave.speed(), wave.dx(), wave.dt(), wave.loss(), wave.stepCount())) {
+		report("wave gpu matches cpu", false, "initWave failed");
+		return;
+	}
+
+	for (int i = 0; i < STEPS; i++) {
+		wave.step();
+	}
+	gpu.step(STEPS);
+
+	std::vector<double> gpuCurr, gpuPrev;
+	gpu.readback(gpuCurr, gpuPrev);
+	wave.copyHeights(&curr[0]);
+
+	double maxDiff = 0.0, peak = 0.0;
+	for (size_t i = 0; i < curr.size(); i++) {
+		maxDiff = std::max(maxDiff, std::fabs(gpuCurr[i] - curr[i]));
+		peak = std::max(peak, std::fabs(curr[i]));
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "%d steps, max diff %g, peak %g", STEPS, maxDiff, peak);
+	report("wave gpu matches cpu", maxDiff <= 1e-4 * peak, detail);
+}
+
+// 拡散方程式: 誤差は増えないので float の精度程度で一致する
+static void testDiffusion(GLuint program) {
+	static const int W = 64, H = 48, STEPS = 300;
+	DiffEquation diff;
+	diff.initParams(W, H, 0.2);
+	for (int y = 10; y < 20; y++) {
+		for (int x = 10; x < 20; x++) {
+			diff.set(x, y, 1.0);
+		}
+	}
+	diff.start();
+
+	std::vector<double> initial((size_t)W * H);
+	diff.copyHeights(&initial[0]);
+	GpuSolver gpu;
+	if (!gpu.initDiffusion(program, W, H, &initial[0], diff.diffNum(), diff.stepCount())) {
+		report("diffusion gpu matches cpu", false, "initDiffusion failed");
+		return;
+	}
+
+	for (int i = 0; i < STEPS; i++) {
+		diff.step();
+	}
+	gpu.step(STEPS);
+
+	std::vector<double> gpuCurr, gpuPrev, curr((size_t)W * H);
+	gpu.readback(gpuCurr, gpuPrev);
+	diff.copyHeights(&curr[0]);
+
+	double maxDiff = 0.0;
+	for (size_t i = 0; i < curr.size(); i++) {
+		maxDiff = std::max(maxDiff, std::fabs(gpuCurr[i] - curr[i]));
+	}
+
+	char detail[128];
+	snprintf(detail, sizeof(detail), "%d steps, max diff %g", STEPS, maxDiff);
+	report("diffusion gpu matches cpu", maxDiff <= 1e-6, detail);
+}
+
+int main() {
+	if (!createContext()) {
+		return 1;
+	}
+
+	ShaderManager shaderManager;
+	shaderManager.setCacheDirectory("");
+	const int waveProgram = shaderManager.addCompute(WAVE_SHADER);
+	const int diffusionProgram = shaderManager.addCompute(DIFFUSION_SHADER);
+	if (waveProgram < 0 || diffusionProgram < 0) {
+		return 1;
+	}
+
+	testWave(shaderManager.program(waveProgram));
+	testDiffusion(shaderManager.program(diffusionProgram));
+
+	if (failures > 0) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,103 @@
+#ifndef _GPU_TIMER_H_
+#define _GPU_TIMER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/gl.h>
+
+// 描画にかかったGPUの時間を GL_TIME_ELAPSED のクエリで測るクラス
+// 結果は数フレーム後に (待たずに取れるものだけ) 回収するので、描画は止まらない
+class GpuTimer {
+public:
+	GpuTimer()
+		: head_(0)
+		, running_(false)
+		, samples_(0)
+		, totalNanoseconds_(0)
+		, lastNanoseconds_(0) {
+	}
+
+	virtual ~GpuTimer() {
+	}
+
+	void init(int ringSize = 4) {
+		queries_.resize(ringSize);
+		pending_.assign(ringSize, false);
+		glGenQueries(ringSize, &queries_[0]);
+	}
+
+	void release() {
+		if (!queries_.empty()) {
+			glDeleteQueries((GLsizei)queries_.size(), &queries_[0]);
+			queries_.clear();
+			pending_.clear();
+		}
+	}
+
+	// 計測の開始 (前の結果がまだ出ていなければこのフレームは測らない)
+	void begin() {
+		collect();
+		if (queries_.empty() || pending_[head_]) {
+			return;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, queries_[head_]);
+		running_ = true;
+	}
+
+	void end() {
+		if (!running_) {
+			return;
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		pending_[head_] = true;
+		head_ = (head_ + 1) % (int)queries_.size();
+		running_ = false;
+	}
+
+	// 平均と直近の時間 (ミリ秒)
+	double averageMilliseconds() const {
+		return samples_ > 0 ? totalNanoseconds_ * 1.0e-6 / samples_ : 0.0;
+	}
+
+	double lastMilliseconds() const {
+		return lastNanoseconds_ * 1.0e-6;
+	}
+
+	unsigned long long samples() const {
+		return samples_;
+	}
+
+private:
+	GpuTimer(const GpuTimer &);
+	GpuTimer & operator=(const GpuTimer &);
+
+	void collect() {
+		for (size_t i = 0; i < queries_.size(); i++) {
+			if (!pending_[i]) {
+				continue;
+			}
+			GLuint available = 0;
+			glGetQueryObjectuiv(queries_[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				continue;
+			}
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &nanoseconds);
+			pending_[i] = false;
+			lastNanoseconds_ = nanoseconds;
+			totalNanoseconds_ += nanoseconds;
+			samples_++;
+		}
+	}
+
+	std::vector<GLuint> queries_;
+	std::vector<bool> pending_;
+	int head_;
+	bool running_;
+	unsigned long long samples_;
+	GLuint64 totalNanoseconds_;
+	GLuint64 lastNanoseconds_;
+};
+
+#endif  // _GPU_TIMER_H_
@@ -0,0 +1,270 @@
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#include "parallel.h"
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+
+// 行ごとに揃えて確保する2次元の格子
+//
+//   [lead][row 0 ......... | pad][row 1 ......... | pad] ...
+//          ^halo           ^xCells
+//
+// xCells, yCellsは周りのhaloセル (ゴーストセル) を含む大きさ。境界の処理はゴーストセルを埋めることになる。
+// 行の間隔 (pitch) はGRID_ALIGNバイトの倍数で、各行の最初の内部セル (x = halo) が
+// GRID_ALIGNバイト境界に来るように先頭をleadセルだけずらしてある。
+// pitchが4KBの倍数になるとすべての行が同じキャッシュセットに集まるので、
+// そのときは1キャッシュライン分を足す (gridPitchPadding() で変えられる)。
+// 大きな格子はGRID_HUGE_PAGEに揃えて新しいページをmmapし、透過的ヒュージページを使うように伝える。
+// 0での初期化は parallelFor で行ごとに分けて行うので、各行のページは
+// その行を計算するスレッドのNUMAノードに置かれる (first-touch)。
+static const size_t GRID_ALIGN = 64;
+static const size_t GRID_HUGE_PAGE = 2 << 20;
+static const size_t GRID_HUGE_PAGE_THRESHOLD = 8 << 20;  // これ以上の大きさの格子にヒュージページを使う
+
+// pitchに足すセルの数 (負ならpitchが4KBの倍数のときだけ1キャッシュライン)
+inline int &gridPitchPadding() {
+	static int padding = -1;
+	return padding;
+}
+
+template <class Scalar>
+class Grid2D {
+public:
+	Grid2D()
+		: xCells_(0)
+		, yCells_(0)
+		, halo_(0)
+		, pitch_(0)
+		, lead_(0)
+		, data_(NULL)
+		, owned_(false)
+		, hugePages_(false)
+		, mappedBytes_(0) {
+	}
+
+	virtual ~Grid2D() {
+		release();
+	}
+
+	// 確保して0で初期化する
+	bool allocate(int xCells, int yCells, int halo = 1) {
+		const int align = alignCells();
+		const int lead = (halo + align - 1) / align * align - halo;
+		int pitch = (lead + xCells + align - 1) / align * align;
+
+		const int padding = gridPitchPadding();
+		if (padding > 0) {
+			pitch += (padding + align - 1) / align * align;
+		}
+		else if (padding < 0 && (pitch * sizeof(Scalar)) % 4096 == 0) {
+			pitch += align;
+		}
+		return allocate(xCells, yCells, halo, pitch, lead);
+	}
+
+	// gridと同じ並び (pitch, lead) で確保する
+	bool allocateLike(const Grid2D &grid) {
+		return allocate(grid.xCells_, grid.yCells_, grid.halo_, grid.pitch_, grid.lead_);
+	}
+
+	// 他で確保された領域 (スナップショットのマップ領域など) をそのまま使う (解放はしない)
+	void attach(Scalar *data, int xCells, int yCells, int halo, int pitch, int lead) {
+		release();
+		data_ = data;
+		xCells_ = xCells;
+		yCells_ = yCells;
+		halo_ = halo;
+		pitch_ = pitch;
+		lead_ = lead;
+	}
+
+	void release() {
+		if (owned_) {
+#if !defined(_WIN32)
+			if (mappedBytes_ > 0) {
+				munmap(data_, mappedBytes_);
+			}
+			else {
+				free(data_);
+			}
+#else
+			_aligned_free(data_);
+#endif
+		}
+		data_ = NULL;
+		owned_ = false;
+		mappedBytes_ = 0;
+		hugePages_ = false;
+		xCells_ = yCells_ = pitch_ = lead_ = 0;
+	}
+
+	// 同じ大きさの格子から値をコピーする (pitchは違ってもよい)
+	void copyFrom(const Grid2D &grid) {
+		for (int y = 0; y < yCells_; y++) {
+			std::memcpy(row(y), grid.row(y), sizeof(Scalar) * xCells_);
+		}
+	}
+
+	// xCells * yCellsの詰めた配列との変換 (描画・転送・保存用)
+	void pack(Scalar *dst) const {
+		for (int y = 0; y < yCells_; y++) {
+			std::memcpy(dst + (size_t)y * xCells_, row(y), sizeof(Scalar) * xCells_);
+		}
+	}
+
+	void unpack(const Scalar *src) {
+		for (int y = 0; y < yCells_; y++) {
+			std::memcpy(row(y), src + (size_t)y * xCells_, sizeof(Scalar) * xCells_);
+		}
+	}
+
+	// セル (0, 0) の位置。セル (x, y) は origin()[y * pitch() + x]
+	Scalar *origin() const {
+		return data_ + lead_;
+	}
+
+	Scalar *row(int y) const {
+		return origin() + (size_t)y * pitch_;
+	}
+
+	Scalar &at(int x, int y) const {
+		return origin()[(size_t)y * pitch_ + x];
+	}
+
+	// 確保した領域の先頭と大きさ (leadと最後の行の余りも含む)
+	Scalar *data() const {
+		return data_;
+	}
+
+	size_t storageBytes() const {
+		return sizeof(Scalar) * ((size_t)lead_ + (size_t)pitch_ * yCells_);
+	}
+
+	int xCells() const {
+		return xCells_;
+	}
+
+	int yCells() const {
+		return yCells_;
+	}
+
+	int halo() const {
+		return halo_;
+	}
+
+	int pitch() const {
+		return pitch_;
+	}
+
+	int lead() const {
+		return lead_;
+	}
+
+	bool hugePages() const {
+		return hugePages_;
+	}
+
+private:
+	Grid2D(const Grid2D &);
+	Grid2D & operator=(const Grid2D &);
+
+	bool allocate(int xCells, int yCells, int halo, int pitch, int lead) {
+		release();
+		xCells_ = xCells;
+		yCells_ = yCells;
+		halo_ = halo;
+		pitch_ = pitch;
+		lead_ = lead;
+
+		const size_t bytes = storageBytes();
+		hugePages_ = bytes >= GRID_HUGE_PAGE_THRESHOLD;
+		const size_t alignment = hugePages_ ? GRID_HUGE_PAGE : GRID_ALIGN;
+		const size_t rounded = (bytes + alignment - 1) / alignment * alignment;
+#if !defined(_WIN32)
+		void *ptr = NULL;
+		if (hugePages_) {
+			// mallocは解放された (別のスレッドが触れた) 領域を再利用することがあるので、直接mmapする
+			ptr = mapAligned(rounded, alignment);
+#if defined(MADV_HUGEPAGE)
+			if (ptr != NULL) {
+				madvise(ptr, rounded, MADV_HUGEPAGE);
+			}
+#else
+			hugePages_ = false;
+#endif
+		}
+		else if (posix_memalign(&ptr, alignment, rounded) != 0) {
+			ptr = NULL;
+		}
+#else
+		void *ptr = _aligned_malloc(rounded, alignment);
+		hugePages_ = false;
+#endif
+		if (ptr == NULL) {
+			release();
+			return false;
+		}
+
+		data_ = (Scalar *)ptr;
+		owned_ = true;
+		firstTouch();
+		return true;
+	}
+
+	// 行をsweep()と同じ分け方で並列に0で埋める
+	void firstTouch() {
+		std::memset(data_, 0, sizeof(Scalar) * lead_);
+		Scalar *origin = this->origin();
+		const size_t pitch = pitch_;
+		parallelFor(0, yCells_, [=](int y0, int y1) {
+			std::memset(origin + y0 * pitch, 0, sizeof(Scalar) * pitch * (y1 - y0));
+		});
+	}
+
+#if !defined(_WIN32)
+	// alignmentに揃えたbytesバイトの新しいページ (前後の余分はすぐに返す)
+	void *mapAligned(size_t bytes, size_t alignment) {
+		const size_t total = bytes + alignment;
+		void *ptr = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) {
+			return NULL;
+		}
+		char *base = (char *)ptr;
+		char *aligned = base + (alignment - (uintptr_t)base % alignment) % alignment;
+		if (aligned > base) {
+			munmap(base, aligned - base);
+		}
+		if (base + total > aligned + bytes) {
+			munmap(aligned + bytes, base + total - (aligned + bytes));
+		}
+		mappedBytes_ = bytes;
+		return aligned;
+	}
+#endif
+
+	static int alignCells() {
+		return (int)std::max<size_t>(1, GRID_ALIGN / sizeof(Scalar));
+	}
+
+	int xCells_, yCells_;
+	int halo_;
+	int pitch_;    // 行の間隔 (セル数)
+	int lead_;     // 確保した領域の先頭からセル (0, 0) までのセル数
+	Scalar *data_;
+	bool owned_;
+	bool hugePages_;
+	size_t mappedBytes_;  // mmapで確保した大きさ (mallocなら0)
+};
+
+#endif  // _GRID_H_
@@ -0,0 +1,38 @@
+#ifndef _GRID_MESH_H_
+#define _GRID_MESH_H_
+
+#include <cstddef>
+#include <vector>
+
+// 格子状の頂点 (xVerts x yVerts、行優先で並んでいるもの) を
+// 三角形ストリップで描画するためのインデックスを作る
+//
+// 1行ごとに1本のストリップにして、行の間にはプリミティブリスタート用の
+// インデックス (IndexT型の最大値) を入れる。三角形リストに比べて
+// インデックスの数が約1/3になる。
+// 頂点数が65535未満なら IndexT = unsigned short にするとさらに半分になる。
+template <class IndexT>
+IndexT gridRestartIndex() {
+	return (IndexT)~(IndexT)0;
+}
+
+template <class IndexT>
+void buildGridStripIndices(int xVerts, int yVerts, std::vector<IndexT> &indices) {
+	indices.clear();
+	if (xVerts < 2 || yVerts < 2) {
+		return;
+	}
+
+	indices.reserve((size_t)(2 * xVerts + 1) * (yVerts - 1));
+	for (int y = 0; y < yVerts - 1; y++) {
+		for (int x = 0; x < xVerts; x++) {
+			indices.push_back((IndexT)(y * xVerts + x));
+			indices.push_back((IndexT)((y + 1) * xVerts + x));
+		}
+		if (y < yVerts - 2) {
+			indices.push_back(gridRestartIndex<IndexT>());
+		}
+	}
+}
+
+#endif  // _GRID_MESH_H_
@@ -0,0 +1,40 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <algorithm>
+
+#include "thread_pool.h"
+
+// 範囲[begin, end)をほぼ等分して並列に処理する
+// funcは func(lo, hi) の形で呼び出され、[lo, hi)を処理する
+// スレッドは共有のスレッドプール (ThreadPool::shared()) のものを使うので、
+// 複数のシミュレーションから同時に呼んでもスレッドが増えすぎない
+// 区間の分け方と担当するスレッドは毎回同じなので (i番目の区間はi - 1番目のワーカーのキューに入る)、
+// 配列を確保するときに同じ分け方で0を書き込んでおけば、各スレッドは自分のNUMAノードのメモリを使う
+template <class Func>
+void parallelFor(int begin, int end, Func func, int numThreads = 0) {
+	const int count = end - begin;
+	if (count <= 0) {
+		return;
+	}
+
+	ThreadPool &pool = ThreadPool::shared();
+	const int n = std::min(numThreads > 0 ? numThreads : pool.numThreads(), count);
+	if (n == 1) {
+		func(begin, end);
+		return;
+	}
+
+	TaskGroup group;
+	for (int i = 1; i < n; i++) {
+		const int lo = begin + (int)((long long)count * i / n);
+		const int hi = begin + (int)((long long)count * (i + 1) / n);
+		pool.submitTo(i - 1, group, [&func, lo, hi] { func(lo, hi); });
+	}
+
+	// 最初の区間は呼び出し元のスレッドで処理し、残りの終了を待つ
+	func(begin, begin + (int)((long long)count / n));
+	pool.wait(group);
+}
+
+#endif  // _PARALLEL_H_
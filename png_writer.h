@@ -0,0 +1,49 @@
+#ifndef _PNG_WRITER_H_
+#define _PNG_WRITER_H_
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+
+#include "stb_image_write.h"
+
+// PNGの書き出し (エンコードは stb_image_write に任せる)
+// 実装 (STB_IMAGE_WRITE_IMPLEMENTATION) は stb_image.h と同じく main のある cpp で1回だけ定義する。
+// stb_image_write.h は上流の v1.16 をそのまま置く (make stb_image_write.h で取ってこられる)。
+
+namespace png_writer {
+
+struct FileSink {
+	FILE *fp;
+	bool ok;
+};
+
+inline void writeToFile(void *context, void *data, int size) {
+	FileSink *sink = (FileSink *)context;
+	if (fwrite(data, 1, size, sink->fp) != (size_t)size) {
+		sink->ok = false;
+	}
+}
+
+}  // namespace png_writer
+
+inline bool writePNG(const std::string &filename, const uint8_t *pixels,
+	int width, int height, int channels) {
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open an image file: %s\n", filename.c_str());
+		return false;
+	}
+	png_writer::FileSink sink = { fp, true };
+	const bool encoded = stbi_write_png_to_func(png_writer::writeToFile, &sink,
+		width, height, channels, pixels, width * channels) != 0;
+	// バッファに残った分の書き込みエラーは fclose で分かる
+	const bool closed = fclose(fp) == 0;
+	const bool ok = encoded && sink.ok && closed;
+	if (!ok) {
+		fprintf(stderr, "Failed to write an image file: %s\n", filename.c_str());
+	}
+	return ok;
+}
+
+#endif  // _PNG_WRITER_H_
@@ -0,0 +1,344 @@
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// 観測点・観測線・観測領域の値を時系列として記録するクラス
+//
+// 座標は格子のセル単位 (格子点の間は双線形補間する)。
+// 登録した観測対象はチャンネルの並びに展開される:
+//   点     1チャンネル (name)
+//   線     samples個のチャンネル (name[0], name[1], ...)
+//   矩形   3チャンネル (name.mean, name.min, name.max)
+// record() は各ステップの直後に呼び、値をあらかじめ確保したリングバッファに書き込む。
+// バッファがいっぱいになったときと flush() のときにまとめてファイルへ書き出すので、
+// 1ステップあたりのコストは観測対象の数に比例するだけで済む。
+//
+// バイナリ形式:
+//   [uint32 magic, uint32 version, uint32 チャンネル数, uint32 予約]
+//   [char 名前[32]] × チャンネル数
+//   [double ステップ, double × チャンネル数] × 記録回数
+static const uint32_t PROBE_MAGIC = 0x424f5250;  // "PROB"
+static const uint32_t PROBE_VERSION = 1;
+
+class ProbeRecorder {
+public:
+	ProbeRecorder()
+		: xCells_(0)
+		, yCells_(0)
+		, capacity_(0)
+		, head_(0)
+		, count_(0)
+		, unflushed_(0)
+		, fp_(NULL)
+		, binary_(false) {
+	}
+
+	virtual ~ProbeRecorder() {
+		close();
+	}
+
+	// 格子の大きさとリングバッファに保持する記録の回数
+	void init(int xCells, int yCells, int capacity = 1024) {
+		close();
+		xCells_ = xCells;
+		yCells_ = yCells;
+		capacity_ = std::max(1, capacity);
+		channels_.clear();
+		rects_.clear();
+		clearBuffer();
+	}
+
+	// 点 (x, y) の値
+	void addPoint(const std::string &name, double x, double y) {
+		Channel channel;
+		channel.name = name;
+		bilinear(x, y, channel);
+		channels_.push_back(channel);
+		clearBuffer();
+	}
+
+	// (x0, y0) から (x1, y1) までの線分上に等間隔に並べたsamples点の値
+	void addLine(const std::string &name, double x0, double y0, double x1, double y1, int samples) {
+		samples = std::max(2, samples);
+		for (int i = 0; i < samples; i++) {
+			const double t = (double)i / (samples - 1);
+			char suffix[16];
+			sprintf(suffix, "[%d]", i);
+			addPoint(name + suffix, x0 + (x1 - x0) * t, y0 + (y1 - y0) * t);
+		}
+	}
+
+	// セル (x0, y0) から (x1, y1) まで (両端を含む) の平均・最小・最大
+	void addRect(const std::string &name, int x0, int y0, int x1, int y1) {
+		Rect rect;
+		rect.x0 = std::max(0, std::min(x0, x1));
+		rect.y0 = std::max(0, std::min(y0, y1));
+		rect.x1 = std::min(xCells_ - 1, std::max(x0, x1));
+		rect.y1 = std::min(yCells_ - 1, std::max(y0, y1));
+		rect.channel = (int)channels_.size();
+		rects_.push_back(rect);
+
+		static const char *const suffixes[] = { ".mean", ".min", ".max" };
+		for (int i = 0; i < 3; i++) {
+			Channel channel;
+			channel.name = name + suffixes[i];
+			channel.rect = true;
+			channels_.push_back(channel);
+		}
+		clearBuffer();
+	}
+
+	// 書き出し先を開く (記録を始める前に、観測対象をすべて登録してから呼ぶ)
+	bool openCsv(const std::string &filename) {
+		return open(filename, false);
+	}
+
+	bool openBinary(const std::string &filename) {
+		return open(filename, true);
+	}
+
+	bool isOpen() const {
+		return fp_ != NULL;
+	}
+
+	// 現在の値を記録する (fieldは xCells * yCells の配列。行の間隔はpitch、0ならxCells)
+	void record(const double *field, unsigned long long step, int pitch = 0) {
+		const int stride = pitch > 0 ? pitch : xCells_;
+		if (buffer_.empty()) {
+			buffer_.resize((size_t)capacity_ * rowSize());
+		}
+
+		// 書き出していない記録で埋まっていれば先に書き出す
+		if (unflushed_ == capacity_) {
+			flush();
+		}
+
+		double *row = &buffer_[(size_t)head_ * rowSize()];
+		row[0] = (double)step;
+		for (size_t c = 0; c < channels_.size(); c++) {
+			const Channel &channel = channels_[c];
+			if (!channel.rect) {
+				const double *base = field + channel.y * stride + channel.x;
+				row[1 + c] = channel.weight[0] * base[0]
+					+ channel.weight[1] * base[channel.dx]
+					+ channel.weight[2] * base[stride * channel.dy]
+					+ channel.weight[3] * base[stride * channel.dy + channel.dx];
+			}
+		}
+		for (size_t r = 0; r < rects_.size(); r++) {
+			const Rect &rect = rects_[r];
+			double sum = 0.0;
+			double lo = field[rect.y0 * stride + rect.x0];
+			double hi = lo;
+			for (int y = rect.y0; y <= rect.y1; y++) {
+				const double *line = field + y * stride;
+				for (int x = rect.x0; x <= rect.x1; x++) {
+					sum += line[x];
+					lo = std::min(lo, line[x]);
+					hi = std::max(hi, line[x]);
+				}
+			}
+			const int area = (rect.x1 - rect.x0 + 1) * (rect.y1 - rect.y0 + 1);
+			row[1 + rect.channel + 0] = sum / area;
+			row[1 + rect.channel + 1] = lo;
+			row[1 + rect.channel + 2] = hi;
+		}
+
+		head_ = (head_ + 1) % capacity_;
+		count_ = std::min(count_ + 1, capacity_);
+		if (fp_ != NULL) {
+			unflushed_++;
+		}
+	}
+
+	// まだ書き出していない記録をファイルに書き出す
+	bool flush() {
+		if (fp_ == NULL || unflushed_ == 0) {
+			unflushed_ = 0;
+			return true;
+		}
+
+		bool ok = true;
+		const int first = (head_ - unflushed_ + capacity_) % capacity_;
+		for (int i = 0; ok && i < unflushed_; ) {
+			// リングバッファの折り返しまでを1回で書き出す
+			const int index = (first + i) % capacity_;
+			const int n = std::min(unflushed_ - i, capacity_ - index);
+			const double *rows = &buffer_[(size_t)index * rowSize()];
+			if (binary_) {
+				ok = fwrite(rows, sizeof(double) * rowSize(), n, fp_) == (size_t)n;
+			}
+			else {
+				for (int r = 0; ok && r < n; r++) {
+					const double *row = rows + (size_t)r * rowSize();
+					ok = fprintf(fp_, "%llu", (unsigned long long)row[0]) > 0;
+					for (size_t c = 1; ok && c < rowSize(); c++) {
+						ok = fprintf(fp_, ",%.9g", row[c]) > 0;
+					}
+					ok = ok && fputc('\n', fp_) != EOF;
+				}
+			}
+			i += n;
+		}
+		unflushed_ = 0;
+
+		if (!ok) {
+			fprintf(stderr, "Failed to write probe data\n");
+		}
+		return ok;
+	}
+
+	void close() {
+		if (fp_ != NULL) {
+			flush();
+			fclose(fp_);
+			fp_ = NULL;
+		}
+	}
+
+	int numChannels() const {
+		return (int)channels_.size();
+	}
+
+	const std::string &channelName(int c) const {
+		return channels_[c].name;
+	}
+
+	// リングバッファに残っている記録の数
+	int size() const {
+		return count_;
+	}
+
+	// i回前の記録 (0が最新) のチャンネルcの値
+	double value(int c, int i = 0) const {
+		const int index = (head_ - 1 - i + capacity_ * 2) % capacity_;
+		return buffer_[(size_t)index * rowSize() + 1 + c];
+	}
+
+	// i回前の記録のステップ数
+	unsigned long long step(int i = 0) const {
+		const int index = (head_ - 1 - i + capacity_ * 2) % capacity_;
+		return (unsigned long long)buffer_[(size_t)index * rowSize()];
+	}
+
+private:
+	ProbeRecorder(const ProbeRecorder &);
+	ProbeRecorder & operator=(const ProbeRecorder &);
+
+	struct Channel {
+		std::string name;
+		bool rect;
+		int x, y;    // 補間に使う4点の左上
+		int dx, dy;  // 右・下の点までの距離 (格子の端では0)
+		double weight[4];
+
+		Channel()
+			: rect(false)
+			, x(0)
+			, y(0)
+			, dx(0)
+			, dy(0) {
+			std::memset(weight, 0, sizeof(weight));
+		}
+	};
+
+	struct Rect {
+		int x0, y0, x1, y1;
+		int channel;
+	};
+
+	// チャンネルの数が変わったらバッファを確保し直す
+	void clearBuffer() {
+		buffer_.clear();
+		head_ = count_ = unflushed_ = 0;
+	}
+
+	size_t rowSize() const {
+		return channels_.size() + 1;
+	}
+
+	// 双線形補間に使う4点と重み (格子の外は端に寄せる)
+	void bilinear(double x, double y, Channel &channel) const {
+		x = std::min(std::max(x, 0.0), (double)(xCells_ - 1));
+		y = std::min(std::max(y, 0.0), (double)(yCells_ - 1));
+		const int ix = std::min((int)std::floor(x), std::max(0, xCells_ - 2));
+		const int iy = std::min((int)std::floor(y), std::max(0, yCells_ - 2));
+		const int ix1 = std::min(ix + 1, xCells_ - 1);
+		const int iy1 = std::min(iy + 1, yCells_ - 1);
+		const double fx = x - ix;
+		const double fy = y - iy;
+
+		channel.x = ix;
+		channel.y = iy;
+		channel.dx = ix1 - ix;
+		channel.dy = iy1 - iy;
+		channel.weight[0] = (1.0 - fx) * (1.0 - fy);
+		channel.weight[1] = fx * (1.0 - fy);
+		channel.weight[2] = (1.0 - fx) * fy;
+		channel.weight[3] = fx * fy;
+	}
+
+	bool open(const std::string &filename, bool binary) {
+		if (fp_ != NULL) {
+			fclose(fp_);
+			fp_ = NULL;
+		}
+
+		FILE *fp = fopen(filename.c_str(), binary ? "wb" : "w");
+		if (fp == NULL) {
+			fprintf(stderr, "Failed to open a probe file: %s\n", filename.c_str());
+			return false;
+		}
+
+		bool ok = true;
+		if (binary) {
+			const uint32_t header[4] = { PROBE_MAGIC, PROBE_VERSION, (uint32_t)channels_.size(), 0 };
+			ok = fwrite(header, sizeof(header), 1, fp) == 1;
+			for (size_t c = 0; ok && c < channels_.size(); c++) {
+				char name[32];
+				std::memset(name, 0, sizeof(name));
+				strncpy(name, channels_[c].name.c_str(), sizeof(name) - 1);
+				ok = fwrite(name, sizeof(name), 1, fp) == 1;
+			}
+		}
+		else {
+			ok = fprintf(fp, "step") > 0;
+			for (size_t c = 0; ok && c < channels_.size(); c++) {
+				ok = fprintf(fp, ",%s", channels_[c].name.c_str()) > 0;
+			}
+			ok = ok && fputc('\n', fp) != EOF;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "Failed to write a probe file: %s\n", filename.c_str());
+			fclose(fp);
+			return false;
+		}
+
+		fp_ = fp;
+		binary_ = binary;
+		unflushed_ = 0;
+		buffer_.resize((size_t)capacity_ * rowSize());
+		return true;
+	}
+
+	int xCells_, yCells_;
+	std::vector<Channel> channels_;
+	std::vector<Rect> rects_;
+	std::vector<double> buffer_;  // capacity_ × (1 + チャンネル数)
+	int capacity_;
+	int head_;                    // 次に書き込む位置
+	int count_;                   // バッファに入っている記録の数
+	int unflushed_;               // まだ書き出していない記録の数
+	FILE *fp_;
+	bool binary_;
+};
+
+#endif  // _PROBE_H_
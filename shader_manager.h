@@ -0,0 +1,352 @@
+#ifndef _SHADER_MANAGER_H_
+#define _SHADER_MANAGER_H_
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+#include <glad/gl.h>
+
+// シェーダプログラムをファイルから作り、まとめて管理するクラス
+//
+// - リンクしたプログラムのバイナリ (glGetProgramBinary) をキャッシュディレクトリに保存し、
+//   次回からはソースが同じならコンパイルせずに読み込む。キャッシュのキーはソースと
+//   GL_RENDERER/GL_VERSIONのハッシュなので、ソースやドライバが変われば作り直す
+// - poll() でシェーダのファイルの更新時刻を調べ、変わっていれば作り直す
+// - 作り直しに失敗したときは、エラーを表示して前のプログラムを使い続ける
+class ShaderManager {
+public:
+	ShaderManager()
+		: cacheDirectory_("shader_cache/")
+		, pollInterval_(0.25)
+		, lastPoll_(std::chrono::steady_clock::now()) {
+	}
+
+	virtual ~ShaderManager() {
+	}
+
+	// 空文字列ならキャッシュを使わない
+	void setCacheDirectory(const std::string &directory) {
+		cacheDirectory_ = directory;
+		if (!cacheDirectory_.empty() && cacheDirectory_[cacheDirectory_.size() - 1] != '/') {
+			cacheDirectory_ += '/';
+		}
+	}
+
+	// 頂点シェーダとフラグメントシェーダからプログラムを作る (失敗したら-1)
+	int add(const std::string &vertFile, const std::string &fragFile) {
+		Entry entry;
+		entry.stages.push_back(Stage(vertFile, GL_VERTEX_SHADER));
+		entry.stages.push_back(Stage(fragFile, GL_FRAGMENT_SHADER));
+		return addEntry(entry);
+	}
+
+	// コンピュートシェーダからプログラムを作る (失敗したら-1)
+	int addCompute(const std::string &compFile) {
+		Entry entry;
+		entry.stages.push_back(Stage(compFile, GL_COMPUTE_SHADER));
+		return addEntry(entry);
+	}
+
+	GLuint program(int handle) const {
+		return handle >= 0 && handle < (int)entries_.size() ? entries_[handle].programId : 0;
+	}
+
+	// ファイルが更新されたプログラムを作り直す (作り直したものがあればtrue)
+	// 毎フレーム呼んでよい (更新時刻を調べるのは一定間隔ごと)
+	bool poll() {
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (std::chrono::duration<double>(now - lastPoll_).count() < pollInterval_) {
+			return false;
+		}
+		lastPoll_ = now;
+
+		bool reloaded = false;
+		for (size_t i = 0; i < entries_.size(); i++) {
+			Entry &entry = entries_[i];
+			const std::vector<long long> mtimes = modificationTimes(entry);
+			if (mtimes == entry.mtimes) {
+				continue;
+			}
+
+			// 失敗しても同じファイルで何度も試さないように、先に更新時刻を記録する
+			entry.mtimes = mtimes;
+			const GLuint programId = build(entry);
+			if (programId == 0) {
+				fprintf(stderr, "Keeping the previous program for: %s\n", entry.stages[0].file.c_str());
+				continue;
+			}
+
+			glDeleteProgram(entry.programId);
+			entry.programId = programId;
+			reloaded = true;
+			fprintf(stderr, "Reloaded: %s\n", entry.stages[0].file.c_str());
+		}
+		return reloaded;
+	}
+
+	void release() {
+		for (size_t i = 0; i < entries_.size(); i++) {
+			glDeleteProgram(entries_[i].programId);
+		}
+		entries_.clear();
+	}
+
+private:
+	ShaderManager(const ShaderManager &);
+	ShaderManager & operator=(const ShaderManager &);
+
+	struct Stage {
+		Stage(const std::string &file_, GLenum type_)
+			: file(file_)
+			, type(type_) {
+		}
+		std::string file;
+		GLenum type;
+	};
+
+	struct Entry {
+		Entry()
+			: programId(0) {
+		}
+		std::vector<Stage> stages;
+		std::vector<long long> mtimes;
+		GLuint programId;
+	};
+
+	// キャッシュファイルのヘッダ
+	struct CacheHeader {
+		uint32_t magic;
+		uint32_t format;
+		uint32_t length;
+	};
+	static const uint32_t CACHE_MAGIC = 0x43425053;  // "SPBC"
+
+	int addEntry(Entry &entry) {
+		entry.mtimes = modificationTimes(entry);
+
+		const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		bool cached = false;
+		entry.programId = build(entry, &cached);
+		if (entry.programId == 0) {
+			return -1;
+		}
+		fprintf(stderr, "Shader program ready in %.1f ms (%s): %s\n",
+			1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(),
+			cached ? "cached binary" : "compiled", entry.stages[0].file.c_str());
+
+		entries_.push_back(entry);
+		return (int)entries_.size() - 1;
+	}
+
+	static std::vector<long long> modificationTimes(const Entry &entry) {
+		std::vector<long long> mtimes;
+		for (size_t i = 0; i < entry.stages.size(); i++) {
+			struct stat st;
+			mtimes.push_back(stat(entry.stages[i].file.c_str(), &st) == 0 ? (long long)st.st_mtime : -1);
+		}
+		return mtimes;
+	}
+
+	static bool readFile(const std::string &filename, std::string &code) {
+		std::ifstream reader(filename.c_str(), std::ios::in | std::ios::binary);
+		if (!reader.is_open()) {
+			fprintf(stderr, "Failed to load a shader: %s\n", filename.c_str());
+			return false;
+		}
+		code.assign(std::istreambuf_iterator<char>(reader), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	// FNV-1a (64ビット)
+	static uint64_t hashBytes(const void *data, size_t n, uint64_t hash) {
+		const unsigned char *bytes = (const unsigned char *)data;
+		for (size_t i = 0; i < n; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// ソースを読んでプログラムを作る (失敗したら0)
+	GLuint build(const Entry &entry, bool *cached = NULL) const {
+		std::vector<std::string> sources(entry.stages.size());
+		uint64_t hash = 14695981039346656037ull;
+		const char *renderer = (const char *)glGetString(GL_RENDERER);
+		const char *version = (const char *)glGetString(GL_VERSION);
+		hash = hashBytes(renderer != NULL ? renderer : "", renderer != NULL ? strlen(renderer) : 0, hash);
+		hash = hashBytes(version != NULL ? version : "", version != NULL ? strlen(version) : 0, hash);
+		for (size_t i = 0; i < entry.stages.size(); i++) {
+			if (!readFile(entry.stages[i].file, sources[i])) {
+				return 0;
+			}
+			hash = hashBytes(&entry.stages[i].type, sizeof(GLenum), hash);
+			hash = hashBytes(sources[i].data(), sources[i].size(), hash);
+		}
+
+		char key[32];
+		sprintf(key, "%016llx.bin", (unsigned long long)hash);
+		const std::string cacheFile = cacheDirectory_.empty() ? std::string() : cacheDirectory_ + key;
+
+		// キャッシュがあればそれを使う
+		if (!cacheFile.empty()) {
+			const GLuint programId = loadBinary(cacheFile);
+			if (programId != 0) {
+				if (cached != NULL) {
+					*cached = true;
+				}
+				return programId;
+			}
+		}
+
+		const GLuint programId = compileAndLink(entry, sources);
+		if (programId != 0 && !cacheFile.empty()) {
+			saveBinary(cacheFile, programId);
+		}
+		return programId;
+	}
+
+	static GLuint compileAndLink(const Entry &entry, const std::vector<std::string> &sources) {
+		const GLuint programId = glCreateProgram();
+		std::vector<GLuint> shaderIds;
+		bool ok = true;
+		for (size_t i = 0; ok && i < entry.stages.size(); i++) {
+			const GLuint shaderId = glCreateShader(entry.stages[i].type);
+			const char *codeChars = sources[i].c_str();
+			glShaderSource(shaderId, 1, &codeChars, NULL);
+			glCompileShader(shaderId);
+			shaderIds.push_back(shaderId);
+
+			GLint compileStatus;
+			glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
+			if (compileStatus == GL_FALSE) {
+				GLint logLength = 0;
+				glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
+				std::string errMsg(logLength > 0 ? logLength : 1, '\0');
+				glGetShaderInfoLog(shaderId, (GLsizei)errMsg.size(), NULL, &errMsg[0]);
+				fprintf(stderr, "Failed to compile a shader: %s\n[ ERROR ] %s\n",
+					entry.stages[i].file.c_str(), errMsg.c_str());
+				ok = false;
+				break;
+			}
+			glAttachShader(programId, shaderId);
+		}
+
+		if (ok) {
+			glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(programId);
+
+			GLint linkState;
+			glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
+			if (linkState == GL_FALSE) {
+				GLint logLength = 0;
+				glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
+				std::string errMsg(logLength > 0 ? logLength : 1, '\0');
+				glGetProgramInfoLog(programId, (GLsizei)errMsg.size(), NULL, &errMsg[0]);
+				fprintf(stderr, "Failed to link shaders: %s\n[ ERROR ] %s\n",
+					entry.stages[0].file.c_str(), errMsg.c_str());
+				ok = false;
+			}
+		}
+
+		for (size_t i = 0; i < shaderIds.size(); i++) {
+			glDeleteShader(shaderIds[i]);
+		}
+		if (!ok) {
+			glDeleteProgram(programId);
+			return 0;
+		}
+		return programId;
+	}
+
+	static GLuint loadBinary(const std::string &filename) {
+		FILE *fp = fopen(filename.c_str(), "rb");
+		if (fp == NULL) {
+			return 0;
+		}
+
+		CacheHeader header;
+		std::vector<char> binary;
+		bool ok = fread(&header, sizeof(CacheHeader), 1, fp) == 1 && header.magic == CACHE_MAGIC;
+		if (ok) {
+			binary.resize(header.length);
+			ok = header.length > 0 && fread(&binary[0], 1, binary.size(), fp) == binary.size();
+		}
+		fclose(fp);
+		if (!ok) {
+			return 0;
+		}
+
+		// ドライバが更新されたなどの理由で読み込めなければ、作り直す
+		const GLuint programId = glCreateProgram();
+		glProgramBinary(programId, header.format, &binary[0], (GLsizei)binary.size());
+		GLint linkState;
+		glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
+		if (linkState == GL_FALSE) {
+			glDeleteProgram(programId);
+			return 0;
+		}
+		return programId;
+	}
+
+	static void saveBinary(const std::string &filename, GLuint programId) {
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		GLint length = 0;
+		glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (numFormats == 0 || length <= 0) {
+			return;
+		}
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(programId, length, &length, &format, &binary[0]);
+
+		const std::string directory = filename.substr(0, filename.find_last_of('/'));
+#if defined(_WIN32)
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+
+		// 書き込み途中のファイルを読まないように、一時ファイルに書いてから名前を変える
+		const std::string tmpname = filename + ".tmp";
+		FILE *fp = fopen(tmpname.c_str(), "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "Failed to open a shader cache file: %s\n", tmpname.c_str());
+			return;
+		}
+		CacheHeader header;
+		header.magic = CACHE_MAGIC;
+		header.format = format;
+		header.length = (uint32_t)length;
+		bool ok = fwrite(&header, sizeof(CacheHeader), 1, fp) == 1;
+		ok = ok && fwrite(&binary[0], 1, length, fp) == (size_t)length;
+		ok = (fclose(fp) == 0) && ok;
+		if (!ok) {
+			remove(tmpname.c_str());
+			return;
+		}
+#if defined(_WIN32)
+		remove(filename.c_str());
+#endif
+		rename(tmpname.c_str(), filename.c_str());
+	}
+
+	std::string cacheDirectory_;
+	double pollInterval_;
+	std::chrono::steady_clock::time_point lastPoll_;
+	std::vector<Entry> entries_;
+};
+
+#endif  // _SHADER_MANAGER_H_
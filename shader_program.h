@@ -0,0 +1,120 @@
+#ifndef _SHADER_PROGRAM_H_
+#define _SHADER_PROGRAM_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+
+// リンク済みのシェーダプログラムと、そのuniform変数の場所をまとめて持つクラス
+// 場所はattachのときに一度だけ調べておくので、描画のたびに
+// glGetUniformLocationを呼ぶ必要がない
+class ShaderProgram {
+public:
+	ShaderProgram()
+		: programId_(0) {
+	}
+
+	virtual ~ShaderProgram() {
+	}
+
+	// リンクした直後に呼ぶ
+	void attach(GLuint programId) {
+		programId_ = programId;
+		locations_.clear();
+
+		GLint numUniforms = 0, maxLength = 0;
+		glGetProgramiv(programId_, GL_ACTIVE_UNIFORMS, &numUniforms);
+		glGetProgramiv(programId_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<char> name(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < numUniforms; i++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(programId_, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+
+			// uniformブロックの中の変数は場所を持たない (-1が返る)
+			const GLint location = glGetUniformLocation(programId_, &name[0]);
+			if (location < 0) {
+				continue;
+			}
+
+			// 配列は "name[0]" で返るので "name" でも引けるようにする
+			std::string key(&name[0], length);
+			if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0) {
+				key.resize(key.size() - 3);
+			}
+			locations_[key] = location;
+		}
+	}
+
+	GLuint id() const {
+		return programId_;
+	}
+
+	// 見つからなければ-1 (glUniform*は-1を無視する)
+	GLint location(const std::string &name) const {
+		std::map<std::string, GLint>::const_iterator it = locations_.find(name);
+		return it != locations_.end() ? it->second : -1;
+	}
+
+	// uniformブロックを結合番号に対応づける
+	bool bindBlock(const char *name, GLuint binding) const {
+		const GLuint index = glGetUniformBlockIndex(programId_, name);
+		if (index == GL_INVALID_INDEX) {
+			return false;
+		}
+		glUniformBlockBinding(programId_, index, binding);
+		return true;
+	}
+
+private:
+	GLuint programId_;
+	std::map<std::string, GLint> locations_;
+};
+
+// uniformブロックに渡すデータを持つバッファ (視点の行列など、複数のシェーダで共有するもの)
+class UniformBuffer {
+public:
+	UniformBuffer()
+		: bufferId_(0)
+		, size_(0) {
+	}
+
+	virtual ~UniformBuffer() {
+	}
+
+	void create(size_t size, GLuint binding) {
+		size_ = size;
+		glGenBuffers(1, &bufferId_);
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId_);
+		glBufferData(GL_UNIFORM_BUFFER, size_, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, bufferId_);
+	}
+
+	void update(const void *data) {
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId_);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size_, data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void release() {
+		if (bufferId_ != 0) {
+			glDeleteBuffers(1, &bufferId_);
+			bufferId_ = 0;
+		}
+	}
+
+private:
+	UniformBuffer(const UniformBuffer &);
+	UniformBuffer & operator=(const UniformBuffer &);
+
+	GLuint bufferId_;
+	size_t size_;
+};
+
+#endif  // _SHADER_PROGRAM_H_
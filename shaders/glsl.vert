@@ -4,7 +4,10 @@ layout(location = 0) in vec3 in_position;
 
 out float fragHeight;
 
-uniform mat4 u_mvpMat;
+// 視点に関するデータ (視点が変わったときだけ更新される)
+layout(std140) uniform ViewData {
+    mat4 u_mvpMat;
+};
 
 void main() {
     gl_Position = u_mvpMat * vec4(in_position, 1.0);
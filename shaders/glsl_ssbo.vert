@@ -0,0 +1,23 @@
+#version 430
+
+// コンピュートシェーダで計算した高さ (SSBO) から直接頂点を作る
+layout(std430, binding = 0) readonly buffer Heights { float heights[]; };
+
+out float fragHeight;
+
+// 視点に関するデータ (視点が変わったときだけ更新される)
+layout(std140) uniform ViewData {
+    mat4 u_mvpMat;
+};
+uniform int u_xCells;
+uniform int u_yCells;
+uniform float u_dx;
+
+void main() {
+    int x = gl_VertexID % u_xCells;
+    int y = gl_VertexID / u_xCells;
+    vec3 position = vec3(float(x - u_xCells / 2) * u_dx, float(y - u_yCells / 2) * u_dx, heights[gl_VertexID]);
+
+    gl_Position = u_mvpMat * vec4(position, 1.0);
+    fragHeight = position.z;
+}
@@ -0,0 +1,513 @@
+#ifndef _SHALLOW_WATER_H_
+#define _SHALLOW_WATER_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "grid.h"
+#include "parallel.h"
+#include "stencil.h"
+#include "simd.h"
+
+// 非線形の浅水方程式 (平らな底、水深 h = depth + 水面の高さ)
+//
+//   ∂h/∂t  + ∂(hu)/∂x + ∂(hv)/∂y = 0
+//   ∂hu/∂t + ∂(hu^2 + g h^2 / 2)/∂x + ∂(huv)/∂y = 0
+//   ∂hv/∂t + ∂(huv)/∂x + ∂(hv^2 + g h^2 / 2)/∂y = 0
+//
+// 1次の有限体積法で、セルの境界の流束はRusanov (局所Lax-Friedrichs) かHLLで求める。
+// 波動方程式 (water_eq.h) と違って振幅が水深に比べて大きくても正しく、波の前面が切り立っていく。
+// 値は水面の高さ (静水面からの差) と運動量 hu, hv の3つのGrid2D (SoA) で、現在・次の2組を入れ替えて使う。
+// 水面の高さを持つので、heights() と pitch() は WaveEquation と同じように描画や出力に使える。
+//
+// step() は行を parallelFor で分け、各行で x方向の境界の流束、下側のy方向の境界の流束
+// (上側は前の行で計算したもの) を求めてからセルを更新する。流束と更新はsimd.hの型で2セルずつ計算する。
+// 時間刻みは更新のときに求めた最大の波の速さ |u| + sqrt(g h) からCFL条件で決め、maxDt を超えない。
+// 乾いたセル (h = 0) は扱わない (h は minDepth で下から抑える)。
+//
+// 境界は EdgeBoundary の方針を読み替える:
+//   周期境界              周期境界
+//   ノイマン・吸収境界    流出 (すべての値を内側の隣と同じにする)
+//   それ以外 (既定)       壁 (法線方向の運動量の符号を反転して反射させる)
+
+enum ShallowWaterFlux {
+	SHALLOW_WATER_RUSANOV = 0,
+	SHALLOW_WATER_HLL
+};
+
+// step() の各部分にかかった時間 (秒)
+// 流束と更新は各スレッドの時間の合計 (setProfiling(true) のときだけ測る)、それ以外は経過時間
+struct ShallowWaterTiming {
+	double xFluxSeconds;
+	double yFluxSeconds;
+	double updateSeconds;
+	double boundarySeconds;
+	double stepSeconds;
+	unsigned long long steps;
+
+	ShallowWaterTiming()
+		: xFluxSeconds(0.0)
+		, yFluxSeconds(0.0)
+		, updateSeconds(0.0)
+		, boundarySeconds(0.0)
+		, stepSeconds(0.0)
+		, steps(0) {
+	}
+};
+
+class ShallowWater {
+public:
+	ShallowWater()
+		: depth_(1.0)
+		, gravity_(9.81)
+		, dx_(0.01)
+		, maxDt_(0.0005)
+		, cfl_(0.45)
+		, minDepth_(1e-6)
+		, flux_(SHALLOW_WATER_RUSANOV)
+		, dt_(0.0)
+		, time_(0.0)
+		, maxSpeed_(0.0)
+		, curr_(0)
+		, profiling_(false)
+		, steps_(0) {
+	}
+
+	virtual ~ShallowWater() {
+	}
+
+	// 格子の大きさ、静水の深さ、セルの幅、時間刻みの上限、重力加速度
+	// 値は静水 (高さ0, 運動量0) で初期化される
+	void setParams(int xCells, int yCells, double depth, double dx = 0.01, double maxDt = 0.0005,
+		double gravity = 9.81) {
+		depth_ = depth;
+		dx_ = dx;
+		maxDt_ = maxDt;
+		gravity_ = gravity;
+		for (int i = 0; i < 2; i++) {
+			eta_[i].allocate(xCells, yCells);
+			hu_[i].allocate(xCells, yCells);
+			hv_[i].allocate(xCells, yCells);
+		}
+		curr_ = 0;
+		steps_ = 0;
+		time_ = 0.0;
+		timing_ = ShallowWaterTiming();
+	}
+
+	void setFlux(ShallowWaterFlux flux) {
+		flux_ = flux;
+	}
+
+	ShallowWaterFlux flux() const {
+		return flux_;
+	}
+
+	// 時間刻みを決めるクーラン数 (2次元で安定なのは0.5まで)
+	void setCfl(double cfl) {
+		cfl_ = cfl;
+	}
+
+	// 流束と更新の時間をスレッドごとに測るかどうか
+	void setProfiling(bool profiling) {
+		profiling_ = profiling;
+	}
+
+	// 水面の高さ (静水面から) と運動量
+	void set(int x, int y, double height, double hu = 0.0, double hv = 0.0) {
+		eta_[curr_].at(x, y) = height;
+		hu_[curr_].at(x, y) = hu;
+		hv_[curr_].at(x, y) = hv;
+	}
+
+	double get(int x, int y) const {
+		return eta_[curr_].at(x, y);
+	}
+
+	// 境界を方針に合わせ、最初の時間刻みを決める
+	void start() {
+		makeFieldBoundaries();
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		double *fields[] = { eta_[curr_].origin(), hu_[curr_].origin(), hv_[curr_].origin() };
+		for (int f = 0; f < 3; f++) {
+			for (int y = 1; y < H - 1; y++) {
+				fieldBoundary_[f].applyRow(fields[f], fields[f], P, W, y);
+			}
+			fieldBoundary_[f].applyTopBottom(fields[f], fields[f], P, W, H);
+		}
+		maxSpeed_ = initialMaxSpeed();
+		steps_ = 0;
+		time_ = 0.0;
+	}
+
+	void step() {
+		const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		dt_ = nextDt();
+		if (flux_ == SHALLOW_WATER_HLL) {
+			sweep<HllFlux>();
+		}
+		else {
+			sweep<RusanovFlux>();
+		}
+
+		const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		fieldBoundary_[0].applyTopBottom(eta_[1 - curr_].origin(), eta_[curr_].origin(), P, W, H);
+		fieldBoundary_[1].applyTopBottom(hu_[1 - curr_].origin(), hu_[curr_].origin(), P, W, H);
+		fieldBoundary_[2].applyTopBottom(hv_[1 - curr_].origin(), hv_[curr_].origin(), P, W, H);
+		const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+		curr_ = 1 - curr_;
+		time_ += dt_;
+		steps_++;
+		timing_.boundarySeconds += std::chrono::duration<double>(t2 - t1).count();
+		timing_.stepSeconds += std::chrono::duration<double>(t2 - t0).count();
+		timing_.steps++;
+	}
+
+	// セル (x, y) の水面の高さは heights()[y * pitch() + x]
+	double *heights() const {
+		return eta_[curr_].origin();
+	}
+
+	// 運動量 (heights() と同じ並び)
+	double *momentumX() const {
+		return hu_[curr_].origin();
+	}
+
+	double *momentumY() const {
+		return hv_[curr_].origin();
+	}
+
+	// 水の体積 (内部のセルの水深の和 * dx^2。壁と周期境界では変わらない)
+	double volume() const {
+		double sum = 0.0;
+		for (int y = 1; y < yCells() - 1; y++) {
+			for (int x = 1; x < xCells() - 1; x++) {
+				sum += depth_ + eta_[curr_].at(x, y);
+			}
+		}
+		return sum * dx_ * dx_;
+	}
+
+	// 境界の扱い (start() の前に設定する)
+	EdgeBoundary &boundary() {
+		return boundary_;
+	}
+
+	const ShallowWaterTiming &timing() const {
+		return timing_;
+	}
+
+	void resetTiming() {
+		timing_ = ShallowWaterTiming();
+	}
+
+	double depth() const {
+		return depth_;
+	}
+
+	double dx() const {
+		return dx_;
+	}
+
+	// 直前のステップの時間刻みと経過時間
+	double dt() const {
+		return dt_;
+	}
+
+	double time() const {
+		return time_;
+	}
+
+	// 現在の最大の波の速さ |u| + sqrt(g h)
+	double maxSpeed() const {
+		return maxSpeed_;
+	}
+
+	int xCells() const {
+		return eta_[curr_].xCells();
+	}
+
+	int yCells() const {
+		return eta_[curr_].yCells();
+	}
+
+	// 行の間隔 (xCellsより大きいことがある)
+	int pitch() const {
+		return eta_[curr_].pitch();
+	}
+
+	// 現在の値を xCells * yCells の詰めた配列にコピーする
+	void copyHeights(double *heights) const {
+		eta_[curr_].pack(heights);
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+private:
+	ShallowWater(const ShallowWater &);
+	ShallowWater & operator=(const ShallowWater &);
+
+	// セルの境界の流束は F = a FL + b FR - d (UR - UL) の形にする
+	// (uL, cL など: 法線方向の速さと波の速さ sqrt(g h))
+	struct RusanovFlux {
+		template <class T>
+		static void weights(const T &uL, const T &cL, const T &uR, const T &cR, T &a, T &b, T &d) {
+			a = T(0.5);
+			b = T(0.5);
+			d = T(0.5) * simdMax(simdAbs(uL) + cL, simdAbs(uR) + cR);
+		}
+	};
+
+	// HLL (左右に進む一番速い波の間を1つの状態で近似する)
+	// sL >= 0 なら FL、sR <= 0 なら FR になるように、sL, sR を0で抑えて場合分けをなくしている
+	struct HllFlux {
+		template <class T>
+		static void weights(const T &uL, const T &cL, const T &uR, const T &cR, T &a, T &b, T &d) {
+			const T sL = simdMin(simdMin(uL - cL, uR - cR), T(0.0));
+			const T sR = simdMax(simdMax(uL + cL, uR + cR), T(0.0));
+			const T inv = T(1.0) / (sR - sL);
+			a = sR * inv;
+			b = -sL * inv;
+			d = -(sL * sR * inv);
+		}
+	};
+
+	// 流束の計算に使う定数
+	struct Constants {
+		double depth;
+		double gravity;
+		double halfGravity;
+		double minDepth;
+	};
+
+	// count個の境界の流束 (i番目の境界の左 (上) のセルは *0[i]、右 (下) は *1[i])
+	// e: 水面の高さ, n: 法線方向の運動量, t: 接線方向の運動量
+	template <class Flux>
+	static void faceFluxes(const Constants &k, const double *e0, const double *n0, const double *t0,
+		const double *e1, const double *n1, const double *t1, int count,
+		double *fe, double *fn, double *ft) {
+		int i = 0;
+#if defined(SIMD_USE_SSE2)
+		for (; i + 2 <= count; i += 2) {
+			faceFlux<Flux, Double2>(k, e0 + i, n0 + i, t0 + i, e1 + i, n1 + i, t1 + i, fe + i, fn + i, ft + i);
+		}
+#endif
+		for (; i < count; i++) {
+			faceFlux<Flux, double>(k, e0 + i, n0 + i, t0 + i, e1 + i, n1 + i, t1 + i, fe + i, fn + i, ft + i);
+		}
+	}
+
+	template <class Flux, class T>
+	static void faceFlux(const Constants &k, const double *e0, const double *n0, const double *t0,
+		const double *e1, const double *n1, const double *t1, double *fe, double *fn, double *ft) {
+		const T eL = simdLoad<T>(e0), nL = simdLoad<T>(n0), tL = simdLoad<T>(t0);
+		const T eR = simdLoad<T>(e1), nR = simdLoad<T>(n1), tR = simdLoad<T>(t1);
+		const T hL = simdMax(eL + T(k.depth), T(k.minDepth));
+		const T hR = simdMax(eR + T(k.depth), T(k.minDepth));
+		const T uL = nL / hL;
+		const T uR = nR / hR;
+		const T cL = simdSqrt(T(k.gravity) * hL);
+		const T cR = simdSqrt(T(k.gravity) * hR);
+
+		T a(0.0), b(0.0), d(0.0);
+		Flux::weights(uL, cL, uR, cR, a, b, d);
+
+		// 物理的な流束 (hu, hu^2 + g h^2 / 2, huv) を混ぜる
+		simdStore(fe, a * nL + b * nR - d * (eR - eL));
+		simdStore(fn, a * (nL * uL + T(k.halfGravity) * hL * hL) + b * (nR * uR + T(k.halfGravity) * hR * hR)
+			- d * (nR - nL));
+		simdStore(ft, a * (tL * uL) + b * (tR * uR) - d * (tR - tL));
+	}
+
+	// セル [x0, x1) を更新し、新しい値での最大の波の速さを返す
+	// fx*: x方向の境界の流束 (fx[x] がセル x - 1 と x の間)、gt*, gb*: 上と下の境界の流束
+	template <class T>
+	static T updateCells(const Constants &k, double r, int x,
+		const double *eta, const double *hu, const double *hv, double *etaN, double *huN, double *hvN,
+		const double *fxe, const double *fxu, const double *fxv,
+		const double *gte, const double *gtu, const double *gtv,
+		const double *gbe, const double *gbu, const double *gbv) {
+		const T R(r);
+		const T e = simdLoad<T>(eta + x) - R * (simdLoad<T>(fxe + x + 1) - simdLoad<T>(fxe + x))
+			- R * (simdLoad<T>(gbe + x) - simdLoad<T>(gte + x));
+		const T u = simdLoad<T>(hu + x) - R * (simdLoad<T>(fxu + x + 1) - simdLoad<T>(fxu + x))
+			- R * (simdLoad<T>(gbu + x) - simdLoad<T>(gtu + x));
+		const T v = simdLoad<T>(hv + x) - R * (simdLoad<T>(fxv + x + 1) - simdLoad<T>(fxv + x))
+			- R * (simdLoad<T>(gbv + x) - simdLoad<T>(gtv + x));
+		simdStore(etaN + x, e);
+		simdStore(huN + x, u);
+		simdStore(hvN + x, v);
+
+		const T h = simdMax(e + T(k.depth), T(k.minDepth));
+		return simdMax(simdAbs(u), simdAbs(v)) / h + simdSqrt(T(k.gravity) * h);
+	}
+
+	template <class Flux>
+	void sweep() {
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		const double *eta = eta_[curr_].origin();
+		const double *hu = hu_[curr_].origin();
+		const double *hv = hv_[curr_].origin();
+		double *etaN = eta_[1 - curr_].origin();
+		double *huN = hu_[1 - curr_].origin();
+		double *hvN = hv_[1 - curr_].origin();
+		const double r = dt_ / dx_;
+		const Constants k = constants();
+		const bool profiling = profiling_;
+		double maxSpeed = 0.0;
+		std::mutex mutex;
+
+		parallelFor(1, H - 1, [&](int y0, int y1) {
+			typedef std::chrono::steady_clock Clock;
+			// x方向の流束、上と下のy方向の流束 (各3成分)
+			std::vector<double> buffer((size_t)9 * W);
+			double *fx[3], *gt[3], *gb[3];
+			for (int c = 0; c < 3; c++) {
+				fx[c] = &buffer[(size_t)c * W];
+				gt[c] = &buffer[(size_t)(3 + c) * W];
+				gb[c] = &buffer[(size_t)(6 + c) * W];
+			}
+			double xFlux = 0.0, yFlux = 0.0, update = 0.0;
+			double chunkMax = 0.0;
+
+			// 最初の行の上の境界 (y方向では hv が法線方向)
+			const size_t top = (size_t)(y0 - 1) * P;
+			faceFluxes<Flux>(k, eta + top + 1, hv + top + 1, hu + top + 1, eta + top + P + 1, hv + top + P + 1,
+				hu + top + P + 1, W - 2, gt[0] + 1, gt[2] + 1, gt[1] + 1);
+
+			for (int y = y0; y < y1; y++) {
+				const size_t o = (size_t)y * P;
+				Clock::time_point t0, t1, t2;
+				if (profiling) {
+					t0 = Clock::now();
+				}
+				faceFluxes<Flux>(k, eta + o, hu + o, hv + o, eta + o + 1, hu + o + 1, hv + o + 1, W - 1,
+					fx[0] + 1, fx[1] + 1, fx[2] + 1);
+				if (profiling) {
+					t1 = Clock::now();
+				}
+				faceFluxes<Flux>(k, eta + o + 1, hv + o + 1, hu + o + 1, eta + o + P + 1, hv + o + P + 1,
+					hu + o + P + 1, W - 2, gb[0] + 1, gb[2] + 1, gb[1] + 1);
+				if (profiling) {
+					t2 = Clock::now();
+				}
+
+				int x = 1;
+#if defined(SIMD_USE_SSE2)
+				Double2 rowMax(0.0);
+				for (; x + 2 <= W - 1; x += 2) {
+					rowMax = simdMax(rowMax, updateCells<Double2>(k, r, x, eta + o, hu + o, hv + o,
+						etaN + o, huN + o, hvN + o, fx[0], fx[1], fx[2], gt[0], gt[1], gt[2], gb[0], gb[1], gb[2]));
+				}
+				chunkMax = std::max(chunkMax, rowMax.horizontalMax());
+#endif
+				for (; x < W - 1; x++) {
+					chunkMax = std::max(chunkMax, updateCells<double>(k, r, x, eta + o, hu + o, hv + o,
+						etaN + o, huN + o, hvN + o, fx[0], fx[1], fx[2], gt[0], gt[1], gt[2], gb[0], gb[1], gb[2]));
+				}
+				fieldBoundary_[0].applyRow(etaN, eta, P, W, y);
+				fieldBoundary_[1].applyRow(huN, hu, P, W, y);
+				fieldBoundary_[2].applyRow(hvN, hv, P, W, y);
+
+				// 下の境界の流束は次の行の上の境界になる
+				for (int c = 0; c < 3; c++) {
+					std::swap(gt[c], gb[c]);
+				}
+				if (profiling) {
+					const Clock::time_point t3 = Clock::now();
+					xFlux += std::chrono::duration<double>(t1 - t0).count();
+					yFlux += std::chrono::duration<double>(t2 - t1).count();
+					update += std::chrono::duration<double>(t3 - t2).count();
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			maxSpeed = std::max(maxSpeed, chunkMax);
+			timing_.xFluxSeconds += xFlux;
+			timing_.yFluxSeconds += yFlux;
+			timing_.updateSeconds += update;
+		});
+		maxSpeed_ = maxSpeed;
+	}
+
+	Constants constants() const {
+		Constants k;
+		k.depth = depth_;
+		k.gravity = gravity_;
+		k.halfGravity = 0.5 * gravity_;
+		k.minDepth = minDepth_;
+		return k;
+	}
+
+	double nextDt() const {
+		return maxSpeed_ > 0.0 ? std::min(maxDt_, cfl_ * dx_ / maxSpeed_) : maxDt_;
+	}
+
+	// start() で現在の値から最大の波の速さを求める
+	double initialMaxSpeed() const {
+		const Constants k = constants();
+		double speed = 0.0;
+		for (int y = 1; y < yCells() - 1; y++) {
+			for (int x = 1; x < xCells() - 1; x++) {
+				const double h = std::max(eta_[curr_].at(x, y) + k.depth, k.minDepth);
+				const double u = std::max(std::fabs(hu_[curr_].at(x, y)), std::fabs(hv_[curr_].at(x, y))) / h;
+				speed = std::max(speed, u + std::sqrt(k.gravity * h));
+			}
+		}
+		return speed;
+	}
+
+	// boundary_ から各成分の境界を作る (0: 水面の高さ, 1: hu, 2: hv)
+	void makeFieldBoundaries() {
+		for (int e = 0; e < 4; e++) {
+			const BoundaryEdge edge = (BoundaryEdge)e;
+			const bool vertical = edge == EDGE_LEFT || edge == EDGE_RIGHT;
+			const BoundaryKind kind = boundary_.kind(edge);
+			for (int f = 0; f < 3; f++) {
+				if (kind == BOUNDARY_PERIODIC) {
+					fieldBoundary_[f].set(edge, BOUNDARY_PERIODIC);
+				}
+				else if (kind == BOUNDARY_NEUMANN || kind == BOUNDARY_ABSORBING) {
+					fieldBoundary_[f].set(edge, BOUNDARY_NEUMANN);
+				}
+				else {
+					// 壁: 壁に垂直な運動量だけ符号を反転する
+					const bool normal = (f == 1 && vertical) || (f == 2 && !vertical);
+					fieldBoundary_[f].set(edge, normal ? BOUNDARY_MIRROR_NEGATE : BOUNDARY_NEUMANN);
+				}
+			}
+		}
+	}
+
+	double depth_, gravity_, dx_;
+	double maxDt_, cfl_, minDepth_;
+	ShallowWaterFlux flux_;
+	double dt_, time_;
+	double maxSpeed_;
+	EdgeBoundary boundary_;
+	EdgeBoundary fieldBoundary_[3];
+	Grid2D<double> eta_[2];   // 現在と次 (curr_が現在)
+	Grid2D<double> hu_[2];
+	Grid2D<double> hv_[2];
+	int curr_;
+	bool profiling_;
+	ShallowWaterTiming timing_;
+	unsigned long long steps_;
+};
+
+#endif  // _SHALLOW_WATER_H_
@@ -0,0 +1,183 @@
+#ifndef _SIMULATION_HOST_H_
+#define _SIMULATION_HOST_H_
+
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// SimulationHostが持つ1つのシミュレーション
+class SimulationInstance {
+public:
+	SimulationInstance(const std::string &name, unsigned long long targetSteps)
+		: name_(name)
+		, targetSteps_(targetSteps)
+		, stepsDone_(0)
+		, seconds_(0.0)
+		, credit_(0.0) {
+	}
+
+	virtual ~SimulationInstance() {
+	}
+
+	virtual void step() = 0;
+
+	const std::string &name() const {
+		return name_;
+	}
+
+	unsigned long long stepsDone() const {
+		return stepsDone_;
+	}
+
+	unsigned long long targetSteps() const {
+		return targetSteps_;
+	}
+
+	bool finished() const {
+		return stepsDone_ >= targetSteps_;
+	}
+
+	// stepにかかった時間の合計 (秒)
+	double seconds() const {
+		return seconds_;
+	}
+
+private:
+	SimulationInstance(const SimulationInstance &);
+	SimulationInstance & operator=(const SimulationInstance &);
+
+	friend class SimulationHost;
+
+	std::string name_;
+	unsigned long long targetSteps_;
+	unsigned long long stepsDone_;
+	double seconds_;
+	double credit_;  // このラウンドで使える残り時間 (秒)
+};
+
+// WaveEquation, DiffEquationなど step() を持つソルバをそのまま入れるためのもの
+template <class Solver>
+class SolverInstance : public SimulationInstance {
+public:
+	SolverInstance(const std::string &name, unsigned long long targetSteps)
+		: SimulationInstance(name, targetSteps) {
+	}
+
+	virtual void step() {
+		solver.step();
+	}
+
+	Solver solver;
+};
+
+// 1つのプロセスで複数のシミュレーションを同時に進めるクラス
+//
+// 各インスタンスは共有のスレッドプールの上で、ラウンドごとに1つのタスクとして実行される
+// (同じインスタンスのstepが同時に走ることはない)。ラウンドごとに各インスタンスに
+// 同じ持ち時間を足し、持ち時間がなくなるまでステップを進める (deficit round robin)。
+// 1ステップが持ち時間より長いインスタンスは超過した分だけ次のラウンドの持ち時間が減るので、
+// 長い目で見ると、1ステップの重さに関係なくどのインスタンスにも同じだけCPU時間が配られる。
+class SimulationHost {
+public:
+	explicit SimulationHost(ThreadPool &pool = ThreadPool::shared())
+		: pool_(pool)
+		, sliceSeconds_(0.005)
+		, rounds_(0) {
+	}
+
+	virtual ~SimulationHost() {
+		for (size_t i = 0; i < instances_.size(); i++) {
+			delete instances_[i];
+		}
+	}
+
+	// ソルバを追加して、その参照を返す (パラメータの設定は呼び出し側で行う)
+	template <class Solver>
+	Solver &add(const std::string &name, unsigned long long targetSteps) {
+		SolverInstance<Solver> *instance = new SolverInstance<Solver>(name, targetSteps);
+		instances_.push_back(instance);
+		return instance->solver;
+	}
+
+	// 独自のSimulationInstanceを追加する (hostが削除する)
+	void add(SimulationInstance *instance) {
+		instances_.push_back(instance);
+	}
+
+	// 1ラウンドあたりの持ち時間 (秒)
+	void setTimeSlice(double seconds) {
+		sliceSeconds_ = seconds;
+	}
+
+	int size() const {
+		return (int)instances_.size();
+	}
+
+	SimulationInstance &instance(int i) {
+		return *instances_[i];
+	}
+
+	// 1ラウンド進める (まだ終わっていないものがあればtrue)
+	bool runRound() {
+		TaskGroup group;
+		bool active = false;
+		for (size_t i = 0; i < instances_.size(); i++) {
+			SimulationInstance *instance = instances_[i];
+			if (instance->finished()) {
+				continue;
+			}
+			active = true;
+			const double slice = sliceSeconds_;
+			pool_.submit(group, [instance, slice] { runSlice(*instance, slice); });
+		}
+		pool_.wait(group);
+		if (active) {
+			rounds_++;
+		}
+		return active;
+	}
+
+	// すべてのインスタンスが目標のステップ数に達するまで進める
+	void run() {
+		while (runRound()) {
+		}
+	}
+
+	void printReport(FILE *fp) const {
+		fprintf(fp, "%-16s %12s %10s %12s\n", "instance", "steps", "seconds", "steps/s");
+		for (size_t i = 0; i < instances_.size(); i++) {
+			const SimulationInstance &instance = *instances_[i];
+			fprintf(fp, "%-16s %12llu %10.3f %12.1f\n", instance.name().c_str(), instance.stepsDone(),
+				instance.seconds(), instance.seconds() > 0.0 ? instance.stepsDone() / instance.seconds() : 0.0);
+		}
+		fprintf(fp, "%d instances, %llu rounds on %d threads\n",
+			(int)instances_.size(), rounds_, pool_.numThreads());
+	}
+
+private:
+	SimulationHost(const SimulationHost &);
+	SimulationHost & operator=(const SimulationHost &);
+
+	static void runSlice(SimulationInstance &instance, double slice) {
+		typedef std::chrono::steady_clock Clock;
+		instance.credit_ += slice;
+		while (instance.credit_ > 0.0 && !instance.finished()) {
+			const Clock::time_point t0 = Clock::now();
+			instance.step();
+			const double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+			instance.stepsDone_++;
+			instance.seconds_ += elapsed;
+			instance.credit_ -= elapsed;
+		}
+	}
+
+	ThreadPool &pool_;
+	std::vector<SimulationInstance *> instances_;
+	double sliceSeconds_;
+	unsigned long long rounds_;
+};
+
+#endif  // _SIMULATION_HOST_H_
@@ -0,0 +1,271 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// スナップショット (チェックポイント) ファイルの形式
+//
+//   [SnapshotHeader (SNAPSHOT_ALIGNバイトに切り上げ)]
+//   [配列0 (SNAPSHOT_ALIGNバイト境界から開始)]
+//   [配列1 (SNAPSHOT_ALIGNバイト境界から開始)]
+//   ...
+//
+// 配列はメモリ上と同じ並び (先頭のleadセルの後に、pitchセル間隔で行が並ぶ) で書き出す。
+// バージョン1のファイルは pitch = xCells, lead = 0 として読む。
+//
+// 配列はページ境界に揃えてあるので、読み込み時はファイル全体をmmapして
+// そのままソルバのバッファとして使うことができる (コピーなし)
+
+static const uint32_t SNAPSHOT_MAGIC = 0x50414e53;  // "SNAP"
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const uint64_t SNAPSHOT_ALIGN = 4096;
+static const int SNAPSHOT_MAX_ARRAYS = 4;
+
+enum SnapshotKind {
+	SNAPSHOT_KIND_WAVE = 1,
+	SNAPSHOT_KIND_DIFFUSION = 2
+};
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t kind;
+	uint32_t numArrays;
+	int32_t xCells;
+	int32_t yCells;
+	uint64_t step;
+	double dx;
+	double dt;
+	double speed;
+	double loss;
+	double diff_num;
+	uint64_t arrayBytes;
+	uint64_t arrayOffset[SNAPSHOT_MAX_ARRAYS];
+	int32_t pitch;  // 行の間隔 (セル数。バージョン2から)
+	int32_t lead;   // 配列の先頭からセル (0, 0) までのセル数 (バージョン2から)
+};
+
+// バージョン1のファイルではヘッダのこの位置は0で埋められている
+inline int snapshotPitch(const SnapshotHeader &header) {
+	return header.version < 2 ? header.xCells : header.pitch;
+}
+
+inline uint64_t snapshotAlignUp(uint64_t n) {
+	return (n + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+// ヘッダの初期化 (配列のオフセットもここで決める。pitchが0なら詰めた配列)
+inline SnapshotHeader makeSnapshotHeader(SnapshotKind kind, int xCells, int yCells,
+	uint32_t numArrays, int pitch = 0, int lead = 0) {
+	SnapshotHeader header;
+	std::memset(&header, 0, sizeof(SnapshotHeader));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.kind = kind;
+	header.numArrays = numArrays;
+	header.xCells = xCells;
+	header.yCells = yCells;
+	header.pitch = pitch > 0 ? pitch : xCells;
+	header.lead = lead;
+	header.arrayBytes = sizeof(double) * ((uint64_t)header.lead + (uint64_t)header.pitch * (uint64_t)yCells);
+
+	uint64_t offset = snapshotAlignUp(sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < numArrays; i++) {
+		header.arrayOffset[i] = offset;
+		offset = snapshotAlignUp(offset + header.arrayBytes);
+	}
+	return header;
+}
+
+// スナップショットの書き出し
+// 一時ファイルに少しずつ書き込んでから名前を変えるので、
+// 書き込み途中でプロセスが落ちても前回のスナップショットは壊れない
+inline bool writeSnapshot(const char *filename, const SnapshotHeader &header,
+	const double *const *arrays) {
+	static const size_t CHUNK_BYTES = 4 << 20;
+
+	const std::string tmpname = std::string(filename) + ".tmp";
+	FILE *fp = fopen(tmpname.c_str(), "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open a snapshot file: %s\n", tmpname.c_str());
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(SnapshotHeader), 1, fp) == 1;
+	uint64_t pos = sizeof(SnapshotHeader);
+
+	static const char zeros[4096] = { 0 };
+	for (uint32_t i = 0; ok && i < header.numArrays; i++) {
+		// 配列の先頭までゼロで埋める
+		while (ok && pos < header.arrayOffset[i]) {
+			const size_t n = (size_t)std::min<uint64_t>(sizeof(zeros), header.arrayOffset[i] - pos);
+			ok = fwrite(zeros, 1, n, fp) == n;
+			pos += n;
+		}
+
+		// 配列の本体を一定サイズずつ書き出す
+		const char *bytes = (const char *)arrays[i];
+		for (uint64_t done = 0; ok && done < header.arrayBytes; ) {
+			const size_t n = (size_t)std::min<uint64_t>(CHUNK_BYTES, header.arrayBytes - done);
+			ok = fwrite(bytes + done, 1, n, fp) == n;
+			done += n;
+		}
+		pos += header.arrayBytes;
+	}
+
+	ok = (fflush(fp) == 0) && ok;
+#if !defined(_WIN32)
+	ok = ok && (fsync(fileno(fp)) == 0);
+#endif
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok) {
+		fprintf(stderr, "Failed to write a snapshot file: %s\n", tmpname.c_str());
+		std::remove(tmpname.c_str());
+		return false;
+	}
+
+	std::remove(filename);
+	if (std::rename(tmpname.c_str(), filename) != 0) {
+		fprintf(stderr, "Failed to rename a snapshot file: %s\n", filename);
+		return false;
+	}
+	return true;
+}
+
+// スナップショットをメモリにマップしたもの
+// mmapはMAP_PRIVATEなので、ソルバが書き込んでもファイルは変更されない
+class SnapshotMapping {
+public:
+	SnapshotMapping()
+		: data_(NULL)
+		, size_(0)
+		, mapped_(false) {
+	}
+
+	virtual ~SnapshotMapping() {
+		close();
+	}
+
+	bool open(const char *filename) {
+		close();
+
+#if !defined(_WIN32)
+		const int fd = ::open(filename, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to open a snapshot file: %s\n", filename);
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+			fprintf(stderr, "Invalid snapshot file: %s\n", filename);
+			::close(fd);
+			return false;
+		}
+
+		size_ = (size_t)st.st_size;
+		void *ptr = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (ptr == MAP_FAILED) {
+			fprintf(stderr, "Failed to map a snapshot file: %s\n", filename);
+			size_ = 0;
+			return false;
+		}
+		data_ = (char *)ptr;
+		mapped_ = true;
+#else
+		// mmapが使えない環境ではファイル全体を読み込む
+		FILE *fp = fopen(filename, "rb");
+		if (fp == NULL) {
+			fprintf(stderr, "Failed to open a snapshot file: %s\n", filename);
+			return false;
+		}
+		fseek(fp, 0, SEEK_END);
+		size_ = (size_t)ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		data_ = new char[size_];
+		const bool ok = fread(data_, 1, size_, fp) == size_;
+		fclose(fp);
+		if (!ok) {
+			fprintf(stderr, "Failed to read a snapshot file: %s\n", filename);
+			close();
+			return false;
+		}
+#endif
+
+		if (!validate()) {
+			fprintf(stderr, "Invalid snapshot file: %s\n", filename);
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+		if (data_ != NULL) {
+#if !defined(_WIN32)
+			if (mapped_) {
+				munmap(data_, size_);
+			}
+#else
+			delete[] data_;
+#endif
+		}
+		data_ = NULL;
+		size_ = 0;
+		mapped_ = false;
+	}
+
+	const SnapshotHeader & header() const {
+		return *(const SnapshotHeader *)data_;
+	}
+
+	double * array(int i) const {
+		return (double *)(data_ + header().arrayOffset[i]);
+	}
+
+private:
+	SnapshotMapping(const SnapshotMapping &);
+	SnapshotMapping & operator=(const SnapshotMapping &);
+
+	bool validate() const {
+		const SnapshotHeader &h = header();
+		if (h.magic != SNAPSHOT_MAGIC || h.version < 1 || h.version > SNAPSHOT_VERSION) {
+			return false;
+		}
+
+		const int64_t pitch = snapshotPitch(h);
+		const int64_t lead = h.version < 2 ? 0 : h.lead;
+		if (h.numArrays > (uint32_t)SNAPSHOT_MAX_ARRAYS || h.xCells <= 0 || h.yCells <= 0 ||
+			pitch < h.xCells || lead < 0 ||
+			h.arrayBytes != sizeof(double) * (uint64_t)(lead + pitch * h.yCells)) {
+			return false;
+		}
+
+		for (uint32_t i = 0; i < h.numArrays; i++) {
+			if (h.arrayOffset[i] % SNAPSHOT_ALIGN != 0 ||
+				h.arrayOffset[i] + h.arrayBytes > (uint64_t)size_) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	char *data_;
+	size_t size_;
+	bool mapped_;
+};
+
+#endif  // _SNAPSHOT_H_
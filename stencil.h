@@ -0,0 +1,552 @@
+#ifndef _STENCIL_H_
+#define _STENCIL_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "grid.h"
+#include "parallel.h"
+#include "snapshot.h"
+
+// 格子上の陽解法で共通の部分 (時間方向の3つの配列の管理・内部の走査・境界処理)
+//
+//   Weights   空間の差分の形 (static apply(u, stride) と半径 RADIUS を持つ)
+//   Boundary  境界の扱い (applyRow() と applyTopBottom() を持つ。EdgeBoundaryなど)
+//   Scalar    値の型
+//
+// 係数はWeights::applyの中に定数として書かれているので、インスタンス化ごとに
+// ループが展開・ベクトル化される。方程式ごとの違いは sweep() に渡す更新式だけになる。
+//
+// 配列は current (現在), previous (1つ前), next (計算先) の3つで、
+// rotate() はポインタを入れ替えるだけでコピーはしない。
+// 配列はGrid2D (grid.h) で、一番外側のセルがゴーストセルになる。行の間隔は pitch() で、
+// セル (x, y) は current()[y * pitch() + x] にある (xCellsとは限らない)。
+
+// 5点のラプラシアン (隣との差の和。dx^2で割る前の値)
+// 空間2次精度。以下のWeightsはどれも dx^2 * ∇^2u の近似を返す。
+struct FivePointLaplacian {
+	static const int RADIUS = 1;
+	typedef FivePointLaplacian Edge;  // 境界から RADIUS 以内のセルに使うもの
+
+	template <class Scalar>
+	static Scalar apply(const Scalar *u, int stride) {
+		// 従来のstep()と同じ順番で足す (結果が変わらないように)
+		Scalar sum = 0;
+		sum += u[-1] - u[0];
+		sum += u[1] - u[0];
+		sum += u[-stride] - u[0];
+		sum += u[stride] - u[0];
+		return sum;
+	}
+};
+
+// 9点の等方的なラプラシアン
+// 精度は2次のままだが誤差の主要項が方向によらないので、斜め方向の数値分散が小さい
+struct NinePointLaplacian {
+	static const int RADIUS = 1;
+	typedef NinePointLaplacian Edge;
+
+	template <class Scalar>
+	static Scalar apply(const Scalar *u, int stride) {
+		const Scalar *n = u - stride;
+		const Scalar *s = u + stride;
+		return (Scalar(4) * (u[-1] + u[1] + n[0] + s[0])
+			+ (n[-1] + n[1] + s[-1] + s[1]) - Scalar(20) * u[0]) / Scalar(6);
+	}
+};
+
+// 4次精度のラプラシアン (各軸に5点の中心差分)
+// 半径が2なので、境界のすぐ内側の1列は5点のラプラシアンで計算する
+struct FourthOrderLaplacian {
+	static const int RADIUS = 2;
+	typedef FivePointLaplacian Edge;
+
+	template <class Scalar>
+	static Scalar apply(const Scalar *u, int stride) {
+		return (Scalar(16) * (u[-1] + u[1] + u[-stride] + u[stride])
+			- (u[-2] + u[2] + u[-2 * stride] + u[2 * stride]) - Scalar(60) * u[0]) / Scalar(12);
+	}
+};
+
+// 境界の扱い (辺ごとに選ぶ)
+//
+// 格子の一番外側のセルを境界 (ゴーストセル) として、内部を計算した後に値を決める。
+//   BOUNDARY_MIRROR_NEGATE  内側の隣のセルの符号を反転する (これまでの動作。既定)
+//   BOUNDARY_NEUMANN        内側の隣のセルと同じ値にする (法線方向の勾配が0)
+//   BOUNDARY_DIRICHLET      指定した値にする
+//   BOUNDARY_PERIODIC       反対側の辺の内側のセルの値にする (向かい合う辺は両方とも周期にする)
+//   BOUNDARY_ABSORBING      1次のMurの吸収境界 (波動方程式用。setCourant() でc dt/dxを指定する)
+//   BOUNDARY_HALO           何もしない (隣の領域の値を外から書き込む。domain_decomp.h の分割の内側の辺)
+enum BoundaryKind {
+	BOUNDARY_MIRROR_NEGATE = 0,
+	BOUNDARY_NEUMANN,
+	BOUNDARY_DIRICHLET,
+	BOUNDARY_PERIODIC,
+	BOUNDARY_ABSORBING,
+	BOUNDARY_HALO
+};
+
+enum BoundaryEdge {
+	EDGE_LEFT = 0,    // x = 0
+	EDGE_RIGHT,       // x = xCells - 1
+	EDGE_TOP,         // y = 0
+	EDGE_BOTTOM       // y = yCells - 1
+};
+
+class EdgeBoundary {
+public:
+	EdgeBoundary()
+		: courant_(0.0) {
+		setAll(BOUNDARY_MIRROR_NEGATE);
+	}
+
+	void set(BoundaryEdge edge, BoundaryKind kind, double value = 0.0) {
+		kind_[edge] = kind;
+		value_[edge] = value;
+	}
+
+	void setAll(BoundaryKind kind, double value = 0.0) {
+		for (int e = 0; e < 4; e++) {
+			set((BoundaryEdge)e, kind, value);
+		}
+	}
+
+	BoundaryKind kind(BoundaryEdge edge) const {
+		return kind_[edge];
+	}
+
+	double value(BoundaryEdge edge) const {
+		return value_[edge];
+	}
+
+	// 吸収境界に使う c dt / dx
+	void setCourant(double courant) {
+		courant_ = courant;
+	}
+
+	// 周期境界が向かい合う辺の片方だけになっていないか
+	bool valid() const {
+		return (kind_[EDGE_LEFT] == BOUNDARY_PERIODIC) == (kind_[EDGE_RIGHT] == BOUNDARY_PERIODIC)
+			&& (kind_[EDGE_TOP] == BOUNDARY_PERIODIC) == (kind_[EDGE_BOTTOM] == BOUNDARY_PERIODIC);
+	}
+
+	// 行yの左右の境界 (行の内部を計算した直後、キャッシュに残っているうちに呼ぶ)
+	template <class Scalar>
+	void applyRow(Scalar *next, const Scalar *curr, int pitch, int xCells, int y) const {
+		Scalar *row = next + (size_t)y * pitch;
+		const Scalar *old = curr + (size_t)y * pitch;
+		row[0] = edgeValue(EDGE_LEFT, row[1], row[xCells - 2], old[0], old[1]);
+		row[xCells - 1] = edgeValue(EDGE_RIGHT, row[xCells - 2], row[1], old[xCells - 1], old[xCells - 2]);
+	}
+
+	// 上下の行全体 (すべての行の左右が決まった後に呼ぶ。角の値もここで決まる)
+	template <class Scalar>
+	void applyTopBottom(Scalar *next, const Scalar *curr, int pitch, int xCells, int yCells) const {
+		const size_t last = (size_t)(yCells - 1) * pitch;
+		applyLine(EDGE_TOP, next, next + pitch, next + last - pitch,
+			curr, curr + pitch, xCells);
+		applyLine(EDGE_BOTTOM, next + last, next + last - pitch, next + pitch,
+			curr + last, curr + last - pitch, xCells);
+	}
+
+	// 初期状態の境界を方針に合わせる (start() で呼ぶ)
+	// 前のステップの値を使わない方針 (ノイマン・ディリクレ・周期) だけを適用し、
+	// 符号の反転と吸収境界は初期状態で与えられた値をそのまま使う
+	template <class Scalar>
+	void initialize(Scalar *u, int pitch, int xCells, int yCells) const {
+		const size_t last = (size_t)(yCells - 1) * pitch;
+		for (int y = 1; y < yCells - 1; y++) {
+			Scalar *row = u + (size_t)y * pitch;
+			if (isStatic(EDGE_LEFT)) {
+				row[0] = edgeValue(EDGE_LEFT, row[1], row[xCells - 2], row[0], row[1]);
+			}
+			if (isStatic(EDGE_RIGHT)) {
+				row[xCells - 1] = edgeValue(EDGE_RIGHT, row[xCells - 2], row[1], row[xCells - 1], row[xCells - 2]);
+			}
+		}
+		if (isStatic(EDGE_TOP)) {
+			applyLine(EDGE_TOP, u, u + pitch, u + last - pitch, u, u + pitch, xCells);
+		}
+		if (isStatic(EDGE_BOTTOM)) {
+			applyLine(EDGE_BOTTOM, u + last, u + last - pitch, u + pitch,
+				u + last, u + last - pitch, xCells);
+		}
+	}
+
+private:
+	bool isStatic(BoundaryEdge edge) const {
+		return kind_[edge] == BOUNDARY_NEUMANN || kind_[edge] == BOUNDARY_DIRICHLET || kind_[edge] == BOUNDARY_PERIODIC;
+	}
+
+	// inside: 内側の隣, opposite: 反対側の辺の内側, old*: 1ステップ前の値
+	template <class Scalar>
+	Scalar edgeValue(BoundaryEdge edge, Scalar inside, Scalar opposite, Scalar oldEdge, Scalar oldInside) const {
+		switch (kind_[edge]) {
+		case BOUNDARY_NEUMANN:
+			return inside;
+		case BOUNDARY_DIRICHLET:
+			return (Scalar)value_[edge];
+		case BOUNDARY_PERIODIC:
+			return opposite;
+		case BOUNDARY_ABSORBING:
+			return oldInside + (Scalar)mur() * (inside - oldEdge);
+		case BOUNDARY_HALO:
+			return oldEdge;
+		default:
+			return -inside;
+		}
+	}
+
+	// 行全体を1つの方針で埋める (方針ごとのループにしてベクトル化されるようにする)
+	template <class Scalar>
+	void applyLine(BoundaryEdge edge, Scalar *dst, const Scalar *inside, const Scalar *opposite,
+		const Scalar *oldEdge, const Scalar *oldInside, int n) const {
+		switch (kind_[edge]) {
+		case BOUNDARY_NEUMANN:
+			std::copy(inside, inside + n, dst);
+			break;
+		case BOUNDARY_DIRICHLET:
+			std::fill(dst, dst + n, (Scalar)value_[edge]);
+			break;
+		case BOUNDARY_PERIODIC:
+			std::copy(opposite, opposite + n, dst);
+			break;
+		case BOUNDARY_ABSORBING: {
+			const Scalar r = (Scalar)mur();
+			for (int x = 0; x < n; x++) {
+				dst[x] = oldInside[x] + r * (inside[x] - oldEdge[x]);
+			}
+			break;
+		}
+		case BOUNDARY_HALO:
+			break;
+		default:
+			for (int x = 0; x < n; x++) {
+				dst[x] = -inside[x];
+			}
+			break;
+		}
+	}
+
+	// Murの境界条件の係数 (c dt - dx) / (c dt + dx)
+	double mur() const {
+		return (courant_ - 1.0) / (courant_ + 1.0);
+	}
+
+	BoundaryKind kind_[4];
+	double value_[4];
+	double courant_;
+};
+
+// "neumann" のように1つだけ指定すると全辺、"left,right,top,bottom" の順に4つ指定すると辺ごと
+// (ディリクレ境界は "dirichlet:0.5" のように値を付ける)
+inline bool parseEdgeBoundary(const std::string &text, EdgeBoundary &boundary) {
+	static const char *const names[] = { "mirror", "neumann", "dirichlet", "periodic", "absorbing" };
+
+	std::vector<std::string> items;
+	size_t begin = 0;
+	for (;;) {
+		const size_t comma = text.find(',', begin);
+		items.push_back(text.substr(begin, comma == std::string::npos ? std::string::npos : comma - begin));
+		if (comma == std::string::npos) {
+			break;
+		}
+		begin = comma + 1;
+	}
+	if (items.size() != 1 && items.size() != 4) {
+		return false;
+	}
+
+	for (int e = 0; e < 4; e++) {
+		const std::string &item = items[items.size() == 1 ? 0 : e];
+		const size_t colon = item.find(':');
+		const std::string name = item.substr(0, colon);
+		const double value = colon == std::string::npos ? 0.0 : atof(item.c_str() + colon + 1);
+
+		int kind = -1;
+		for (int k = 0; k < 5; k++) {
+			if (name == names[k]) {
+				kind = k;
+			}
+		}
+		if (kind < 0) {
+			return false;
+		}
+		boundary.set((BoundaryEdge)e, (BoundaryKind)kind, value);
+	}
+	return boundary.valid();
+}
+
+template <class Weights, class Boundary, class Scalar = double>
+class Stencil {
+public:
+	Stencil()
+		: curr_(&levels_[0])
+		, next_(&levels_[1])
+		, prev_(&levels_[2])
+		, mapping_(NULL) {
+	}
+
+	Stencil(const Stencil &stencil)
+		: curr_(&levels_[0])
+		, next_(&levels_[1])
+		, prev_(&levels_[2])
+		, mapping_(NULL) {
+		this->operator=(stencil);
+	}
+
+	virtual ~Stencil() {
+		release();
+	}
+
+	// 中身をコピーする (マップされた配列もコピーして自分の配列にする)
+	Stencil & operator=(const Stencil &stencil) {
+		if (this == &stencil) {
+			return *this;
+		}
+
+		boundary_ = stencil.boundary_;
+		resize(stencil.xCells(), stencil.yCells());
+		if (stencil.curr_->data() != NULL) {
+			curr_->copyFrom(*stencil.curr_);
+			next_->copyFrom(*stencil.next_);
+			prev_->copyFrom(*stencil.prev_);
+		}
+		return *this;
+	}
+
+	// 配列を確保して0で初期化する
+	void resize(int xCells, int yCells) {
+		release();
+		for (int i = 0; i < 3; i++) {
+			levels_[i].allocate(xCells, yCells);
+		}
+	}
+
+	// スナップショットの配列0をcurrent、配列1をpreviousとしてそのまま使う
+	// (mappingはこのクラスが削除する。行の並びもファイルに書かれたものをそのまま使う)
+	void adopt(SnapshotMapping *mapping) {
+		release();
+		const SnapshotHeader &header = mapping->header();
+		const int pitch = snapshotPitch(header);
+		const int lead = (int)header.lead;
+
+		mapping_ = mapping;
+		curr_->attach((Scalar *)mapping_->array(0), header.xCells, header.yCells, 1, pitch, lead);
+		prev_->attach((Scalar *)mapping_->array(1), header.xCells, header.yCells, 1, pitch, lead);
+		next_->allocateLike(*curr_);
+	}
+
+	void release() {
+		for (int i = 0; i < 3; i++) {
+			levels_[i].release();
+		}
+		curr_ = &levels_[0];
+		next_ = &levels_[1];
+		prev_ = &levels_[2];
+		delete mapping_;
+		mapping_ = NULL;
+	}
+
+	// 内部のセルについて next = update(x, y, i, Weights::apply(current)) を計算し、
+	// nextに境界処理を行う (iは y * pitch() + x)。境界から Weights::RADIUS 以内のセルには Weights::Edge を使う。
+	// 行はrowBlock行ずつまとめて並列に処理する (同じまとまりの行は同じスレッドが処理する)。
+	template <class Update>
+	void sweep(Update update, int rowBlock = 1) {
+		typedef typename Weights::Edge Edge;
+		const int R = Weights::RADIUS;
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		const Scalar *curr = current();
+		Scalar *next = this->next();
+		const Boundary &boundary = boundary_;
+
+		const int numBlocks = (H + rowBlock - 1) / rowBlock;
+		parallelFor(0, numBlocks, [&](int b0, int b1) {
+			const int y0 = std::max(1, b0 * rowBlock);
+			const int y1 = std::min(H - 1, b1 * rowBlock);
+			for (int y = y0; y < y1; y++) {
+				int x = 1;
+				if (y >= R && y < H - R) {
+					for (; x < R; x++) {
+						next[y * P + x] = update(x, y, y * P + x, Edge::apply(curr + y * P + x, P));
+					}
+					for (; x < W - R; x++) {
+						const int i = y * P + x;
+						next[i] = update(x, y, i, Weights::apply(curr + i, P));
+					}
+				}
+				for (; x < W - 1; x++) {
+					next[y * P + x] = update(x, y, y * P + x, Edge::apply(curr + y * P + x, P));
+				}
+				boundary.applyRow(next, curr, P, W, y);
+			}
+		});
+
+		boundary_.applyTopBottom(next, curr, P, W, H);
+	}
+
+	// 内部のセルのうち [x0, x1) × [y0, y1) だけを計算する (境界処理はしない)
+	// 領域を分けて計算する場合に使う。すべての内部のセルを計算したら applyBoundary() を呼ぶ
+	template <class Update>
+	void sweepRect(Update update, int x0, int y0, int x1, int y1) {
+		parallelFor(std::max(y0, 1), std::min(y1, yCells() - 1), [&](int r0, int r1) {
+			sweepRows(update, x0, r0, x1, r1);
+		});
+	}
+
+	// sweep() と同じ計算を、境界から Weights::RADIUS 以内の帯 → 境界処理 → 内側 の順に行う
+	// 帯と境界が埋まったところで publish(next) を呼び、内側の計算と並行させる
+	// (publishはnextの帯と境界だけを読める。袖領域の送信や描画スレッドへの受け渡しに使う)。
+	// 帯の4辺はタスクに分けて計算し、そのタスクがすべて終わってから境界処理とpublishを行う。
+	// 内側は parallelFor と同じ分け方で、呼び出し元の区間はpublishの後に計算する
+	template <class Update, class Publish>
+	void sweepPipelined(Update update, Publish publish) {
+		const int B = std::max(1, (int)Weights::RADIUS);
+		const int W = xCells();
+		const int H = yCells();
+		if (W - 2 <= 2 * B || H - 2 <= 2 * B) {
+			sweep(update);
+			publish((const Grid2D<Scalar> &)*next_);
+			return;
+		}
+
+		ThreadPool &pool = ThreadPool::shared();
+		TaskGroup band;
+		pool.submit(band, [&] { sweepRows(update, 1, 1, W - 1, 1 + B); });
+		pool.submit(band, [&] { sweepRows(update, 1, H - 1 - B, W - 1, H - 1); });
+		pool.submit(band, [&] { sweepRows(update, 1, 1 + B, 1 + B, H - 1 - B); });
+		pool.submit(band, [&] { sweepRows(update, W - 1 - B, 1 + B, W - 1, H - 1 - B); });
+		pool.wait(band);
+		applyBoundary();
+
+		const int y0 = 1 + B;
+		const int count = H - 2 - 2 * B;
+		const int n = std::min(pool.numThreads(), count);
+		TaskGroup interior;
+		for (int i = 1; i < n; i++) {
+			const int lo = y0 + (int)((long long)count * i / n);
+			const int hi = y0 + (int)((long long)count * (i + 1) / n);
+			pool.submitTo(i - 1, interior, [&, lo, hi] { sweepRows(update, 1 + B, lo, W - 1 - B, hi); });
+		}
+
+		publish((const Grid2D<Scalar> &)*next_);
+		sweepRows(update, 1 + B, y0, W - 1 - B, y0 + count / n);
+		pool.wait(interior);
+	}
+
+	// nextの境界を埋める (sweepRect() で内部をすべて計算した後に呼ぶ)
+	void applyBoundary() {
+		const int P = pitch();
+		for (int y = 1; y < yCells() - 1; y++) {
+			boundary_.applyRow(next(), current(), P, xCells(), y);
+		}
+		boundary_.applyTopBottom(next(), current(), P, xCells(), yCells());
+	}
+
+	// previous ← current ← next
+	void rotate() {
+		Grid2D<Scalar> *prev = prev_;
+		prev_ = curr_;
+		curr_ = next_;
+		next_ = prev;
+	}
+
+	// currentの境界をBoundaryの方針に合わせる
+	void initializeBoundary() {
+		boundary_.initialize(current(), pitch(), xCells(), yCells());
+	}
+
+	// previousをcurrentと同じ値にする
+	void syncPrevious() {
+		prev_->copyFrom(*curr_);
+	}
+
+	// 各配列のセル (0, 0) の位置
+	Scalar *current() const {
+		return curr_->origin();
+	}
+
+	Scalar *previous() const {
+		return prev_->origin();
+	}
+
+	Scalar *next() const {
+		return next_->origin();
+	}
+
+	const Grid2D<Scalar> &currentGrid() const {
+		return *curr_;
+	}
+
+	const Grid2D<Scalar> &previousGrid() const {
+		return *prev_;
+	}
+
+	Boundary &boundary() {
+		return boundary_;
+	}
+
+	const Boundary &boundary() const {
+		return boundary_;
+	}
+
+	int xCells() const {
+		return curr_->xCells();
+	}
+
+	int yCells() const {
+		return curr_->yCells();
+	}
+
+	// 行の間隔 (3つの配列で共通)
+	int pitch() const {
+		return curr_->pitch();
+	}
+
+private:
+	// [x0, x1) × [y0, y1) を呼び出し元のスレッドで計算する
+	template <class Update>
+	void sweepRows(Update update, int x0, int y0, int x1, int y1) {
+		typedef typename Weights::Edge Edge;
+		const int R = Weights::RADIUS;
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		const Scalar *curr = current();
+		Scalar *next = this->next();
+		x0 = std::max(x0, 1);
+		x1 = std::min(x1, W - 1);
+
+		for (int y = y0; y < y1; y++) {
+			int x = x0;
+			if (y >= R && y < H - R) {
+				for (; x < std::min(x1, R); x++) {
+					next[y * P + x] = update(x, y, y * P + x, Edge::apply(curr + y * P + x, P));
+				}
+				const int xEnd = std::min(x1, W - R);
+				for (; x < xEnd; x++) {
+					const int i = y * P + x;
+					next[i] = update(x, y, i, Weights::apply(curr + i, P));
+				}
+			}
+			for (; x < x1; x++) {
+				next[y * P + x] = update(x, y, y * P + x, Edge::apply(curr + y * P + x, P));
+			}
+		}
+	}
+
+	Grid2D<Scalar> levels_[3];
+	Grid2D<Scalar> *curr_;
+	Grid2D<Scalar> *next_;
+	Grid2D<Scalar> *prev_;
+	SnapshotMapping *mapping_;   // スナップショットから再開したときのマップ領域
+	Boundary boundary_;
+};
+
+#endif  // _STENCIL_H_
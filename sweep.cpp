@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+
+#include "sweep.h"
+#include "thread_pool.h"
+
+// パラメータスイープの実行
+//
+//   sweep SPEC RESULTS [--threads N] [--memory MB]
+//
+// SPECの設定からジョブの一覧を作って並列に計算し、結果をRESULTSに列ごとにまとめて書き出す。
+// 終わったジョブは RESULTS.journal に記録していくので、中断しても同じコマンドで続きから再開できる。
+// 同時に計算するジョブの数は、スレッド数と --memory で指定したメモリの上限の小さい方で決まる。
+
+static std::atomic<bool> interrupted(false);
+
+void handleInterrupt(int) {
+	interrupted = true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s SPEC RESULTS [--threads N] [--memory MB]\n", argv[0]);
+		return 1;
+	}
+
+	const std::string specFile = argv[1];
+	const std::string resultsFile = argv[2];
+	int numThreads = 0;
+	double memoryLimit = 1024.0;  // MB
+	for (int i = 3; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) {
+			numThreads = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--memory" && i + 1 < argc) {
+			memoryLimit = std::max(1.0, atof(argv[++i]));
+		}
+		else {
+			fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	SweepSpec spec;
+	if (!loadSweepSpec(specFile.c_str(), spec)) {
+		return 1;
+	}
+	if (!spec.snapshotDirectory.empty() && !makeSweepDirectory(spec.snapshotDirectory)) {
+		return 1;
+	}
+
+	const std::vector<SweepJob> jobs = makeSweepJobs(spec);
+	const std::vector<std::string> columns = sweepColumns(spec);
+
+	// 終わっているジョブを読み込んで、残りだけを実行する
+	SweepJournal journal;
+	std::vector<SweepResult> results;
+	if (!journal.open(resultsFile + ".journal", spec.hash, (uint32_t)columns.size(), results)) {
+		return 1;
+	}
+	std::set<int> finished;
+	for (size_t i = 0; i < results.size(); i++) {
+		finished.insert(results[i].job);
+	}
+	std::vector<const SweepJob *> pending;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (finished.count(jobs[i].id) == 0) {
+			pending.push_back(&jobs[i]);
+		}
+	}
+
+	// ジョブも各ジョブの中の parallelFor も同じ共有のプールで動かす (スレッドの数が numThreads を超えない)
+	ThreadPool::sharedSize() = numThreads;
+	ThreadPool &pool = ThreadPool::shared();
+	const size_t jobBytes = sweepJobBytes(spec);
+	const int maxByMemory = (int)std::max<double>(1.0, memoryLimit * 1024.0 * 1024.0 / jobBytes);
+	const int concurrency = std::max(1, std::min(std::min(pool.numThreads(), maxByMemory), (int)pending.size()));
+	fprintf(stderr, "%d jobs (%d already finished), %d at a time (%.1f MB each)\n",
+		(int)jobs.size(), (int)finished.size(), concurrency, jobBytes / (1024.0 * 1024.0));
+
+	signal(SIGINT, handleInterrupt);
+
+	// 各タスクは残っているジョブを1つずつ取り出して実行する
+	std::atomic<int> next(0);
+	std::atomic<bool> failed(false);
+	std::mutex mutex;
+	int completed = 0;
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	TaskGroup group;
+	for (int t = 0; t < concurrency; t++) {
+		pool.submit(group, [&] {
+			for (;;) {
+				const int index = next++;
+				if (index >= (int)pending.size() || interrupted || failed) {
+					return;
+				}
+
+				const SweepJob &job = *pending[index];
+				SweepResult result;
+				SweepRunner runner(spec, job);
+				if (!runner.run(result)) {
+					failed = true;
+					return;
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!journal.append(result)) {
+					fprintf(stderr, "Failed to record job %d\n", job.id);
+					failed = true;
+					return;
+				}
+				results.push_back(result);
+				completed++;
+				const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+				fprintf(stderr, "[%d/%d] job %d done (%.1f s elapsed)\n",
+					completed, (int)pending.size(), job.id, elapsed);
+			}
+		});
+	}
+	pool.wait(group);
+	journal.close();
+
+	if (failed) {
+		return 1;
+	}
+	if (interrupted) {
+		fprintf(stderr, "Interrupted with %d jobs remaining; run the same command to resume\n",
+			(int)pending.size() - completed);
+		return 1;
+	}
+
+	if (!writeSweepResults(resultsFile, columns, results)) {
+		return 1;
+	}
+	fprintf(stderr, "Wrote %s (%d jobs, %d columns)\n", resultsFile.c_str(), (int)results.size(), (int)columns.size());
+	return 0;
+}
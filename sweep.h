@@ -0,0 +1,678 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "water_eq.h"
+#include "拡散視覚化/diffusion_eq.h"
+
+// パラメータスイープの設定・ジョブ・結果ファイル
+//
+// 設定ファイルは1行に1項目の書式 (#以降はコメント)
+//
+//   model wave                 # wave または diffusion
+//   mode cartesian             # cartesian (直積) または lhs (ラテン超方格)
+//   samples 32                 # lhsのときのジョブ数
+//   seed 1                     # lhsの乱数の種
+//   grid 200 200               # 格子の大きさ
+//   steps 2000                 # 1ジョブのステップ数
+//   record 20                  # エネルギーと観測点を記録する間隔
+//   speed 0.25 1.0 4           # 最小値 最大値 個数 (個数を省くとlhs用の範囲, 値1つなら固定)
+//   loss 0.001
+//   probe 0.25 0.5             # 観測点 (格子に対する割合)
+//   snapshots sweep_snaps/     # 指定すると各ジョブの最終状態を保存する
+//
+// スイープできるパラメータは SWEEP_PARAM_NAMES の通り。
+// 初期状態は amplitude * exp(-width * r^2) のガウス型の山 (中心は center_x, center_y の割合の位置)。
+
+enum SweepParam {
+	SWEEP_SPEED = 0,
+	SWEEP_DX,
+	SWEEP_DT,
+	SWEEP_LOSS,
+	SWEEP_DIFF_NUM,
+	SWEEP_AMPLITUDE,
+	SWEEP_WIDTH,
+	SWEEP_CENTER_X,
+	SWEEP_CENTER_Y,
+	SWEEP_NUM_PARAMS
+};
+
+static const char *const SWEEP_PARAM_NAMES[SWEEP_NUM_PARAMS] = {
+	"speed", "dx", "dt", "loss", "diff_num", "amplitude", "width", "center_x", "center_y"
+};
+
+// 1つのパラメータの範囲 (countが1なら固定値、0ならlhs用の連続な範囲)
+struct SweepRange {
+	double min;
+	double max;
+	int count;
+
+	bool swept() const {
+		return count != 1;
+	}
+
+	// 直積のi番目の値
+	double value(int i) const {
+		return count > 1 ? min + (max - min) * i / (count - 1) : min;
+	}
+};
+
+struct SweepSpec {
+	std::string model;
+	bool latinHypercube;
+	int samples;
+	unsigned int seed;
+	int xCells, yCells;
+	int steps;
+	int recordInterval;
+	SweepRange ranges[SWEEP_NUM_PARAMS];
+	std::vector<double> probes;        // x0, y0, x1, y1, ... (格子に対する割合)
+	std::string snapshotDirectory;
+	uint64_t hash;                     // 設定ファイルの内容のハッシュ (再開時の確認用)
+
+	SweepSpec()
+		: model("wave")
+		, latinHypercube(false)
+		, samples(16)
+		, seed(1)
+		, xCells(200)
+		, yCells(200)
+		, steps(1000)
+		, recordInterval(10)
+		, hash(0) {
+		static const double defaults[SWEEP_NUM_PARAMS] = {
+			0.5, 0.01, 0.0005, 0.001, 0.25, 2.0, 5.0, 0.5, 0.5
+		};
+		for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+			ranges[i].min = ranges[i].max = defaults[i];
+			ranges[i].count = 1;
+		}
+	}
+
+	bool isWave() const {
+		return model == "wave";
+	}
+
+	int numProbes() const {
+		return (int)probes.size() / 2;
+	}
+};
+
+inline uint64_t sweepHash(const void *data, size_t n, uint64_t hash = 14695981039346656037ULL) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < n; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+inline bool loadSweepSpec(const char *filename, SweepSpec &spec) {
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open a sweep spec: %s\n", filename);
+		return false;
+	}
+
+	spec = SweepSpec();
+	spec.hash = sweepHash(NULL, 0);
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp) != NULL) {
+		lineNumber++;
+		spec.hash = sweepHash(line, strlen(line), spec.hash);
+		char *comment = strchr(line, '#');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+
+		char key[64], text[256];
+		double v[3];
+		int n = 0;
+		if (sscanf(line, "%63s", key) != 1) {
+			continue;
+		}
+
+		const std::string name = key;
+		if (name == "model" && sscanf(line, "%*s %255s", text) == 1) {
+			spec.model = text;
+			ok = spec.model == "wave" || spec.model == "diffusion";
+		}
+		else if (name == "mode" && sscanf(line, "%*s %255s", text) == 1) {
+			spec.latinHypercube = std::string(text) == "lhs";
+			ok = spec.latinHypercube || std::string(text) == "cartesian";
+		}
+		else if (name == "samples" && sscanf(line, "%*s %d", &spec.samples) == 1) {
+			ok = spec.samples > 0;
+		}
+		else if (name == "seed" && sscanf(line, "%*s %u", &spec.seed) == 1) {
+			ok = true;
+		}
+		else if (name == "grid" && sscanf(line, "%*s %d %d", &spec.xCells, &spec.yCells) == 2) {
+			ok = spec.xCells >= 3 && spec.yCells >= 3;
+		}
+		else if (name == "steps" && sscanf(line, "%*s %d", &spec.steps) == 1) {
+			ok = spec.steps > 0;
+		}
+		else if (name == "record" && sscanf(line, "%*s %d", &spec.recordInterval) == 1) {
+			ok = spec.recordInterval > 0;
+		}
+		else if (name == "probe" && sscanf(line, "%*s %lf %lf", &v[0], &v[1]) == 2) {
+			spec.probes.push_back(std::min(std::max(v[0], 0.0), 1.0));
+			spec.probes.push_back(std::min(std::max(v[1], 0.0), 1.0));
+		}
+		else if (name == "snapshots" && sscanf(line, "%*s %255s", text) == 1) {
+			spec.snapshotDirectory = text;
+		}
+		else {
+			int param = -1;
+			for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+				if (name == SWEEP_PARAM_NAMES[i]) {
+					param = i;
+				}
+			}
+			n = sscanf(line, "%*s %lf %lf %lf", &v[0], &v[1], &v[2]);
+			ok = param >= 0 && n >= 1;
+			if (ok) {
+				SweepRange &range = spec.ranges[param];
+				range.min = v[0];
+				range.max = n >= 2 ? v[1] : v[0];
+				range.count = n >= 3 ? std::max(1, (int)v[2]) : (n == 2 ? 0 : 1);
+			}
+		}
+
+		if (!ok) {
+			fprintf(stderr, "%s:%d: invalid line\n", filename, lineNumber);
+		}
+	}
+	fclose(fp);
+
+	// 直積で範囲だけ指定されたパラメータは両端の2点にする
+	for (int i = 0; ok && i < SWEEP_NUM_PARAMS; i++) {
+		if (!spec.latinHypercube && spec.ranges[i].count == 0) {
+			spec.ranges[i].count = 2;
+		}
+	}
+	return ok;
+}
+
+// 1つのジョブ (パラメータの組)
+struct SweepJob {
+	int id;
+	double params[SWEEP_NUM_PARAMS];
+};
+
+// 設定からジョブの一覧を作る (同じ設定からは常に同じ一覧ができる)
+inline std::vector<SweepJob> makeSweepJobs(const SweepSpec &spec) {
+	std::vector<SweepJob> jobs;
+
+	if (!spec.latinHypercube) {
+		// 直積: 最初のパラメータが一番速く変わる
+		int total = 1;
+		for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+			total *= spec.ranges[i].count;
+		}
+		for (int j = 0; j < total; j++) {
+			SweepJob job;
+			job.id = j;
+			int rest = j;
+			for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+				const SweepRange &range = spec.ranges[i];
+				job.params[i] = range.value(rest % range.count);
+				rest /= range.count;
+			}
+			jobs.push_back(job);
+		}
+		return jobs;
+	}
+
+	// ラテン超方格: 各パラメータの範囲をsamples個の区間に分け、
+	// どの区間もちょうど1回ずつ使われるように区間の順番を並べ替える
+	const int n = spec.samples;
+	std::mt19937 rng(spec.seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	jobs.resize(n);
+	for (int j = 0; j < n; j++) {
+		jobs[j].id = j;
+	}
+	for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+		const SweepRange &range = spec.ranges[i];
+		std::vector<int> strata(n);
+		for (int j = 0; j < n; j++) {
+			strata[j] = j;
+		}
+		for (int j = n - 1; j > 0; j--) {
+			std::swap(strata[j], strata[(int)(uniform(rng) * (j + 1)) % (j + 1)]);
+		}
+		for (int j = 0; j < n; j++) {
+			const double t = range.swept() ? (strata[j] + uniform(rng)) / n : 0.0;
+			jobs[j].params[i] = range.min + (range.max - range.min) * t;
+		}
+	}
+	return jobs;
+}
+
+// 結果の列の名前 (1行は1つのジョブの1回の記録)
+inline std::vector<std::string> sweepColumns(const SweepSpec &spec) {
+	std::vector<std::string> columns;
+	columns.push_back("job");
+	for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+		columns.push_back(SWEEP_PARAM_NAMES[i]);
+	}
+	columns.push_back("step");
+	columns.push_back("energy");
+	for (int p = 0; p < spec.numProbes(); p++) {
+		char name[32];
+		sprintf(name, "probe%d", p);
+		columns.push_back(name);
+	}
+	return columns;
+}
+
+// 1ジョブを実行するのに必要なメモリ (バイト, 概算)
+inline size_t sweepJobBytes(const SweepSpec &spec) {
+	const size_t cells = (size_t)spec.xCells * spec.yCells;
+	const size_t rows = spec.steps / spec.recordInterval + 1;
+	return cells * sizeof(double) * 3 + rows * sweepColumns(spec).size() * sizeof(double);
+}
+
+// スナップショットを保存するディレクトリを作る (途中のディレクトリも作る。作れなければfalse)
+inline bool makeSweepDirectory(const std::string &directory) {
+	for (size_t end = directory.find('/', 1); ; end = directory.find('/', end + 1)) {
+		const std::string path = directory.substr(0, end);
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+#if defined(_WIN32)
+			_mkdir(path.c_str());
+#else
+			mkdir(path.c_str(), 0755);
+#endif
+		}
+		if (end == std::string::npos) {
+			break;
+		}
+	}
+
+	struct stat st;
+	if (stat(directory.c_str(), &st) != 0 || !(st.st_mode & S_IFDIR)) {
+		fprintf(stderr, "Failed to create a snapshot directory: %s\n", directory.c_str());
+		return false;
+	}
+	return true;
+}
+
+// ジョブのスナップショットのファイル名 (ディレクトリの最後の / はあってもなくてもよい)
+inline std::string sweepSnapshotPath(const SweepSpec &spec, int job) {
+	char name[32];
+	sprintf(name, "job%05d.snap", job);
+	std::string path = spec.snapshotDirectory;
+	if (path[path.size() - 1] != '/') {
+		path += '/';
+	}
+	return path + name;
+}
+
+// 1つのジョブの結果 (行優先で sweepColumns() の順に並べたもの)
+struct SweepResult {
+	int job;
+	std::vector<double> rows;
+};
+
+// 1つのジョブを実行する
+class SweepRunner {
+public:
+	SweepRunner(const SweepSpec &spec, const SweepJob &job)
+		: spec_(spec)
+		, job_(job) {
+	}
+
+	bool run(SweepResult &result) {
+		result.job = job_.id;
+		result.rows.clear();
+
+		const double *p = job_.params;
+		if (spec_.isWave()) {
+			wave_.setParams(spec_.xCells, spec_.yCells, p[SWEEP_SPEED], p[SWEEP_DX], p[SWEEP_DT], p[SWEEP_LOSS]);
+		}
+		else {
+			diffusion_.initParams(spec_.xCells, spec_.yCells, p[SWEEP_DIFF_NUM]);
+		}
+
+		const double cx = p[SWEEP_CENTER_X] * spec_.xCells;
+		const double cy = p[SWEEP_CENTER_Y] * spec_.yCells;
+		for (int y = 0; y < spec_.yCells; y++) {
+			for (int x = 0; x < spec_.xCells; x++) {
+				const double vx = (x - cx) * p[SWEEP_DX];
+				const double vy = (y - cy) * p[SWEEP_DX];
+				const double h = p[SWEEP_AMPLITUDE] * exp(-p[SWEEP_WIDTH] * (vx * vx + vy * vy));
+				if (spec_.isWave()) {
+					wave_.set(x, y, h);
+				}
+				else {
+					diffusion_.set(x, y, h);
+				}
+			}
+		}
+
+		if (spec_.isWave()) {
+			wave_.start();
+		}
+		else {
+			diffusion_.start();
+		}
+
+		for (int s = 0; s <= spec_.steps; s++) {
+			if (s % spec_.recordInterval == 0 || s == spec_.steps) {
+				record(s, result.rows);
+			}
+			if (s == spec_.steps) {
+				break;
+			}
+			if (spec_.isWave()) {
+				wave_.step();
+			}
+			else {
+				diffusion_.step();
+			}
+		}
+
+		if (!spec_.snapshotDirectory.empty()) {
+			const std::string filename = sweepSnapshotPath(spec_, job_.id);
+			if (!(spec_.isWave() ? wave_.saveSnapshot(filename.c_str()) : diffusion_.saveSnapshot(filename.c_str()))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	SweepRunner(const SweepRunner &);
+	SweepRunner & operator=(const SweepRunner &);
+
+	const double *heights() const {
+		return spec_.isWave() ? wave_.heights() : diffusion_.heights();
+	}
+
+	int pitch() const {
+		return spec_.isWave() ? wave_.pitch() : diffusion_.pitch();
+	}
+
+	// 波動方程式は運動エネルギーと位置エネルギーの和、拡散方程式は値の2乗の和
+	double energy() const {
+		const int W = spec_.xCells;
+		const int H = spec_.yCells;
+		const int P = pitch();
+		const double dx = job_.params[SWEEP_DX];
+		const double *u = heights();
+		double sum = 0.0;
+		if (spec_.isWave()) {
+			const double dt = job_.params[SWEEP_DT];
+			const double c2 = job_.params[SWEEP_SPEED] * job_.params[SWEEP_SPEED];
+			const double *prev = wave_.previousHeights();
+			for (int y = 1; y < H - 1; y++) {
+				for (int x = 1; x < W - 1; x++) {
+					const int i = y * P + x;
+					const double ut = (u[i] - prev[i]) / dt;
+					const double ux = (u[i + 1] - u[i]) / dx;
+					const double uy = (u[i + P] - u[i]) / dx;
+					sum += 0.5 * (ut * ut + c2 * (ux * ux + uy * uy));
+				}
+			}
+		}
+		else {
+			for (int y = 1; y < H - 1; y++) {
+				for (int x = 1; x < W - 1; x++) {
+					sum += u[y * P + x] * u[y * P + x];
+				}
+			}
+		}
+		return sum * dx * dx;
+	}
+
+	void record(int step, std::vector<double> &rows) const {
+		rows.push_back(job_.id);
+		for (int i = 0; i < SWEEP_NUM_PARAMS; i++) {
+			rows.push_back(job_.params[i]);
+		}
+		rows.push_back(step);
+		rows.push_back(energy());
+
+		const double *u = heights();
+		for (int p = 0; p < spec_.numProbes(); p++) {
+			const int x = (int)(spec_.probes[p * 2 + 0] * (spec_.xCells - 1) + 0.5);
+			const int y = (int)(spec_.probes[p * 2 + 1] * (spec_.yCells - 1) + 0.5);
+			rows.push_back(u[y * pitch() + x]);
+		}
+	}
+
+	const SweepSpec &spec_;
+	const SweepJob &job_;
+	WaveEquation wave_;
+	DiffEquation diffusion_;
+};
+
+// 終わったジョブの結果を追記していくファイル (中断後の再開に使う)
+//
+//   [SweepJournalHeader]
+//   [int32 ジョブ番号, uint32 値の数, uint64 チェックサム, double × 値の数] ...
+//
+// 1件ごとにfsyncするので、落ちても壊れるのは最後の書きかけの1件だけで、
+// 開くときにそこを切り捨てる。
+static const uint32_t SWEEP_JOURNAL_MAGIC = 0x4a505753;  // "SWPJ"
+static const uint32_t SWEEP_RESULTS_MAGIC = 0x43505753;  // "SWPC"
+static const uint32_t SWEEP_FILE_VERSION = 1;
+
+struct SweepJournalHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t specHash;
+	uint32_t numColumns;
+	uint32_t reserved;
+};
+
+class SweepJournal {
+public:
+	SweepJournal()
+		: fp_(NULL) {
+	}
+
+	virtual ~SweepJournal() {
+		close();
+	}
+
+	// 開いて、すでに終わっているジョブの結果を読み込む (なければ作る)
+	bool open(const std::string &filename, uint64_t specHash, uint32_t numColumns,
+		std::vector<SweepResult> &finished) {
+		close();
+		finished.clear();
+
+		SweepJournalHeader header;
+		std::memset(&header, 0, sizeof(header));
+		long validBytes = 0;
+
+		FILE *fp = fopen(filename.c_str(), "rb");
+		if (fp != NULL) {
+			if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == SWEEP_JOURNAL_MAGIC &&
+				header.version == SWEEP_FILE_VERSION) {
+				if (header.specHash != specHash || header.numColumns != numColumns) {
+					fprintf(stderr, "The journal %s belongs to a different sweep spec\n", filename.c_str());
+					fclose(fp);
+					return false;
+				}
+				validBytes = sizeof(header);
+
+				for (;;) {
+					int32_t job;
+					uint32_t count;
+					uint64_t checksum;
+					SweepResult result;
+					if (fread(&job, sizeof(job), 1, fp) != 1 || fread(&count, sizeof(count), 1, fp) != 1 ||
+						fread(&checksum, sizeof(checksum), 1, fp) != 1 || count % numColumns != 0) {
+						break;
+					}
+					result.job = job;
+					result.rows.resize(count);
+					if (fread(result.rows.data(), sizeof(double), count, fp) != count ||
+						sweepHash(result.rows.data(), sizeof(double) * count) != checksum) {
+						break;
+					}
+					finished.push_back(result);
+					validBytes = ftell(fp);
+				}
+			}
+			fclose(fp);
+		}
+
+		if (validBytes == 0) {
+			// 新しく作る
+			fp_ = fopen(filename.c_str(), "wb");
+			header.magic = SWEEP_JOURNAL_MAGIC;
+			header.version = SWEEP_FILE_VERSION;
+			header.specHash = specHash;
+			header.numColumns = numColumns;
+			if (fp_ == NULL || fwrite(&header, sizeof(header), 1, fp_) != 1 || !sync()) {
+				fprintf(stderr, "Failed to create a journal: %s\n", filename.c_str());
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		// 書きかけの記録を切り捨ててから追記する
+#if !defined(_WIN32)
+		if (truncate(filename.c_str(), validBytes) != 0) {
+			fprintf(stderr, "Failed to truncate a journal: %s\n", filename.c_str());
+			return false;
+		}
+#endif
+		fp_ = fopen(filename.c_str(), "ab");
+		if (fp_ == NULL) {
+			fprintf(stderr, "Failed to open a journal: %s\n", filename.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool append(const SweepResult &result) {
+		const int32_t job = result.job;
+		const uint32_t count = (uint32_t)result.rows.size();
+		const uint64_t checksum = sweepHash(result.rows.data(), sizeof(double) * count);
+		bool ok = fwrite(&job, sizeof(job), 1, fp_) == 1;
+		ok = ok && fwrite(&count, sizeof(count), 1, fp_) == 1;
+		ok = ok && fwrite(&checksum, sizeof(checksum), 1, fp_) == 1;
+		ok = ok && fwrite(result.rows.data(), sizeof(double), count, fp_) == count;
+		return sync() && ok;
+	}
+
+	void close() {
+		if (fp_ != NULL) {
+			fclose(fp_);
+			fp_ = NULL;
+		}
+	}
+
+private:
+	SweepJournal(const SweepJournal &);
+	SweepJournal & operator=(const SweepJournal &);
+
+	bool sync() {
+		bool ok = fflush(fp_) == 0;
+#if !defined(_WIN32)
+		ok = ok && fsync(fileno(fp_)) == 0;
+#endif
+		return ok;
+	}
+
+	FILE *fp_;
+};
+
+// すべてのジョブの結果を列ごとにまとめたファイルに書き出す
+//
+//   [uint32 magic, uint32 version, uint32 列数, uint32 予約, uint64 行数]
+//   [char 名前[32], uint64 オフセット] × 列数
+//   [double × 行数] × 列数 (オフセットの位置から)
+//
+// 結果はジョブ番号順に並べる。一時ファイルに書いてから名前を変える。
+inline bool writeSweepResults(const std::string &filename, const std::vector<std::string> &columns,
+	std::vector<SweepResult> results) {
+	struct ColumnEntry {
+		char name[32];
+		uint64_t offset;
+	};
+
+	std::sort(results.begin(), results.end(),
+		[](const SweepResult &a, const SweepResult &b) { return a.job < b.job; });
+
+	const uint32_t numColumns = (uint32_t)columns.size();
+	uint64_t numRows = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		numRows += results[i].rows.size() / numColumns;
+	}
+
+	const std::string tmpname = filename + ".tmp";
+	FILE *fp = fopen(tmpname.c_str(), "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open a results file: %s\n", tmpname.c_str());
+		return false;
+	}
+
+	const uint32_t header[4] = { SWEEP_RESULTS_MAGIC, SWEEP_FILE_VERSION, numColumns, 0 };
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(&numRows, sizeof(numRows), 1, fp) == 1;
+
+	uint64_t offset = sizeof(header) + sizeof(numRows) + sizeof(ColumnEntry) * numColumns;
+	for (uint32_t c = 0; ok && c < numColumns; c++) {
+		ColumnEntry entry;
+		std::memset(&entry, 0, sizeof(entry));
+		strncpy(entry.name, columns[c].c_str(), sizeof(entry.name) - 1);
+		entry.offset = offset;
+		ok = fwrite(&entry, sizeof(entry), 1, fp) == 1;
+		offset += sizeof(double) * numRows;
+	}
+
+	// 1列ずつ書き出す
+	std::vector<double> column;
+	for (uint32_t c = 0; ok && c < numColumns; c++) {
+		column.clear();
+		for (size_t i = 0; i < results.size(); i++) {
+			const std::vector<double> &rows = results[i].rows;
+			for (size_t r = c; r < rows.size(); r += numColumns) {
+				column.push_back(rows[r]);
+			}
+		}
+		ok = fwrite(column.data(), sizeof(double), column.size(), fp) == column.size();
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write a results file: %s\n", tmpname.c_str());
+		std::remove(tmpname.c_str());
+		return false;
+	}
+
+	std::remove(filename.c_str());
+	if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+		fprintf(stderr, "Failed to rename a results file: %s\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+#endif  // _SWEEP_H_
@@ -0,0 +1,409 @@
+#ifndef _TERRAIN_LOD_H_
+#define _TERRAIN_LOD_H_
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "grid_mesh.h"
+#include "parallel.h"
+
+// 高さ場をタイルに分けて、タイルごとに解像度 (LOD) を変えて描画するクラス
+//
+// - タイルごとに、頂点の間隔を画面に投影した大きさ (画面上の誤差) が
+//   閾値を超えない範囲で一番粗いレベルを選ぶ
+// - 選んだレベルの解像度に間引いた頂点だけを (タイルごとに並列に) 作ってアップロードする
+// - 隣のタイルの方が粗い場合は、境界上の頂点の高さを隣のタイルの辺上で線形補間した値にする。
+//   こうすると境界の折れ線が両側で一致するので、タイルの間に隙間ができない
+//
+// - 視錐台の外のタイルは頂点を作らず、描画もしない
+// - 見えるタイルの頂点は詰めて並べて1回でアップロードし、1回の glMultiDrawElementsBaseVertex で描画する
+//
+// 描画する三角形の数は格子の大きさではなく画面の解像度で決まり、1フレームのGLの呼び出しはタイルの数によらない。
+class TerrainLOD {
+public:
+	TerrainLOD()
+		: vaoId_(0)
+		, vboId_(0)
+		, iboId_(0)
+		, xCells_(0)
+		, yCells_(0)
+		, tileCells_(0)
+		, maxLevel_(0)
+		, tilesX_(0)
+		, tilesY_(0)
+		, x0_(0.0f)
+		, y0_(0.0f)
+		, spacing_(0.0f)
+		, maxPixelError_(2.0f)
+		, uploadedVertices_(0)
+		, visibleTiles_(0) {
+	}
+
+	virtual ~TerrainLOD() {
+		release();
+	}
+
+	// xCells x yCellsの格子 (頂点 (x, y) の位置は (x0 + x * spacing, y0 + y * spacing))
+	// tileCells: タイル1辺のセル数 (16ビットのインデックスに収まるように256以下)
+	void init(int xCells, int yCells, float x0, float y0, float spacing,
+		int tileCells = 64, int maxLevel = 5) {
+		release();
+
+		xCells_ = xCells;
+		yCells_ = yCells;
+		x0_ = x0;
+		y0_ = y0;
+		spacing_ = spacing;
+		tileCells_ = std::min(std::max(tileCells, 2), 254);
+		maxLevel_ = std::max(0, maxLevel);
+		while (maxLevel_ > 0 && (1 << maxLevel_) > tileCells_) {
+			maxLevel_--;
+		}
+
+		tilesX_ = (xCells_ - 1 + tileCells_ - 1) / tileCells_;
+		tilesY_ = (yCells_ - 1 + tileCells_ - 1) / tileCells_;
+		tiles_.resize(tilesX_ * tilesY_);
+
+		const int slotVertices = (tileCells_ + 1) * (tileCells_ + 1);
+		for (int ty = 0; ty < tilesY_; ty++) {
+			for (int tx = 0; tx < tilesX_; tx++) {
+				Tile &tile = tiles_[ty * tilesX_ + tx];
+				tile.x0 = tx * tileCells_;
+				tile.x1 = std::min(tile.x0 + tileCells_, xCells_ - 1);
+				tile.y0 = ty * tileCells_;
+				tile.y1 = std::min(tile.y0 + tileCells_, yCells_ - 1);
+				tile.level = 0;
+				tile.baseVertex = 0;
+				tile.visible = false;
+				tile.built = false;
+				tile.zMin = tile.zMax = 0.0f;
+			}
+		}
+
+		// レベルとタイルの大きさの組み合わせごとにインデックスを作っておく
+		std::vector<unsigned short> allIndices;
+		for (size_t i = 0; i < tiles_.size(); i++) {
+			for (int level = 0; level <= maxLevel_; level++) {
+				const int nx = sampleCount(tiles_[i].x0, tiles_[i].x1, 1 << level);
+				const int ny = sampleCount(tiles_[i].y0, tiles_[i].y1, 1 << level);
+				const std::pair<int, int> key(nx, ny);
+				if (strips_.find(key) != strips_.end()) {
+					continue;
+				}
+
+				std::vector<unsigned short> indices;
+				buildGridStripIndices(nx, ny, indices);
+				Strip strip;
+				strip.offset = allIndices.size() * sizeof(unsigned short);
+				strip.count = (GLsizei)indices.size();
+				strips_[key] = strip;
+				allIndices.insert(allIndices.end(), indices.begin(), indices.end());
+			}
+		}
+
+		vertices_.resize(tiles_.size() * slotVertices * 3);
+
+		glGenVertexArrays(1, &vaoId_);
+		glBindVertexArray(vaoId_);
+
+		glGenBuffers(1, &vboId_);
+		glBindBuffer(GL_ARRAY_BUFFER, vboId_);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices_.size(), NULL, GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+
+		glGenBuffers(1, &iboId_);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId_);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * allIndices.size(),
+			&allIndices[0], GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+	}
+
+	void release() {
+		if (vaoId_ != 0) {
+			glDeleteVertexArrays(1, &vaoId_);
+			glDeleteBuffers(1, &vboId_);
+			glDeleteBuffers(1, &iboId_);
+		}
+		vaoId_ = vboId_ = iboId_ = 0;
+		tiles_.clear();
+		strips_.clear();
+		vertices_.clear();
+		drawCounts_.clear();
+		drawOffsets_.clear();
+		drawBaseVertices_.clear();
+	}
+
+	// 画面上の誤差の閾値 (ピクセル)
+	void setMaxPixelError(float pixels) {
+		maxPixelError_ = pixels;
+	}
+
+	// 視点の位置と、距離1での1ワールド単位あたりのピクセル数
+	// (= ビューポートの高さ * projMat[1][1] / 2) からタイルのレベルを選び、頂点を更新する
+	// heightsの行の間隔はpitch (0ならxCells)
+	// viewProjは投影とビューの行列 (列優先の16要素。glm::value_ptr)。NULLなら視錐台での選別をしない
+	void update(const double *heights, const float eye[3], float pixelsPerUnit, int pitch = 0,
+		const float *viewProj = NULL) {
+		const int stride = pitch > 0 ? pitch : xCells_;
+		float planes[6][4];
+		if (viewProj != NULL) {
+			frustumPlanes(viewProj, planes);
+		}
+
+		// 視錐台での選別とレベルの選択
+		for (size_t i = 0; i < tiles_.size(); i++) {
+			Tile &tile = tiles_[i];
+			tile.visible = viewProj == NULL || tileInFrustum(tile, heights, stride, planes);
+
+			const float cx = x0_ + 0.5f * (tile.x0 + tile.x1) * spacing_;
+			const float cy = y0_ + 0.5f * (tile.y0 + tile.y1) * spacing_;
+			const float cz = (float)heights[((tile.y0 + tile.y1) / 2) * stride + (tile.x0 + tile.x1) / 2];
+			const float radius = 0.7072f * tileCells_ * spacing_;
+			const float ddx = cx - eye[0];
+			const float ddy = cy - eye[1];
+			const float ddz = cz - eye[2];
+			const float distance = std::max(std::sqrt(ddx * ddx + ddy * ddy + ddz * ddz) - radius, 1.0e-3f);
+
+			int level = 0;
+			while (level < maxLevel_ &&
+				(float)(2 << level) * spacing_ * pixelsPerUnit / distance <= maxPixelError_) {
+				level++;
+			}
+			tile.level = level;
+		}
+
+		// 見えるタイルの頂点を先頭から詰めて並べる
+		drawCounts_.clear();
+		drawOffsets_.clear();
+		drawBaseVertices_.clear();
+		visible_.clear();
+		int vertexCount = 0;
+		for (size_t i = 0; i < tiles_.size(); i++) {
+			Tile &tile = tiles_[i];
+			if (!tile.visible) {
+				continue;
+			}
+			const int step = 1 << tile.level;
+			tile.nx = sampleCount(tile.x0, tile.x1, step);
+			tile.ny = sampleCount(tile.y0, tile.y1, step);
+			tile.baseVertex = vertexCount;
+			vertexCount += tile.nx * tile.ny;
+
+			const Strip &strip = strips_.find(std::make_pair(tile.nx, tile.ny))->second;
+			drawCounts_.push_back(strip.count);
+			drawOffsets_.push_back((const void *)strip.offset);
+			drawBaseVertices_.push_back(tile.baseVertex);
+			visible_.push_back((int)i);
+		}
+		visibleTiles_ = visible_.size();
+
+		// 頂点の作成 (タイルごとに並列)
+		parallelFor(0, (int)visible_.size(), [&](int lo, int hi) {
+			for (int k = lo; k < hi; k++) {
+				buildTile(visible_[k], heights, stride);
+			}
+		});
+
+		// 使う頂点だけをまとめてアップロードする
+		uploadedVertices_ = vertexCount;
+		if (vertexCount > 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, vboId_);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 3 * vertexCount, &vertices_[0]);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+
+	// シェーダとテクスチャを有効にした状態で呼ぶ
+	void draw() const {
+		if (drawCounts_.empty()) {
+			return;
+		}
+		glBindVertexArray(vaoId_);
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(0xffff);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, &drawCounts_[0], GL_UNSIGNED_SHORT,
+			&drawOffsets_[0], (GLsizei)drawCounts_.size(), const_cast<GLint *>(&drawBaseVertices_[0]));
+		glBindVertexArray(0);
+	}
+
+	// 直近のupdateでアップロードした頂点数
+	size_t uploadedVertices() const {
+		return uploadedVertices_;
+	}
+
+	// 直近のupdateで視錐台の中にあったタイルの数
+	size_t visibleTiles() const {
+		return visibleTiles_;
+	}
+
+private:
+	TerrainLOD(const TerrainLOD &);
+	TerrainLOD & operator=(const TerrainLOD &);
+
+	struct Tile {
+		int x0, x1, y0, y1;  // 頂点の範囲 (両端を含む)
+		int level;
+		int nx, ny;          // 選んだレベルでの頂点数
+		int baseVertex;      // 詰めて並べた頂点の中での位置
+		bool visible;
+		bool built;          // 一度でも頂点を作ったか (zMin, zMaxが正確か)
+		float zMin, zMax;    // 最後に頂点を作ったときの高さの範囲
+	};
+
+	struct Strip {
+		size_t offset;
+		GLsizei count;
+	};
+
+	// [a, b]をstep間隔で間引いたときの標本数 (端点は必ず含む)
+	static int sampleCount(int a, int b, int step) {
+		return (b - a + step - 1) / step + 1;
+	}
+
+	static int sampleAt(int a, int b, int step, int k) {
+		return std::min(a + k * step, b);
+	}
+
+	// 視錐台の6つの平面 (ax + by + cz + d >= 0 が内側。m は列優先)
+	static void frustumPlanes(const float *m, float planes[6][4]) {
+		for (int k = 0; k < 3; k++) {
+			for (int c = 0; c < 4; c++) {
+				planes[2 * k][c] = m[c * 4 + 3] + m[c * 4 + k];
+				planes[2 * k + 1][c] = m[c * 4 + 3] - m[c * 4 + k];
+			}
+		}
+	}
+
+	// タイルの直方体が視錐台に掛かるか
+	// 高さの範囲は、前に頂点を作ったときの範囲と今の粗い標本 (最も粗いレベルの間隔) の範囲を合わせたもの
+	bool tileInFrustum(const Tile &tile, const double *heights, int stride, const float planes[6][4]) const {
+		const int step = 1 << maxLevel_;
+		float zMin = tile.built ? tile.zMin : (float)heights[(size_t)tile.y0 * stride + tile.x0];
+		float zMax = tile.built ? tile.zMax : zMin;
+		for (int j = 0; j < sampleCount(tile.y0, tile.y1, step); j++) {
+			const double *row = heights + (size_t)sampleAt(tile.y0, tile.y1, step, j) * stride;
+			for (int i = 0; i < sampleCount(tile.x0, tile.x1, step); i++) {
+				const float z = (float)row[sampleAt(tile.x0, tile.x1, step, i)];
+				zMin = std::min(zMin, z);
+				zMax = std::max(zMax, z);
+			}
+		}
+
+		const float lo[3] = { x0_ + tile.x0 * spacing_, y0_ + tile.y0 * spacing_, zMin };
+		const float hi[3] = { x0_ + tile.x1 * spacing_, y0_ + tile.y1 * spacing_, zMax };
+		for (int p = 0; p < 6; p++) {
+			// 法線の向きに一番進んだ角が外側なら、直方体全体が外側
+			float d = planes[p][3];
+			for (int a = 0; a < 3; a++) {
+				d += planes[p][a] * (planes[p][a] >= 0.0f ? hi[a] : lo[a]);
+			}
+			if (d < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int levelOf(int tx, int ty, int fallback) const {
+		if (tx < 0 || ty < 0 || tx >= tilesX_ || ty >= tilesY_) {
+			return fallback;
+		}
+		return tiles_[ty * tilesX_ + tx].level;
+	}
+
+	// 辺[a, b]をstep間隔で標本化した折れ線の、位置pでの高さ
+	// (heightAt(i)は辺上のi番目の格子点の高さ)
+	template <class HeightAt>
+	static double edgeHeight(int a, int b, int step, int p, HeightAt heightAt) {
+		const int lo = a + (p - a) / step * step;
+		const int hi = std::min(lo + step, b);
+		if (lo == p || hi == lo) {
+			return heightAt(lo);
+		}
+		const double t = (double)(p - lo) / (hi - lo);
+		return (1.0 - t) * heightAt(lo) + t * heightAt(hi);
+	}
+
+	void buildTile(int index, const double *heights, int stride) {
+		Tile &tile = tiles_[index];
+		const int tx = index % tilesX_;
+		const int ty = index / tilesX_;
+		const int step = 1 << tile.level;
+
+		// 隣のタイルの方が粗ければ、境界ではそちらの間隔に合わせる
+		const int stepLeft = 1 << std::max(tile.level, levelOf(tx - 1, ty, tile.level));
+		const int stepRight = 1 << std::max(tile.level, levelOf(tx + 1, ty, tile.level));
+		const int stepBottom = 1 << std::max(tile.level, levelOf(tx, ty - 1, tile.level));
+		const int stepTop = 1 << std::max(tile.level, levelOf(tx, ty + 1, tile.level));
+
+		float *dst = &vertices_[(size_t)tile.baseVertex * 3];
+		float zMin = (float)heights[(size_t)tile.y0 * stride + tile.x0];
+		float zMax = zMin;
+		for (int j = 0; j < tile.ny; j++) {
+			const int y = sampleAt(tile.y0, tile.y1, step, j);
+			const double *row = heights + (size_t)y * stride;
+			for (int i = 0; i < tile.nx; i++) {
+				const int x = sampleAt(tile.x0, tile.x1, step, i);
+				double z = row[x];
+
+				if (j == 0 && stepBottom > step) {
+					z = edgeHeight(tile.x0, tile.x1, stepBottom, x,
+						[&](int p) { return heights[(size_t)y * stride + p]; });
+				}
+				else if (j == tile.ny - 1 && stepTop > step) {
+					z = edgeHeight(tile.x0, tile.x1, stepTop, x,
+						[&](int p) { return heights[(size_t)y * stride + p]; });
+				}
+				else if (i == 0 && stepLeft > step) {
+					z = edgeHeight(tile.y0, tile.y1, stepLeft, y,
+						[&](int p) { return heights[(size_t)p * stride + x]; });
+				}
+				else if (i == tile.nx - 1 && stepRight > step) {
+					z = edgeHeight(tile.y0, tile.y1, stepRight, y,
+						[&](int p) { return heights[(size_t)p * stride + x]; });
+				}
+
+				dst[0] = x0_ + x * spacing_;
+				dst[1] = y0_ + y * spacing_;
+				dst[2] = (float)z;
+				zMin = std::min(zMin, dst[2]);
+				zMax = std::max(zMax, dst[2]);
+				dst += 3;
+			}
+		}
+		tile.zMin = zMin;
+		tile.zMax = zMax;
+		tile.built = true;
+	}
+
+	GLuint vaoId_;
+	GLuint vboId_;
+	GLuint iboId_;
+
+	int xCells_, yCells_;
+	int tileCells_;
+	int maxLevel_;
+	int tilesX_, tilesY_;
+	float x0_, y0_, spacing_;
+	float maxPixelError_;
+
+	std::vector<Tile> tiles_;
+	std::map<std::pair<int, int>, Strip> strips_;
+	std::vector<float> vertices_;
+	std::vector<int> visible_;                 // 見えるタイルの番号
+	std::vector<GLsizei> drawCounts_;          // glMultiDrawElementsBaseVertexの引数 (見えるタイルごと)
+	std::vector<const void *> drawOffsets_;
+	std::vector<GLint> drawBaseVertices_;
+	size_t uploadedVertices_;
+	size_t visibleTiles_;
+};
+
+#endif  // _TERRAIN_LOD_H_
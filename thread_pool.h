@@ -0,0 +1,280 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// 使用するスレッド数 (0ならハードウェアのスレッド数)
+inline int parallelNumThreads(int numThreads = 0) {
+	if (numThreads > 0) {
+		return numThreads;
+	}
+	const int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+// 終了を待つタスクのまとまり
+class TaskGroup {
+public:
+	TaskGroup()
+		: pending_(0) {
+	}
+
+	bool done() const {
+		return pending_.load() == 0;
+	}
+
+private:
+	TaskGroup(const TaskGroup &);
+	TaskGroup & operator=(const TaskGroup &);
+
+	friend class ThreadPool;
+	std::atomic<int> pending_;
+};
+
+// ワークスティーリング方式のスレッドプール
+//
+// ワーカーはそれぞれ自分のキューを持ち、自分のキューの後ろから取り出し、
+// 空になったら他のキューの前から盗む。ワーカーの外から投入したタスクは
+// 共有のキューに入る。wait() で待っているスレッドも空いていればタスクを実行するので、
+// タスクの中から並列処理を呼んでも (入れ子にしても) 止まらない。
+// ワーカーは (スレッド数 - 1) 個で、残りの1つは待っているスレッドが受け持つ。
+class ThreadPool {
+public:
+	explicit ThreadPool(int numThreads = 0)
+		: queued_(0)
+		, unpinned_(0)
+		, stopping_(false) {
+		const int numWorkers = parallelNumThreads(numThreads) - 1;
+		for (int i = 0; i < numWorkers + 1; i++) {
+			queues_.push_back(new WorkQueue());
+		}
+		for (int i = 0; i < numWorkers; i++) {
+			workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+		}
+	}
+
+	virtual ~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cond_.notify_all();
+		for (size_t i = 0; i < workers_.size(); i++) {
+			workers_[i].join();
+		}
+		for (size_t i = 0; i < queues_.size(); i++) {
+			delete queues_[i];
+		}
+	}
+
+	// プロセスで共有するプール (スレッド数は最初に使うときの sharedSize() で決まる)
+	static ThreadPool &shared() {
+		static ThreadPool pool(sharedSize());
+		return pool;
+	}
+
+	// 共有のプールのスレッド数 (0ならハードウェアのスレッド数。1つのホストで複数のプロセスを動かす場合に減らす)
+	static int &sharedSize() {
+		static int numThreads = 0;
+		return numThreads;
+	}
+
+	int numThreads() const {
+		return (int)workers_.size() + 1;
+	}
+
+	void submit(TaskGroup &group, const std::function<void()> &func) {
+		// ワーカーから投入したものは自分のキューに入れる (キャッシュに残っている可能性が高い)
+		const int self = currentWorker();
+		push(self >= 0 ? self : (int)queues_.size() - 1, group, func, false);
+	}
+
+	// worker番目のワーカーのキューに入れる
+	// 同じ範囲をいつも同じワーカーに渡すと、そのワーカーが最初に触れたメモリ
+	// (NUMAノードのローカルメモリ) を使い続けられる。手の空いた他のワーカーに盗まれることはあるが、
+	// wait() で待っているワーカー以外のスレッドは実行しない。ワーカーの中から呼んだ場合は submit() と同じ
+	void submitTo(int worker, TaskGroup &group, const std::function<void()> &func) {
+		if (currentWorker() >= 0 || worker < 0 || worker >= (int)workers_.size()) {
+			submit(group, func);
+			return;
+		}
+		push(worker, group, func, true);
+	}
+
+	// スレッドをCPUに固定する
+	// cpus[0]は呼び出し元のスレッド、cpus[i + 1]はi番目のワーカー (足りなければ先頭から繰り返す)
+	bool setAffinity(const std::vector<int> &cpus) {
+		if (cpus.empty()) {
+			return true;
+		}
+#if defined(__linux__)
+		bool ok = pinThread(pthread_self(), cpus[0]);
+		for (size_t i = 0; i < workers_.size(); i++) {
+			ok = pinThread(workers_[i].native_handle(), cpus[(i + 1) % cpus.size()]) && ok;
+		}
+		return ok;
+#else
+		return false;
+#endif
+	}
+
+	// groupのタスクがすべて終わるまで、他のタスクを実行しながら待つ
+	void wait(TaskGroup &group) {
+		const int self = currentWorker();
+		while (!group.done()) {
+			if (runOne(self)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [&] { return group.done() || (self >= 0 ? queued_ : unpinned_).load() > 0; });
+		}
+	}
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool & operator=(const ThreadPool &);
+
+	struct Task {
+		std::function<void()> func;
+		TaskGroup *group;
+		bool pinned;  // submitTo() で投入したもの
+	};
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	// このプールのワーカーなら番号、それ以外なら-1
+	int currentWorker() const {
+		return currentPool() == this ? currentIndex() : -1;
+	}
+
+	static const ThreadPool *&currentPool() {
+		static thread_local const ThreadPool *pool = NULL;
+		return pool;
+	}
+
+	static int &currentIndex() {
+		static thread_local int index = -1;
+		return index;
+	}
+
+	void push(int index, TaskGroup &group, const std::function<void()> &func, bool pinned) {
+		group.pending_++;
+		queued_++;
+		if (!pinned) {
+			unpinned_++;
+		}
+
+		WorkQueue &queue = *queues_[index];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			Task task;
+			task.func = func;
+			task.group = &group;
+			task.pinned = pinned;
+			queue.tasks.push_back(task);
+		}
+		notify();
+	}
+
+#if defined(__linux__)
+	static bool pinThread(pthread_t thread, int cpu) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+	}
+#endif
+
+	void notify() {
+		// 待っている側が条件を調べてから眠るまでの間に通知が失われないようにする
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+		}
+		cond_.notify_all();
+	}
+
+	// pinnedOkがfalseなら submitTo() で投入したものは取り出さない
+	bool pop(WorkQueue &queue, bool back, bool pinnedOk, Task &task) {
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		if (back) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			return true;
+		}
+		for (std::deque<Task>::iterator it = queue.tasks.begin(); it != queue.tasks.end(); ++it) {
+			if (pinnedOk || !it->pinned) {
+				task = *it;
+				queue.tasks.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// タスクを1つ実行する (なければfalse)
+	bool runOne(int self) {
+		const int numQueues = (int)queues_.size();
+		Task task;
+		bool found = self >= 0 && pop(*queues_[self], true, true, task);
+		for (int i = 0; !found && i < numQueues; i++) {
+			const int victim = (self + 1 + i + numQueues) % numQueues;
+			found = pop(*queues_[victim], false, self >= 0, task);
+		}
+		if (!found) {
+			return false;
+		}
+		queued_--;
+		if (!task.pinned) {
+			unpinned_--;
+		}
+
+		task.func();
+		if (--task.group->pending_ == 0) {
+			notify();
+		}
+		return true;
+	}
+
+	void workerLoop(int index) {
+		currentPool() = this;
+		currentIndex() = index;
+		for (;;) {
+			if (runOne(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [this] { return queued_.load() > 0 || stopping_; });
+			if (stopping_ && queued_.load() == 0) {
+				return;
+			}
+		}
+	}
+
+	std::vector<WorkQueue *> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<int> queued_;
+	std::atomic<int> unpinned_;   // queued_ のうち submitTo() 以外で投入したもの
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool stopping_;
+};
+
+#endif  // _THREAD_POOL_H_
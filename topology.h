@@ -0,0 +1,203 @@
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#endif
+
+#include "thread_pool.h"
+
+// CPUとNUMAノードの構成
+// Linuxでは /sys/devices/system/node から読む。読めなければ全CPUを1つのノードとする
+struct CpuTopology {
+	std::vector<std::vector<int> > nodes;  // ノードごとのCPU番号
+
+	int numCpus() const {
+		int n = 0;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			n += (int)nodes[i].size();
+		}
+		return n;
+	}
+
+	// cpuが属するノード (見つからなければ-1)
+	int nodeOf(int cpu) const {
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end()) {
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+};
+
+// "0-3,8,10-11" の形のCPUの一覧
+inline bool parseCpuList(const std::string &text, std::vector<int> &cpus) {
+	cpus.clear();
+	size_t begin = 0;
+	while (begin < text.size()) {
+		size_t comma = text.find(',', begin);
+		if (comma == std::string::npos) {
+			comma = text.size();
+		}
+		const std::string item = text.substr(begin, comma - begin);
+		int lo, hi;
+		const int fields = sscanf(item.c_str(), "%d-%d", &lo, &hi);
+		if (fields < 1) {
+			return false;
+		}
+		if (fields == 1) {
+			hi = lo;
+		}
+		if (lo < 0 || hi < lo) {
+			return false;
+		}
+		for (int cpu = lo; cpu <= hi; cpu++) {
+			cpus.push_back(cpu);
+		}
+		begin = comma + 1;
+	}
+	return !cpus.empty();
+}
+
+inline CpuTopology loadCpuTopology() {
+	CpuTopology topology;
+
+#if defined(__linux__)
+	std::vector<int> ids;
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (dir != NULL) {
+		while (struct dirent *entry = readdir(dir)) {
+			int id;
+			char rest;
+			if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1) {
+				ids.push_back(id);
+			}
+		}
+		closedir(dir);
+	}
+	std::sort(ids.begin(), ids.end());
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		char path[64];
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", ids[i]);
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL) {
+			continue;
+		}
+		char line[4096];
+		std::vector<int> cpus;
+		if (fgets(line, sizeof(line), fp) != NULL) {
+			std::string text(line);
+			text.erase(text.find_last_not_of(" \n") + 1);
+			parseCpuList(text, cpus);
+		}
+		fclose(fp);
+
+		// CPUのないノード (メモリだけのノード) は除く
+		if (!cpus.empty()) {
+			topology.nodes.push_back(cpus);
+		}
+	}
+#endif
+
+	if (topology.nodes.empty()) {
+		std::vector<int> cpus;
+		const int n = std::max(1, (int)std::thread::hardware_concurrency());
+		for (int cpu = 0; cpu < n; cpu++) {
+			cpus.push_back(cpu);
+		}
+		topology.nodes.push_back(cpus);
+	}
+	return topology;
+}
+
+// スレッドを固定するCPUの並び (numThreads個。i番目がparallelForのi番目の区間を受け持つスレッド)
+//   none     固定しない (空の並び)
+//   compact  ノード0のCPUから順に詰める
+//   scatter  ノードを順番に回って1つずつ取る
+//   0,2,4-7  CPU番号を直接並べる
+inline bool makeAffinityMap(const std::string &spec, const CpuTopology &topology, int numThreads,
+	std::vector<int> &map) {
+	map.clear();
+	if (spec.empty() || spec == "none") {
+		return true;
+	}
+
+	std::vector<int> cpus;
+	if (spec == "compact") {
+		for (size_t n = 0; n < topology.nodes.size(); n++) {
+			cpus.insert(cpus.end(), topology.nodes[n].begin(), topology.nodes[n].end());
+		}
+	}
+	else if (spec == "scatter") {
+		for (size_t i = 0; (int)cpus.size() < topology.numCpus(); i++) {
+			for (size_t n = 0; n < topology.nodes.size(); n++) {
+				if (i < topology.nodes[n].size()) {
+					cpus.push_back(topology.nodes[n][i]);
+				}
+			}
+		}
+	}
+	else if (!parseCpuList(spec, cpus)) {
+		return false;
+	}
+
+	for (int t = 0; t < numThreads; t++) {
+		map.push_back(cpus[t % cpus.size()]);
+	}
+	return true;
+}
+
+// 共有のスレッドプールのスレッドをaffinityのとおりに固定し、構成を表示する
+// (配列を確保する前に呼ぶ。確保時に0を書き込んだスレッドのノードにページが置かれるため)
+inline bool setupThreadAffinity(const std::string &affinity, FILE *report) {
+	const CpuTopology topology = loadCpuTopology();
+	ThreadPool &pool = ThreadPool::shared();
+
+	std::vector<int> map;
+	if (!makeAffinityMap(affinity, topology, pool.numThreads(), map)) {
+		fprintf(stderr, "Invalid affinity: %s\n", affinity.c_str());
+		return false;
+	}
+	if (!pool.setAffinity(map)) {
+		fprintf(stderr, "Failed to set thread affinity: %s\n", affinity.c_str());
+		return false;
+	}
+
+	if (report != NULL) {
+		fprintf(report, "NUMA nodes: %d, CPUs: %d, threads: %d\n",
+			(int)topology.nodes.size(), topology.numCpus(), pool.numThreads());
+		for (size_t n = 0; n < topology.nodes.size(); n++) {
+			int threads = 0;
+			for (size_t t = 0; t < map.size(); t++) {
+				threads += topology.nodeOf(map[t]) == (int)n;
+			}
+			fprintf(report, "  node %d: %d CPUs", (int)n, (int)topology.nodes[n].size());
+			if (!map.empty()) {
+				fprintf(report, ", %d threads", threads);
+			}
+			fprintf(report, "\n");
+		}
+		if (map.empty()) {
+			fprintf(report, "  threads are not pinned (--affinity compact|scatter|LIST)\n");
+		}
+		else {
+			fprintf(report, "  pinned (%s):", affinity.c_str());
+			for (size_t t = 0; t < map.size(); t++) {
+				fprintf(report, " %d", map[t]);
+			}
+			fprintf(report, "\n");
+		}
+	}
+	return true;
+}
+
+#endif  // _TOPOLOGY_H_
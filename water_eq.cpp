@@ -4,6 +4,8 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <chrono>
 
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
@@ -18,9 +20,27 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
 #include "common.h"
-#include "wave_equation.h"
+#include "water_eq.h"
+#include "shallow_water.h"
+#include "frame_writer.h"
+#include "frame_codec.h"
+#include "colormap.h"
+#include "y4m_writer.h"
+#include "grid_mesh.h"
+#include "png_writer.h"
+#include "terrain_lod.h"
+#include "gpu_solver.h"
+#include "shader_program.h"
+#include "shader_manager.h"
+#include "gpu_timer.h"
+#include "simulation_host.h"
+#include "wave_ensemble.h"
+#include "probe.h"
+#include "topology.h"
 
 static int WIN_WIDTH = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT = 500;                       // ウィンドウの高さ
@@ -30,16 +50,40 @@ static const std::string TEX_FILE = std::string(DATA_DIRECTORY) + "hue.png";
 
 static const std::string VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "glsl.vert";
 static const std::string FRAG_SHADER_FILE = std::string(SHADER_DIRECTORY) + "glsl.frag";
+static const std::string SSBO_VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "glsl_ssbo.vert";
+static const std::string WAVE_COMP_SHADER_FILE = std::string(SHADER_DIRECTORY) + "wave_step.comp";
 
 // VAO関連の変数
 GLuint vaoId;
 GLuint vboId;
 GLuint iboId;
+GLsizei indexCount;
+GLenum indexType;
 
 // シェーダを参照する番号
 GLuint vertShaderId;
 GLuint fragShaderId;
 GLuint programId;
+ShaderProgram program;
+
+// シェーダのファイルが変わったら読み込み直す
+ShaderManager shaderManager;
+int renderProgram = -1;
+int computeProgram = -1;
+
+// 視点に関するデータ (シェーダのViewDataブロック、視点が変わったときだけ更新する)
+struct ViewData {
+	glm::mat4 mvpMat;
+};
+static const GLuint VIEW_DATA_BINDING = 0;
+UniformBuffer viewBuffer;
+static bool viewDirty = true;
+static const glm::vec3 eye(9.0f, 9.0f, 8.0f);     // 視点の位置
+static float pixelsPerUnit = 0.0f;                // 距離1で1ワールド単位が何ピクセルになるか
+static glm::mat4 viewProjMat;                     // 視錐台の外のタイルを描画しないために使う
+
+// 描画にかかったGPUの時間
+GpuTimer drawTimer;
 
 // テクスチャ
 GLuint textureId;
@@ -52,136 +96,197 @@ static const double speed = 0.5;
 static const double dx = 0.01;
 static const double dt = 0.0005;
 
+// 浅水方程式で計算する (コマンドライン引数 --shallow-water で切り替え。--flux で流束を選ぶ)
+// 水面の高さを描画・出力するので、振幅の大きな波も形が崩れない (時間刻みは dt 以下でCFL条件から決まる)
+static bool useShallowWater = false;
+static ShallowWaterFlux shallowWaterFlux = SHALLOW_WATER_RUSANOV;
+static const double shallowWaterDepth = 1.0;
+ShallowWater shallowWater;
+
+// チェックポイントの設定 (コマンドライン引数で指定)
+static std::string restoreFile;                   // 再開に使うスナップショット
+static std::string checkpointFile;                // 保存先のスナップショット
+static int checkpointInterval = 1000;             // 保存の間隔 (ステップ数)
+
+// 時系列データの出力の設定 (コマンドライン引数で指定)
+static std::string outputFile;                    // 出力先
+static int outputInterval = 10;                   // 出力の間隔 (ステップ数)
+static FrameWriterPolicy outputPolicy = FRAME_WRITER_BLOCK;
+static bool outputDirect = false;                 // O_DIRECTを使うかどうか
+static bool outputCompressed = false;             // 圧縮形式で出力するかどうか
+FrameWriter frameWriter;
+FrameEncoder frameEncoder;
+
+// 観測点の記録の設定 (コマンドライン引数で指定、座標はセル単位)
+static std::string probeFile;                     // 記録先 (.csvならCSV、それ以外はバイナリ)
+static int probeInterval = 1;                     // 記録の間隔 (ステップ数)
+ProbeRecorder probes;
+
+// 画像・動画の書き出しの設定 (コマンドライン引数で指定)
+static int headlessSteps = 0;                     // 0より大きければウィンドウを作らずに計算する
+static std::string exportPngPrefix;               // PNGの書き出し先 (ファイル名の前半)
+static std::string exportY4mTarget;               // Y4Mの書き出し先 (ファイル, "-", "|コマンド")
+static std::string colormapFile = TEX_FILE;       // 色の対応表
+static int numInstances = 1;                      // 同時に計算するシミュレーションの数 (--headlessと併用)
+static int ensembleMembers = 0;                   // 0より大きければまとめて計算するアンサンブルのメンバー数
+Colormap colormap;
+Y4mWriter y4mWriter;
+std::vector<uint8_t> exportPixels;
+
 // 頂点のデータ
 std::vector<glm::vec3> positions;
 
-GLuint compileShader(const std::string &filename, GLuint type) {
-	// シェーダの作成
-	GLuint shaderId = glCreateShader(type);
+// タイルごとに解像度を変えて描画する (コマンドライン引数で切り替え)
+static bool useLOD = true;
+static float lodPixelError = 2.0f;                // 許容する画面上の誤差 (ピクセル)
+TerrainLOD terrain;
+
+// 境界の扱い (コマンドライン引数 --boundary で指定。既定は符号の反転)
+static EdgeBoundary boundaryPolicy;
+static bool customBoundary = false;
+
+// スレッドを固定するCPU (topology.h の makeAffinityMap)
+static std::string affinity = "none";
+
+// コンピュートシェーダで計算する (コマンドライン引数で切り替え、OpenGL 4.3が必要)
+static bool useGpu = false;
+GpuSolver gpuSolver;
 
-	// ファイルの読み込み
-	std::ifstream reader;
-	size_t codeSize;
-	std::string code;
+void setupRenderProgram();
 
-	// ファイルを開く
-	reader.open(filename.c_str(), std::ios::in);
-	if (!reader.is_open()) {
-		// ファイルを開けなかったらエラーを出して終了
-		fprintf(stderr, "Failed to load a shader: %s\n", VERT_SHADER_FILE.c_str());
+// シェーダの初期化
+void initShaders() {
+	// GPUで計算する場合は頂点シェーダがSSBOから高さを読む
+	// (最初の読み込みに失敗したときは使えるプログラムがないので終了する)
+	renderProgram = shaderManager.add(useGpu ? SSBO_VERT_SHADER_FILE : VERT_SHADER_FILE, FRAG_SHADER_FILE);//shaders1
+	if (renderProgram < 0) {
 		exit(1);
 	}
+	if (useGpu) {
+		computeProgram = shaderManager.addCompute(WAVE_COMP_SHADER_FILE);
+		if (computeProgram < 0) {
+			exit(1);
+		}
+	}
+
+	viewBuffer.create(sizeof(ViewData), VIEW_DATA_BINDING);
+	setupRenderProgram();
+}
+
+// 描画用のプログラムの準備 (読み込み直したときにも呼ぶ)
+void setupRenderProgram() {
+	programId = shaderManager.program(renderProgram);
+
+	// uniform変数の場所を調べて、描画中に変わらない値はここで設定しておく
+	program.attach(programId);
+	program.bindBlock("ViewData", VIEW_DATA_BINDING);
+
+	glUseProgram(programId);
+	glUniform1i(program.location("u_texture"), 0);
+	if (useGpu) {
+		glUniform1i(program.location("u_xCells"), xCells);
+		glUniform1i(program.location("u_yCells"), yCells);
+		glUniform1f(program.location("u_dx"), (float)dx);
+	}
+	glUseProgram(0);
+}
+
+// 中央にガウス型の山を置いた初期状態にする
+void setInitialCondition(WaveEquation &weq, double waveSpeed) {
+	weq.boundary() = boundaryPolicy;
+	weq.setParams(xCells, yCells, waveSpeed, dx, dt);
 
-	// ファイルをすべて読んで変数に格納 (やや難)
-	reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-	codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-	code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-	reader.seekg(0);                            // ファイルの読み取り位置を先頭に移動
-	reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-	// ファイルを閉じる
-	reader.close();
-
-	// コードのコンパイル
-	const char *codeChars = code.c_str();
-	glShaderSource(shaderId, 1, &codeChars, NULL);
-	glCompileShader(shaderId);
-
-	// コンパイルの成否を判定する
-	GLint compileStatus;
-	glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-	if (compileStatus == GL_FALSE) {
-		// コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-		fprintf(stderr, "Failed to compile a shader!\n");
-
-		// エラーメッセージの長さを取得する
-		GLint logLength;
-		glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-		if (logLength > 0) {
-			// エラーメッセージを取得する
-			GLsizei length;
-			std::string errMsg;
-			errMsg.resize(logLength);
-			glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-			// エラーメッセージとソースコードの出力
-			fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-			fprintf(stderr, "%s\n", code.c_str());
+	for (int y = 0; y < yCells; y++) {
+		for (int x = 0; x < xCells; x++) {
+			double vx = (x - xCells / 2) * dx;
+			double vy = (y - yCells / 2) * dx;
+			weq.set(x, y, 2.0 * exp(-5.0 * (vx * vx + vy * vy)));
 		}
-		exit(1);
 	}
 
-	return shaderId;
+	weq.start();
 }
 
-GLuint buildShaderProgram(const std::string &vShaderFile, const std::string &fShaderFile) {
-	// シェーダの作成
-	GLuint vertShaderId = compileShader(vShaderFile, GL_VERTEX_SHADER);
-	GLuint fragShaderId = compileShader(fShaderFile, GL_FRAGMENT_SHADER);
-
-	// シェーダプログラムのリンク
-	GLuint programId = glCreateProgram();
-	glAttachShader(programId, vertShaderId);
-	glAttachShader(programId, fragShaderId);
-	glLinkProgram(programId);
-
-	// リンクの成否を判定する
-	GLint linkState;
-	glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-	if (linkState == GL_FALSE) {
-		// リンクに失敗したらエラーメッセージを表示して終了
-		fprintf(stderr, "Failed to link shaders!\n");
-
-		// エラーメッセージの長さを取得する
-		GLint logLength;
-		glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-		if (logLength > 0) {
-			// エラーメッセージを取得する
-			GLsizei length;
-			std::string errMsg;
-			errMsg.resize(logLength);
-			glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-			// エラーメッセージを出力する
-			fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
+// 浅水方程式で同じ形の山を置く (静止した水面から持ち上げた状態)
+void setShallowWaterInitialCondition(ShallowWater &sw) {
+	sw.boundary() = boundaryPolicy;
+	sw.setParams(xCells, yCells, shallowWaterDepth, dx, dt);
+	sw.setFlux(shallowWaterFlux);
+	sw.setProfiling(true);
+
+	for (int y = 0; y < yCells; y++) {
+		for (int x = 0; x < xCells; x++) {
+			double vx = (x - xCells / 2) * dx;
+			double vy = (y - yCells / 2) * dx;
+			sw.set(x, y, 2.0 * exp(-5.0 * (vx * vx + vy * vy)));
 		}
-		exit(1);
 	}
 
-	// シェーダを無効化した後にIDを返す
-	glUseProgram(0);
-	return programId;
+	sw.start();
 }
 
-// シェーダの初期化
-void initShaders() {
-	programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);//shaders1
+// 描画・出力に使う現在の値 (セル (x, y) は simHeights()[y * simPitch() + x])
+const double *simHeights() {
+	return useShallowWater ? shallowWater.heights() : waveEqn.heights();
 }
 
-// 初期化関数
-void initializeGL() {
-	// 背景色の設定 (黒)
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+int simPitch() {
+	return useShallowWater ? shallowWater.pitch() : waveEqn.pitch();
+}
 
-	// 深度テストの有効化
-	glEnable(GL_DEPTH_TEST);
+unsigned long long simStepCount() {
+	return useShallowWater ? shallowWater.stepCount() : waveEqn.stepCount();
+}
 
-	// 波動方程式シミュレーションの初期化
-	waveEqn.setParams(xCells, yCells, speed, dx, dt);
+// 浅水方程式の各部分にかかった時間 (流束と更新は全スレッドの合計)
+void printShallowWaterTiming() {
+	const ShallowWaterTiming &t = shallowWater.timing();
+	if (t.steps == 0) {
+		return;
+	}
+	const double ms = 1000.0 / t.steps;
+	fprintf(stderr, "Shallow water (%s): %.3f ms/step, simulated %.3f s\n",
+		shallowWater.flux() == SHALLOW_WATER_HLL ? "HLL" : "Rusanov", t.stepSeconds * ms, shallowWater.time());
+	fprintf(stderr, "  x flux   %8.3f ms/step (thread total)\n", t.xFluxSeconds * ms);
+	fprintf(stderr, "  y flux   %8.3f ms/step (thread total)\n", t.yFluxSeconds * ms);
+	fprintf(stderr, "  update   %8.3f ms/step (thread total)\n", t.updateSeconds * ms);
+	fprintf(stderr, "  boundary %8.3f ms/step\n", t.boundarySeconds * ms);
+}
+
+// 波動方程式シミュレーションの初期化
+void initSimulation() {
+	if (useShallowWater) {
+		setShallowWaterInitialCondition(shallowWater);
+		return;
+	}
+
+	setInitialCondition(waveEqn, speed);
 
+	// スナップショットから再開する
+	if (!restoreFile.empty()) {
+		if (!waveEqn.loadSnapshot(restoreFile.c_str()) ||
+			waveEqn.xCells() != xCells || waveEqn.yCells() != yCells) {
+			fprintf(stderr, "Failed to restore from: %s\n", restoreFile.c_str());
+			exit(1);
+		}
+		fprintf(stderr, "Restored from %s (step %llu)\n", restoreFile.c_str(), waveEqn.stepCount());
+	}
+}
+
+void initGridIndices();
+
+// 全解像度で描画するための頂点とインデックスの用意
+void initGridBuffers() {
 	// 頂点データの初期化
+	positions.reserve((size_t)xCells * yCells);
 	for (int y = 0; y < yCells; y++) {
 		for (int x = 0; x < xCells; x++) {
 			double vx = (x - xCells / 2) * dx;
 			double vy = (y - yCells / 2) * dx;
 			positions.push_back(glm::vec3(vx, vy, 0.0));
-
-			waveEqn.set(x, y, 2.0 * exp(-5.0 * (vx * vx + vy * vy)));
 		}
 	}
 
-	waveEqn.start();
-
 	// VAOの用意
 	glGenVertexArrays(1, &vaoId);
 	glBindVertexArray(vaoId);
@@ -195,33 +300,81 @@ void initializeGL() {
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
 
-	std::vector<unsigned int> indices;
-	for (int y = 0; y < yCells - 1; y++) {
-		for (int x = 0; x < xCells - 1; x++) {
-			const int i0 = y * xCells + x;
-			const int i1 = y * xCells + (x + 1);
-			const int i2 = (y + 1) * xCells + x;
-			const int i3 = (y + 1) * xCells + (x + 1);
+	initGridIndices();
 
-			indices.push_back(i0);
-			indices.push_back(i1);
-			indices.push_back(i3);
-			indices.push_back(i0);
-			indices.push_back(i3);
-			indices.push_back(i2);
-		}
+	glBindVertexArray(0);
+}
+
+// 全解像度の格子のインデックスの用意 (VAOを有効にした状態で呼ぶ)
+void initGridIndices() {
+	// インデックスの用意 (三角形ストリップ + プリミティブリスタート)
+	// 頂点数が少なければ16ビットのインデックスを使う
+	glGenBuffers(1, &iboId);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+	if (xCells * yCells < 65535) {
+		std::vector<unsigned short> indices;
+		buildGridStripIndices(xCells, yCells, indices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			sizeof(unsigned short) * indices.size(),
+			&indices[0], GL_STATIC_DRAW);
+		indexCount = (GLsizei)indices.size();
+		indexType = GL_UNSIGNED_SHORT;
+	}
+	else {
+		std::vector<unsigned int> indices;
+		buildGridStripIndices(xCells, yCells, indices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			sizeof(unsigned int) * indices.size(),
+			&indices[0], GL_STATIC_DRAW);
+		indexCount = (GLsizei)indices.size();
+		indexType = GL_UNSIGNED_INT;
 	}
 
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(indexType == GL_UNSIGNED_SHORT ? 0xffff : 0xffffffff);
+}
+
+// 初期化関数
+void initializeGL() {
+	// 背景色の設定 (黒)
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// 深度テストの有効化
+	glEnable(GL_DEPTH_TEST);
+
+	// 波動方程式シミュレーションの初期化
+	initSimulation();
+
 	// シェーダの用意
 	initShaders();
 
-	glGenBuffers(1, &iboId);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		sizeof(unsigned int) * indices.size(),
-		&indices[0], GL_STATIC_DRAW);
+	// GPUで計算する場合は頂点をSSBOから作るので、インデックスだけを用意する
+	if (useGpu) {
+		// GPU側のバッファは行を詰めて並べる
+		std::vector<double> curr((size_t)xCells * yCells), prev((size_t)xCells * yCells);
+		waveEqn.copyHeights(&curr[0]);
+		waveEqn.copyPreviousHeights(&prev[0]);
+		if (!gpuSolver.initWave(shaderManager.program(computeProgram), xCells, yCells, &curr[0], &prev[0],
+			waveEqn.speed(), waveEqn.dx(), waveEqn.dt(), waveEqn.loss(), waveEqn.stepCount())) {
+			exit(1);
+		}
 
-	glBindVertexArray(0);
+		glGenVertexArrays(1, &vaoId);
+		glBindVertexArray(vaoId);
+		initGridIndices();
+		glBindVertexArray(0);
+	}
+	// LODを使う場合は全解像度の頂点を用意しない
+	else if (useLOD) {
+		terrain.init(xCells, yCells, -(xCells / 2) * dx, -(yCells / 2) * dx, dx);
+		terrain.setMaxPixelError(lodPixelError);
+	}
+	else {
+		initGridBuffers();
+	}
+
+	// 描画時間の計測の用意
+	drawTimer.init();
 
 	// テクスチャの用意
 	int texWidth, texHeight, channels;
@@ -246,23 +399,47 @@ void initializeGL() {
 
 }
 
-// OpenGLの描画関数
-void paintGL() {
-	// 背景色と深度値のクリア
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// 座標の変換
+// 視点の行列を作り直してシェーダに渡す
+void updateView() {
 	glm::mat4 projMat = glm::perspective(45.0f,
 		(float)WIN_WIDTH / (float)WIN_HEIGHT, 0.1f, 1000.0f);
 
-	glm::mat4 lookAt = glm::lookAt(glm::vec3(9.0f, 9.0f, 8.0f),   // 視点の位置
+	glm::mat4 lookAt = glm::lookAt(eye,   // 視点の位置
 		glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
 		glm::vec3(0.0f, 0.0f, 1.0f));  // 視界の上方向
 
-	glm::mat4 mvpMat = projMat * lookAt;
+	ViewData view;
+	view.mvpMat = projMat * lookAt;
+	viewBuffer.update(&view);
+	viewProjMat = view.mvpMat;
 
-	// VAOの有効化
-	glBindVertexArray(vaoId);
+	pixelsPerUnit = 0.5f * WIN_HEIGHT * projMat[1][1];
+	viewDirty = false;
+}
+
+// OpenGLの描画関数
+void paintGL() {
+	// シェーダのファイルが変わっていれば読み込み直す (失敗したら前のものを使い続ける)
+	if (shaderManager.poll()) {
+		setupRenderProgram();
+		if (useGpu) {
+			gpuSolver.setProgram(shaderManager.program(computeProgram));
+		}
+	}
+
+	// 背景色と深度値のクリア
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// 座標の変換 (ウィンドウの大きさが変わったときだけ)
+	if (viewDirty) {
+		updateView();
+	}
+
+	// 見えている大きさに合わせてタイルの解像度を選び、頂点を更新する
+	if (useLOD && !useGpu) {
+		const float eyePos[3] = { eye.x, eye.y, eye.z };
+		terrain.update(simHeights(), eyePos, pixelsPerUnit, simPitch(), glm::value_ptr(viewProjMat));
+	}
 
 	// シェーダの有効化
 	glUseProgram(programId);
@@ -271,19 +448,26 @@ void paintGL() {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_1D, textureId);
 
-	// Uniform変数の転送
-	GLuint uid;
-	uid = glGetUniformLocation(programId, "u_mvpMat");
-	glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-
-	uid = glGetUniformLocation(programId, "u_texture");
-	glUniform1i(uid, 0);
+	if (useGpu) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuSolver.currentBuffer());
+	}
 
 	// 三角形の描画
-	glDrawElements(GL_TRIANGLES, 3 * (yCells - 1) * (xCells - 1) * 2, GL_UNSIGNED_INT, 0);
-
-	// VAOの無効化
-	glBindVertexArray(0);
+	drawTimer.begin();
+	if (useGpu) {
+		glBindVertexArray(vaoId);
+		glDrawElements(GL_TRIANGLE_STRIP, indexCount, indexType, 0);
+		glBindVertexArray(0);
+	}
+	else if (useLOD) {
+		terrain.draw();
+	}
+	else {
+		glBindVertexArray(vaoId);
+		glDrawElements(GL_TRIANGLE_STRIP, indexCount, indexType, 0);
+		glBindVertexArray(0);
+	}
+	drawTimer.end();
 
 	// シェーダの無効化
 	glUseProgram(0);
@@ -297,6 +481,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 	// ユーザ管理のウィンドウサイズを変更
 	WIN_WIDTH = width;
 	WIN_HEIGHT = height;
+	viewDirty = true;
 
 	// GLFW管理のウィンドウサイズを変更
 	glfwSetWindowSize(window, WIN_WIDTH, WIN_HEIGHT);
@@ -309,14 +494,80 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 	glViewport(0, 0, renderBufferWidth, renderBufferHeight);
 }
 
+// GPUで1ステップ進める (CPUへの読み出しはチェックポイントの保存のときだけ)
+void stepGpuSimulation() {
+	gpuSolver.step();
+
+	if (!checkpointFile.empty() && gpuSolver.stepCount() % checkpointInterval == 0) {
+		gpuSolver.saveSnapshot(checkpointFile.c_str());
+	}
+}
+
+// 1ステップ進めて、必要なら保存・出力を行う
+void stepSimulation() {
+	// 波動データの更新
+	if (useShallowWater) {
+		shallowWater.step();
+	}
+	else {
+		waveEqn.step();
+	}
+
+	// チェックポイントの保存 (波動方程式のみ)
+	if (!useShallowWater && !checkpointFile.empty() && waveEqn.stepCount() % checkpointInterval == 0) {
+		waveEqn.saveSnapshot(checkpointFile.c_str());
+	}
+
+	const double *heights = simHeights();
+	const int pitch = simPitch();
+	const unsigned long long step = simStepCount();
+
+	// 時系列データの出力 (書き込みは別スレッドで行われる)
+	if (frameWriter.isOpen() && step % outputInterval == 0) {
+		frameWriter.submitRows(heights, sizeof(double) * xCells, sizeof(double) * pitch, yCells, step);
+	}
+	if (frameEncoder.isOpen() && step % outputInterval == 0) {
+		frameEncoder.encode(heights, step, pitch);
+	}
+
+	// 観測点の記録
+	if (probes.isOpen() && step % probeInterval == 0) {
+		probes.record(heights, step, pitch);
+	}
+
+	// 色をつけた画像の書き出し
+	if ((!exportPngPrefix.empty() || y4mWriter.isOpen()) && step % outputInterval == 0) {
+		colormap.apply(heights, xCells, yCells, &exportPixels[0], true, pitch);
+		if (!exportPngPrefix.empty()) {
+			char filename[32];
+			sprintf(filename, "%08llu.png", step);
+			writePNG(exportPngPrefix + filename, &exportPixels[0], xCells, yCells, 3);
+		}
+		if (y4mWriter.isOpen()) {
+			y4mWriter.write(&exportPixels[0]);
+		}
+	}
+}
+
 // アニメーションのためのアップデート
 void update() {
-	// 波動データの更新
-	waveEqn.step();
+	if (useGpu) {
+		stepGpuSimulation();
+		return;
+	}
 
+	stepSimulation();
+
+	// LODを使う場合は描画時に必要な解像度だけ更新する
+	if (useLOD) {
+		return;
+	}
+
+	const double *heights = simHeights();
+	const int pitch = simPitch();
 	for (int y = 0; y < yCells; y++) {
 		for (int x = 0; x < xCells; x++) {
-			positions[y * xCells + x].z = waveEqn.get(x, y);
+			positions[y * xCells + x].z = heights[y * pitch + x];
 		}
 	}
 
@@ -325,7 +576,392 @@ void update() {
 	glBindVertexArray(0);
 }
 
+// 時系列データ・画像の出力の準備
+bool openOutputs() {
+	if (!outputFile.empty() && outputCompressed) {
+		if (!frameEncoder.open(outputFile.c_str(), xCells, yCells)) {
+			return false;
+		}
+	}
+	else if (!outputFile.empty()) {
+		const size_t frameBytes = sizeof(double) * xCells * yCells;
+		if (!frameWriter.open(outputFile.c_str(), frameBytes, 2, outputPolicy,
+			outputDirect, 64 * (uint64_t)frameBytes)) {
+			return false;
+		}
+	}
+
+	if (!exportPngPrefix.empty() || !exportY4mTarget.empty()) {
+		if (!colormap.load(colormapFile)) {
+			return false;
+		}
+		exportPixels.resize((size_t)xCells * yCells * 3);
+	}
+	if (!exportY4mTarget.empty()) {
+		if (!y4mWriter.open(exportY4mTarget, xCells, yCells)) {
+			return false;
+		}
+	}
+
+	if (!probeFile.empty()) {
+		if (probes.numChannels() == 0) {
+			fprintf(stderr, "--probe-output needs at least one --probe, --probe-line or --probe-rect\n");
+			return false;
+		}
+		const bool csv = probeFile.size() >= 4 && probeFile.compare(probeFile.size() - 4, 4, ".csv") == 0;
+		if (!(csv ? probes.openCsv(probeFile) : probes.openBinary(probeFile))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void closeOutputs() {
+	if (frameWriter.isOpen()) {
+		frameWriter.close();
+		fprintf(stderr, "Frames written: %llu, dropped: %llu\n",
+			(unsigned long long)frameWriter.framesWritten(),
+			(unsigned long long)frameWriter.framesDropped());
+	}
+	if (frameEncoder.isOpen()) {
+		fprintf(stderr, "Frames encoded: %d (%llu bytes)\n", frameEncoder.numFrames(),
+			(unsigned long long)frameEncoder.bytesWritten());
+		frameEncoder.close();
+	}
+	y4mWriter.close();
+	if (probes.isOpen()) {
+		probes.close();
+		fprintf(stderr, "Probe channels recorded: %d\n", probes.numChannels());
+	}
+}
+
+// ウィンドウを作らずに計算だけを行う
+void runHeadless() {
+	initSimulation();
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < headlessSteps; i++) {
+		stepSimulation();
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	fprintf(stderr, "Steps: %d (%.1f steps/s)\n", headlessSteps, elapsed > 0.0 ? headlessSteps / elapsed : 0.0);
+	if (useShallowWater) {
+		printShallowWaterTiming();
+	}
+}
+
+// n個のシミュレーションのi番目の波の速さ (0.5倍から1.5倍まで振る)
+double sweepSpeed(int i, int n) {
+	return speed * (n > 1 ? 0.5 + (double)i / (n - 1) : 1.0);
+}
+
+// 波の速さを変えた複数のシミュレーションを共有のスレッドプールで同時に計算する
+void runInstances() {
+	SimulationHost host;
+	for (int i = 0; i < numInstances; i++) {
+		char name[32];
+		sprintf(name, "speed=%.3f", sweepSpeed(i, numInstances));
+		setInitialCondition(host.add<WaveEquation>(name, headlessSteps), sweepSpeed(i, numInstances));
+	}
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	host.run();
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	host.printReport(stderr);
+	fprintf(stderr, "Elapsed: %.3f s\n", elapsed);
+}
+
+// 波の速さを変えたシミュレーションを1つのアンサンブルとしてまとめて計算する
+void runEnsemble() {
+	WaveEnsemble ensemble;
+	ensemble.setParams(xCells, yCells, ensembleMembers, dx, dt);
+	for (int k = 0; k < ensembleMembers; k++) {
+		ensemble.setMember(k, sweepSpeed(k, ensembleMembers));
+	}
+
+	for (int y = 0; y < yCells; y++) {
+		for (int x = 0; x < xCells; x++) {
+			double vx = (x - xCells / 2) * dx;
+			double vy = (y - yCells / 2) * dx;
+			for (int k = 0; k < ensembleMembers; k++) {
+				ensemble.set(k, x, y, 2.0 * exp(-5.0 * (vx * vx + vy * vy)));
+			}
+		}
+	}
+	ensemble.start();
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < headlessSteps; i++) {
+		ensemble.step();
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	const double memberSteps = (double)headlessSteps * ensembleMembers;
+	fprintf(stderr, "Ensemble: %d members x %d steps (%.1f member-steps/s)\n",
+		ensembleMembers, headlessSteps, elapsed > 0.0 ? memberSteps / elapsed : 0.0);
+	for (int k = 0; k < ensembleMembers; k++) {
+		fprintf(stderr, "  speed=%.3f  center=%+.6f\n", ensemble.speed(k), ensemble.get(k, xCells / 2, yCells / 2));
+	}
+}
+
+// 収束の確認に使う問題: [-1, 1]^2 の中央のガウス型の山を時刻 CONVERGENCE_TIME まで進める
+// (波が境界に届く前に止めるので、境界の扱いは誤差に入らない)
+static const double CONVERGENCE_TIME = 0.5;
+static const int CONVERGENCE_REFERENCE_CELLS = 513;
+
+// 1辺nセル (n - 1 が2の累乗) の格子で解いた結果
+template <class Weights>
+std::vector<double> solveConvergenceProblem(int n, double stepDt) {
+	BasicWaveEquation<Weights> weq;
+	const double h = 2.0 / (n - 1);
+	weq.setParams(n, n, speed, h, stepDt, 0.0);
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			const double vx = -1.0 + x * h;
+			const double vy = -1.0 + y * h;
+			weq.set(x, y, exp(-40.0 * (vx * vx + vy * vy)));
+		}
+	}
+	weq.start();
+
+	const int steps = (int)(CONVERGENCE_TIME / stepDt + 0.5);
+	for (int i = 0; i < steps; i++) {
+		weq.step();
+	}
+	std::vector<double> u((size_t)n * n);
+	weq.copyHeights(&u[0]);
+	return u;
+}
+
+// 基準解との差のL2ノルム (粗い格子の点は基準解の格子点に重なる)
+double convergenceError(const std::vector<double> &u, int n, const std::vector<double> &reference) {
+	const int ratio = (CONVERGENCE_REFERENCE_CELLS - 1) / (n - 1);
+	const double h = 2.0 / (n - 1);
+	double sum = 0.0;
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			const double d = u[y * n + x] - reference[(y * ratio) * CONVERGENCE_REFERENCE_CELLS + x * ratio];
+			sum += d * d * h * h;
+		}
+	}
+	return sqrt(sum);
+}
+
+template <class Weights>
+void printConvergence(const char *name, const std::vector<double> &reference, double stepDt) {
+	double previous = 0.0;
+	for (int n = 33; n < CONVERGENCE_REFERENCE_CELLS; n = (n - 1) * 2 + 1) {
+		const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		const double error = convergenceError(solveConvergenceProblem<Weights>(n, stepDt), n, reference);
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if (previous > 0.0) {
+			fprintf(stderr, "%-8s %5d %14.6e %7.2f %9.3f\n", name, n, error, log(previous / error) / log(2.0), elapsed);
+		}
+		else {
+			fprintf(stderr, "%-8s %5d %14.6e %7s %9.3f\n", name, n, error, "-", elapsed);
+		}
+		previous = error;
+	}
+}
+
+// 空間の差分ごとに格子を細かくしたときの誤差と収束次数を表示する
+// 時間刻みはすべての格子で同じにして (最も細かい格子のCFL条件に合わせる)、空間の誤差だけを比べる
+void runConvergence() {
+	const double stepDt = 0.25 * (2.0 / (CONVERGENCE_REFERENCE_CELLS - 1)) / speed;
+	fprintf(stderr, "Reference: %d cells, 4th-order, dt = %g, t = %g\n",
+		CONVERGENCE_REFERENCE_CELLS, stepDt, CONVERGENCE_TIME);
+	const std::vector<double> reference =
+		solveConvergenceProblem<FourthOrderLaplacian>(CONVERGENCE_REFERENCE_CELLS, stepDt);
+
+	fprintf(stderr, "%-8s %5s %14s %7s %9s\n", "stencil", "cells", "L2 error", "order", "seconds");
+	printConvergence<FivePointLaplacian>("5-point", reference, stepDt);
+	printConvergence<NinePointLaplacian>("9-point", reference, stepDt);
+	printConvergence<FourthOrderLaplacian>("4th", reference, stepDt);
+}
+
 int main(int argc, char **argv) {
+	probes.init(xCells, yCells);
+
+	// コマンドライン引数の処理
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--restore" && i + 1 < argc) {
+			restoreFile = argv[++i];
+		}
+		else if (arg == "--checkpoint" && i + 1 < argc) {
+			checkpointFile = argv[++i];
+		}
+		else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+			checkpointInterval = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (arg == "--output-interval" && i + 1 < argc) {
+			outputInterval = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--output-drop") {
+			outputPolicy = FRAME_WRITER_DROP;
+		}
+		else if (arg == "--output-direct") {
+			outputDirect = true;
+		}
+		else if (arg == "--output-compressed") {
+			outputCompressed = true;
+		}
+		else if (arg == "--headless" && i + 1 < argc) {
+			headlessSteps = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--instances" && i + 1 < argc) {
+			numInstances = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--ensemble" && i + 1 < argc) {
+			ensembleMembers = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--probe" && i + 1 < argc) {
+			double x, y;
+			if (sscanf(argv[++i], "%lf,%lf", &x, &y) != 2) {
+				fprintf(stderr, "--probe expects X,Y\n");
+				return 1;
+			}
+			char name[32];
+			sprintf(name, "p%d", probes.numChannels());
+			probes.addPoint(name, x, y);
+		}
+		else if (arg == "--probe-line" && i + 1 < argc) {
+			double x0, y0, x1, y1;
+			int samples;
+			if (sscanf(argv[++i], "%lf,%lf,%lf,%lf,%d", &x0, &y0, &x1, &y1, &samples) != 5) {
+				fprintf(stderr, "--probe-line expects X0,Y0,X1,Y1,SAMPLES\n");
+				return 1;
+			}
+			char name[32];
+			sprintf(name, "line%d", probes.numChannels());
+			probes.addLine(name, x0, y0, x1, y1, samples);
+		}
+		else if (arg == "--probe-rect" && i + 1 < argc) {
+			int x0, y0, x1, y1;
+			if (sscanf(argv[++i], "%d,%d,%d,%d", &x0, &y0, &x1, &y1) != 4) {
+				fprintf(stderr, "--probe-rect expects X0,Y0,X1,Y1\n");
+				return 1;
+			}
+			char name[32];
+			sprintf(name, "rect%d", probes.numChannels());
+			probes.addRect(name, x0, y0, x1, y1);
+		}
+		else if (arg == "--probe-output" && i + 1 < argc) {
+			probeFile = argv[++i];
+		}
+		else if (arg == "--probe-interval" && i + 1 < argc) {
+			probeInterval = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--boundary" && i + 1 < argc) {
+			if (!parseEdgeBoundary(argv[++i], boundaryPolicy)) {
+				fprintf(stderr, "Invalid boundary: %s\n", argv[i]);
+				return 1;
+			}
+			customBoundary = true;
+		}
+		else if (arg == "--affinity" && i + 1 < argc) {
+			affinity = argv[++i];
+		}
+		else if (arg == "--pitch-padding" && i + 1 < argc) {
+			// 格子の行の間隔に足すセル数 (負なら4KBの倍数のときだけ1キャッシュライン)
+			gridPitchPadding() = atoi(argv[++i]);
+		}
+		else if (arg == "--convergence") {
+			runConvergence();
+			return 0;
+		}
+		else if (arg == "--export-png" && i + 1 < argc) {
+			exportPngPrefix = argv[++i];
+		}
+		else if (arg == "--export-y4m" && i + 1 < argc) {
+			exportY4mTarget = argv[++i];
+		}
+		else if (arg == "--colormap" && i + 1 < argc) {
+			colormapFile = argv[++i];
+		}
+		else if (arg == "--gpu") {
+			useGpu = true;
+		}
+		else if (arg == "--shallow-water") {
+			useShallowWater = true;
+		}
+		else if (arg == "--flux" && i + 1 < argc) {
+			const std::string flux = argv[++i];
+			if (flux == "rusanov") {
+				shallowWaterFlux = SHALLOW_WATER_RUSANOV;
+			}
+			else if (flux == "hll") {
+				shallowWaterFlux = SHALLOW_WATER_HLL;
+			}
+			else {
+				fprintf(stderr, "Unknown flux: %s (rusanov or hll)\n", flux.c_str());
+				return 1;
+			}
+		}
+		else if (arg == "--no-lod") {
+			useLOD = false;
+		}
+		else if (arg == "--lod-error" && i + 1 < argc) {
+			lodPixelError = std::max(0.1f, (float)atof(argv[++i]));
+		}
+		else {
+			fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	// GPUで計算する場合は毎ステップの読み出しが必要な出力は使えない
+	if (useGpu && (headlessSteps > 0 || !outputFile.empty() || !probeFile.empty() || customBoundary ||
+		!exportPngPrefix.empty() || !exportY4mTarget.empty())) {
+		fprintf(stderr, "--gpu can only be combined with --restore and --checkpoint\n");
+		return 1;
+	}
+
+	// 浅水方程式はスナップショット・GPU・複数のインスタンスには対応していない
+	if (useShallowWater && (useGpu || !restoreFile.empty() || !checkpointFile.empty() ||
+		numInstances > 1 || ensembleMembers > 0)) {
+		fprintf(stderr, "--shallow-water cannot be combined with --gpu, --restore, --checkpoint, --instances or --ensemble\n");
+		return 1;
+	}
+
+	// 格子を確保する前にスレッドを固定する
+	if (!setupThreadAffinity(affinity, stderr)) {
+		return 1;
+	}
+
+	// 複数のインスタンスやアンサンブルは計算だけを行う (出力やスナップショットは1つのシミュレーション用)
+	if (numInstances > 1 || ensembleMembers > 0) {
+		if (headlessSteps == 0 || useGpu || !restoreFile.empty() || !checkpointFile.empty() ||
+			!outputFile.empty() || !probeFile.empty() || !exportPngPrefix.empty() || !exportY4mTarget.empty() ||
+			(numInstances > 1 && ensembleMembers > 0) || (ensembleMembers > 0 && customBoundary)) {
+			fprintf(stderr, "--instances and --ensemble require --headless and cannot be combined with other options\n");
+			return 1;
+		}
+		if (ensembleMembers > 0) {
+			runEnsemble();
+		}
+		else {
+			runInstances();
+		}
+		return 0;
+	}
+
+	if (!openOutputs()) {
+		return 1;
+	}
+
+	// ウィンドウを使わない場合
+	if (headlessSteps > 0) {
+		runHeadless();
+		closeOutputs();
+		return 0;
+	}
+
 	// OpenGLを初期化する
 	if (glfwInit() == GL_FALSE) {
 		fprintf(stderr, "Initialization failed!\n");
@@ -333,8 +969,9 @@ int main(int argc, char **argv) {
 	}
 
 	// OpenGLのバージョン指定
+	// コンピュートシェーダには4.3が必要
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, useGpu ? 3 : 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -378,4 +1015,13 @@ int main(int argc, char **argv) {
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
+
+	// 出力待ちのフレームを書き出す
+	closeOutputs();
+
+	fprintf(stderr, "Draw: %.3f ms/frame on the GPU (%llu frames measured)\n",
+		drawTimer.averageMilliseconds(), drawTimer.samples());
+	if (useShallowWater) {
+		printShallowWaterTiming();
+	}
 }
@@ -4,178 +4,221 @@
 #include <cstdio>
 #include <cstring>
 
-class WaveEquation {
+#include "snapshot.h"
+#include "stencil.h"
+
+// 空間の差分はWeightsで選ぶ (stencil.h。通常は WaveEquation = 5点のラプラシアン)
+template <class Weights>
+class BasicWaveEquation {
 public:
-	WaveEquation()
-		: xCells_(0)
-		, yCells_(0)
-		, speed_(0.0)
+	typedef Stencil<Weights, EdgeBoundary> Grid;
+
+	BasicWaveEquation()
+		: speed_(0.0)
 		, dx_(0.0)
 		, dt_(0.0)
 		, loss_(0.001)
-		, ucurr_(NULL)
-		, unext_(NULL)
-		, uprev_(NULL) {
+		, steps_(0) {
 	}
 
-	WaveEquation(int xCells, int yCells, double speed,
+	BasicWaveEquation(int xCells, int yCells, double speed,
 		double dx = 0.01, double dt = 0.01)
-		: xCells_(xCells)
-		, yCells_(yCells)
-		, speed_(speed)
+		: speed_(speed)
 		, dx_(dx)
 		, dt_(dt)
 		, loss_(0.001)
-		, ucurr_(NULL)
-		, unext_(NULL)
-		, uprev_(NULL) {
-
-		allocateMemory();
-	}
-
-	WaveEquation(const WaveEquation &weq)
-		: xCells_(0)
-		, yCells_(0)
-		, speed_(0.0)
-		, dx_(0.0)
-		, dt_(0.0)
-		, loss_(0.001)
-		, ucurr_(NULL)
-		, unext_(NULL)
-		, uprev_(NULL) {
-		this->operator=(weq);
-	}
+		, steps_(0) {
 
-	virtual ~WaveEquation() {
-		delete[] ucurr_;
-		delete[] unext_;
-		delete[] uprev_;
+		grid_.resize(xCells, yCells);
+		grid_.boundary().setCourant(speed_ * dt_ / dx_);
 	}
 
-	WaveEquation & operator=(const WaveEquation &weq) {
-		this->xCells_ = weq.xCells_;
-		this->yCells_ = weq.yCells_;
-		this->speed_ = weq.speed_;
-		this->dx_ = weq.dx_;
-		this->dt_ = weq.dt_;
-		this->loss_ = weq.loss_;
-
-		delete[] ucurr_;
-		delete[] uprev_;
-
-		if (weq.ucurr_ != NULL) {
-			ucurr_ = new double[xCells_ * yCells_];
-			std::memcpy(ucurr_, weq.ucurr_, sizeof(double) * xCells_ * yCells_);
-		}
-		else {
-			ucurr_ = NULL;
-		}
-
-		if (weq.unext_ != NULL) {
-			unext_ = new double[xCells_ * yCells_];
-			std::memcpy(unext_, weq.unext_, sizeof(double) * xCells_ * yCells_);
-		}
-		else {
-			unext_ = NULL;
-		}
-
-		if (weq.uprev_ != NULL) {
-			uprev_ = new double[xCells_ * yCells_];
-			std::memcpy(uprev_, weq.uprev_, sizeof(double) * xCells_ * yCells_);
-		}
-		else {
-			uprev_ = NULL;
-		}
-
-		return *this;
+	virtual ~BasicWaveEquation() {
 	}
 
 	void setParams(int xCells, int yCells, double speed,
 		double dx = 0.01, double dt = 0.01, double loss = 0.001) {
-		this->xCells_ = xCells;
-		this->yCells_ = yCells;
 		this->speed_ = speed;
 		this->dx_ = dx;
 		this->dt_ = dt;
 		this->loss_ = loss;
 
-		allocateMemory();
+		grid_.resize(xCells, yCells);
+		grid_.boundary().setCourant(speed_ * dt_ / dx_);
+		steps_ = 0;
 	}
 
 	void start() {
-		std::memcpy(uprev_, ucurr_, sizeof(double) * xCells_ * yCells_);
+		grid_.initializeBoundary();
+		grid_.syncPrevious();
+		steps_ = 0;
 	}
 
+	// 外周の帯と境界を先に計算してから内側を計算する (stepPipelined() で何も渡さない場合)
 	void step() {
-		static const int NN = 4;
-		static const int dx[] = { -1, 1, 0, 0 };
-		static const int dy[] = { 0, 0, -1, 1 };
-
-		for (int y = 1; y < yCells_ - 1; y++) {
-			for (int x = 1; x < xCells_ - 1; x++) {
-				double sum = 0.0;
-				for (int i = 0; i < NN; i++) {
-					const int nx = x + dx[i];
-					const int ny = y + dy[i];
-					if (x < 0 || y < 0 || x >= xCells_ || y >= yCells_) {
-						continue;
-					}
-
-					sum += ucurr_[ny * xCells_ + nx] - ucurr_[y * xCells_ + x];
-				}
-
-				unext_[y * xCells_ + x] = ucurr_[y * xCells_ + x]
-					+ (1.0 - loss_) * (ucurr_[y * xCells_ + x] - uprev_[y * xCells_ + x]
-						+ (speed_ * speed_ * dt_ * dt_ * sum / (dx_ * dx_)));
-			}
-		}
+		stepPipelined([](const Grid2D<double> &) {});
+	}
 
-		// Neumann border condition.
-		for (int x = 0; x < xCells_; x++) {
-			unext_[0 * xCells_ + x] = -unext_[1 * xCells_ + x];
-			unext_[(yCells_ - 1) * xCells_ + x] = -unext_[(yCells_ - 2) * xCells_ + x];
-		}
+	// step() と同じ計算を、外周の帯と境界を先に終えてから publish(next) を呼び、内側の計算と並行させる
+	// (publishは const Grid2D<double> & を受け取る。nextの帯と境界だけを読める)
+	template <class Publish>
+	void stepPipelined(Publish publish) {
+		grid_.sweepPipelined(update(), publish);
+		grid_.rotate();
+		steps_++;
+	}
 
-		for (int y = 0; y < yCells_; y++) {
-			unext_[y * xCells_ + 0] = -unext_[y * xCells_ + 1];
-			unext_[y * xCells_ + (xCells_ - 1)] = -unext_[y * xCells_ + (xCells_ - 2)];
-		}
+	// 1ステップを領域に分けて計算する (domain_decomp.h などで使う)
+	// 内部のセルをすべて覆うように stepRect() を呼んでから finishStep() を呼ぶ
+	void stepRect(int x0, int y0, int x1, int y1) {
+		grid_.sweepRect(update(), x0, y0, x1, y1);
+	}
 
-		std::memcpy(uprev_, ucurr_, sizeof(double) * xCells_ * yCells_);
-		std::memcpy(ucurr_, unext_, sizeof(double) * xCells_ * yCells_);
+	void finishStep() {
+		grid_.applyBoundary();
+		grid_.rotate();
+		steps_++;
 	}
 
 	void set(int x, int y, double height) {
-		ucurr_[y * xCells_ + x] = height;
+		grid_.current()[y * grid_.pitch() + x] = height;
 	}
 
 	double get(int x, int y) const {
-		return ucurr_[y * xCells_ + x];
+		return grid_.current()[y * grid_.pitch() + x];
 	}
 
+	// セル (x, y) の値は heights()[y * pitch() + x]
 	double * const heights() const {
-		return ucurr_;
+		return grid_.current();
 	}
 
-private:
-	void allocateMemory() {
-		delete[] ucurr_;
-		delete[] unext_;
-		delete[] uprev_;
+	// 1つ前のステップの値
+	double *previousHeights() const {
+		return grid_.previous();
+	}
+
+	// 境界の扱い (辺ごとに設定できる。既定はこれまでと同じ符号の反転)
+	EdgeBoundary &boundary() {
+		return grid_.boundary();
+	}
+
+	double speed() const {
+		return speed_;
+	}
 
-		ucurr_ = new double[xCells_ * yCells_];
-		unext_ = new double[xCells_ * yCells_];
-		uprev_ = new double[xCells_ * yCells_];
-		std::memset(ucurr_, 0, sizeof(double) * xCells_ * yCells_);
-		std::memset(unext_, 0, sizeof(double) * xCells_ * yCells_);
-		std::memset(uprev_, 0, sizeof(double) * xCells_ * yCells_);
+	double dx() const {
+		return dx_;
+	}
+
+	double dt() const {
+		return dt_;
+	}
+
+	double loss() const {
+		return loss_;
+	}
+
+	int xCells() const {
+		return grid_.xCells();
+	}
+
+	int yCells() const {
+		return grid_.yCells();
+	}
+
+	// 行の間隔 (xCellsより大きいことがある)
+	int pitch() const {
+		return grid_.pitch();
+	}
+
+	// 現在の値の格子 (行の並びを含む)
+	const Grid2D<double> &currentGrid() const {
+		return grid_.currentGrid();
+	}
+
+	// 現在の値を xCells * yCells の詰めた配列にコピーする
+	void copyHeights(double *heights) const {
+		grid_.currentGrid().pack(heights);
+	}
+
+	void copyPreviousHeights(double *heights) const {
+		grid_.previousGrid().pack(heights);
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+	// 現在の状態をスナップショットとして保存する
+	bool saveSnapshot(const char *filename) const {
+		SnapshotHeader header = makeSnapshotHeader(SNAPSHOT_KIND_WAVE, xCells(), yCells(), 2,
+			grid_.pitch(), grid_.currentGrid().lead());
+		header.step = steps_;
+		header.dx = dx_;
+		header.dt = dt_;
+		header.speed = speed_;
+		header.loss = loss_;
+
+		const double *arrays[] = { grid_.currentGrid().data(), grid_.previousGrid().data() };
+		return writeSnapshot(filename, header, arrays);
+	}
+
+	// スナップショットから再開する
+	// ファイルをmmapして、その領域を現在/1つ前の値として直接使う
+	bool loadSnapshot(const char *filename) {
+		SnapshotMapping *mapping = new SnapshotMapping();
+		if (!mapping->open(filename)) {
+			delete mapping;
+			return false;
+		}
+
+		const SnapshotHeader &header = mapping->header();
+		if (header.kind != SNAPSHOT_KIND_WAVE || header.numArrays != 2) {
+			fprintf(stderr, "Not a wave equation snapshot: %s\n", filename);
+			delete mapping;
+			return false;
+		}
+
+		dx_ = header.dx;
+		dt_ = header.dt;
+		speed_ = header.speed;
+		loss_ = header.loss;
+		steps_ = header.step;
+		grid_.adopt(mapping);
+		grid_.boundary().setCourant(speed_ * dt_ / dx_);
+		return true;
+	}
+
+private:
+	// 1セル分の更新式
+	struct Update {
+		const double *ucurr;
+		const double *uprev;
+		double damp;
+		double c2dt2;
+		double dx2;
+
+		double operator()(int, int, int i, double sum) const {
+			return ucurr[i] + damp * (ucurr[i] - uprev[i] + (c2dt2 * sum / dx2));
+		}
+	};
+
+	Update update() const {
+		Update u;
+		u.ucurr = grid_.current();
+		u.uprev = grid_.previous();
+		u.damp = 1.0 - loss_;
+		u.c2dt2 = speed_ * speed_ * dt_ * dt_;
+		u.dx2 = dx_ * dx_;
+		return u;
 	}
 
-	int xCells_, yCells_;
 	double speed_, dx_, dt_, loss_;
-	double *ucurr_;
-	double *unext_;
-	double *uprev_;
+	unsigned long long steps_;
+	Grid grid_;
 };
 
+typedef BasicWaveEquation<FivePointLaplacian> WaveEquation;
+
 #endif  // _WAVE_EQUATION_H_
@@ -0,0 +1,246 @@
+#ifndef _WAVE_ENSEMBLE_H_
+#define _WAVE_ENSEMBLE_H_
+
+#include <cstddef>
+#include <cstring>
+
+#include "parallel.h"
+#include "water_eq.h"
+
+// 同じ格子の上で、速さや減衰だけが違う波動方程式をまとめて計算するクラス
+//
+// K個のメンバーの値をセルごとに並べて持つ ((y * xCells + x) * K + k)。
+// 近傍の添字計算は全メンバーで共有され、一番内側のkのループは連続したメモリを
+// 同じ演算で処理するのでSIMD化される。1つのソルバではコアを使い切れない
+// 小さい・中くらいの格子で、パラメータを振った計算をまとめて流すためのもの。
+// 各メンバーの結果は係数をまとめて計算している分の丸め誤差を除いてWaveEquationと一致する。
+class WaveEnsemble {
+public:
+	WaveEnsemble()
+		: xCells_(0)
+		, yCells_(0)
+		, members_(0)
+		, dx_(0.0)
+		, dt_(0.0)
+		, speed_(NULL)
+		, loss_(NULL)
+		, coef_(NULL)
+		, damp_(NULL)
+		, ucurr_(NULL)
+		, unext_(NULL)
+		, uprev_(NULL)
+		, steps_(0) {
+	}
+
+	virtual ~WaveEnsemble() {
+		releaseMemory();
+	}
+
+	// 格子の大きさとメンバーの数を決める (速さ0, 減衰0.001で初期化される)
+	void setParams(int xCells, int yCells, int members,
+		double dx = 0.01, double dt = 0.01) {
+		xCells_ = xCells;
+		yCells_ = yCells;
+		members_ = members;
+		dx_ = dx;
+		dt_ = dt;
+
+		allocateMemory();
+	}
+
+	// k番目のメンバーの速さと減衰
+	void setMember(int k, double speed, double loss = 0.001) {
+		speed_[k] = speed;
+		loss_[k] = loss;
+		coef_[k] = speed * speed * dt_ * dt_ / (dx_ * dx_);
+		damp_[k] = 1.0 - loss;
+	}
+
+	void start() {
+		std::memcpy(uprev_, ucurr_, sizeof(double) * size());
+		steps_ = 0;
+	}
+
+	void step() {
+		const int K = members_;
+		const int W = xCells_;
+		const double *coef = coef_;
+		const double *damp = damp_;
+		const double *ucurr = ucurr_;
+		const double *uprev = uprev_;
+		double *unext = unext_;
+
+		parallelFor(1, yCells_ - 1, [=](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				for (int x = 1; x < W - 1; x++) {
+					const int i = (y * W + x) * K;
+					const double *c = ucurr + i;
+					const double *l = c - K;
+					const double *r = c + K;
+					const double *u = c - W * K;
+					const double *d = c + W * K;
+					const double *p = uprev + i;
+					double *n = unext + i;
+					for (int k = 0; k < K; k++) {
+						double sum = 0.0;
+						sum += l[k] - c[k];
+						sum += r[k] - c[k];
+						sum += u[k] - c[k];
+						sum += d[k] - c[k];
+						n[k] = c[k] + damp[k] * (c[k] - p[k] + coef[k] * sum);
+					}
+				}
+			}
+		});
+
+		// 境界はWaveEquationと同じく隣のセルの符号を反転する
+		for (int x = 0; x < xCells_; x++) {
+			flipCopy(x, 0, x, 1);
+			flipCopy(x, yCells_ - 1, x, yCells_ - 2);
+		}
+
+		for (int y = 0; y < yCells_; y++) {
+			flipCopy(0, y, 1, y);
+			flipCopy(xCells_ - 1, y, xCells_ - 2, y);
+		}
+
+		// 配列を入れ替えるだけでコピーはしない
+		double *prev = uprev_;
+		uprev_ = ucurr_;
+		ucurr_ = unext_;
+		unext_ = prev;
+		steps_++;
+	}
+
+	void set(int k, int x, int y, double height) {
+		ucurr_[(y * xCells_ + x) * members_ + k] = height;
+	}
+
+	double get(int k, int x, int y) const {
+		return ucurr_[(y * xCells_ + x) * members_ + k];
+	}
+
+	// k番目のメンバーの現在の値を xCells * yCells の配列に取り出す (描画や保存用)
+	void copyMember(int k, double *heights) const {
+		const int numCells = xCells_ * yCells_;
+		for (int i = 0; i < numCells; i++) {
+			heights[i] = ucurr_[i * members_ + k];
+		}
+	}
+
+	// k番目のメンバーをWaveEquationとして取り出す (スナップショットの保存などに使う)
+	void extractMember(int k, WaveEquation &weq) const {
+		weq.setParams(xCells_, yCells_, speed_[k], dx_, dt_, loss_[k]);
+		const int P = weq.pitch();
+		for (int y = 0; y < yCells_; y++) {
+			for (int x = 0; x < xCells_; x++) {
+				const int i = y * xCells_ + x;
+				weq.heights()[y * P + x] = ucurr_[i * members_ + k];
+				weq.previousHeights()[y * P + x] = uprev_[i * members_ + k];
+			}
+		}
+	}
+
+	int members() const {
+		return members_;
+	}
+
+	double speed(int k) const {
+		return speed_[k];
+	}
+
+	double loss(int k) const {
+		return loss_[k];
+	}
+
+	int xCells() const {
+		return xCells_;
+	}
+
+	int yCells() const {
+		return yCells_;
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+private:
+	WaveEnsemble(const WaveEnsemble &);
+	WaveEnsemble & operator=(const WaveEnsemble &);
+
+	size_t size() const {
+		return (size_t)xCells_ * yCells_ * members_;
+	}
+
+	void flipCopy(int x, int y, int fromX, int fromY) {
+		double *dst = unext_ + (y * xCells_ + x) * members_;
+		const double *src = unext_ + (fromY * xCells_ + fromX) * members_;
+		for (int k = 0; k < members_; k++) {
+			dst[k] = -src[k];
+		}
+	}
+
+	void allocateMemory() {
+		releaseMemory();
+
+		speed_ = new double[members_];
+		loss_ = new double[members_];
+		coef_ = new double[members_];
+		damp_ = new double[members_];
+		for (int k = 0; k < members_; k++) {
+			setMember(k, 0.0);
+		}
+
+		ucurr_ = new double[size()];
+		unext_ = new double[size()];
+		uprev_ = new double[size()];
+		firstTouch(ucurr_);
+		firstTouch(unext_);
+		firstTouch(uprev_);
+		steps_ = 0;
+	}
+
+	// step() と同じ行の分け方で0を書き込み、各行のページを計算するスレッドのNUMAノードに置く
+	void firstTouch(double *u) {
+		const size_t rowSize = (size_t)xCells_ * members_;
+		parallelFor(1, yCells_ - 1, [=](int y0, int y1) {
+			std::memset(u + y0 * rowSize, 0, sizeof(double) * rowSize * (y1 - y0));
+		});
+		if (yCells_ > 0) {
+			std::memset(u, 0, sizeof(double) * rowSize);
+			std::memset(u + (yCells_ - 1) * rowSize, 0, sizeof(double) * rowSize);
+		}
+	}
+
+	void releaseMemory() {
+		delete[] speed_;
+		delete[] loss_;
+		delete[] coef_;
+		delete[] damp_;
+		delete[] ucurr_;
+		delete[] unext_;
+		delete[] uprev_;
+
+		speed_ = NULL;
+		loss_ = NULL;
+		coef_ = NULL;
+		damp_ = NULL;
+		ucurr_ = NULL;
+		unext_ = NULL;
+		uprev_ = NULL;
+	}
+
+	int xCells_, yCells_, members_;
+	double dx_, dt_;
+	double *speed_;
+	double *loss_;
+	double *coef_;  // speed^2 dt^2 / dx^2
+	double *damp_;  // 1 - loss
+	double *ucurr_;
+	double *unext_;
+	double *uprev_;
+	unsigned long long steps_;
+};
+
+#endif  // _WAVE_ENSEMBLE_H_
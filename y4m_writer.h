@@ -0,0 +1,130 @@
+#ifndef _Y4M_WRITER_H_
+#define _Y4M_WRITER_H_
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+
+// RGB画像をY4M (YUV 4:4:4) の動画として書き出すクラス
+// ファイル名に"-"を指定すると標準出力、"|コマンド"を指定するとパイプに書き出す
+class Y4mWriter {
+public:
+	Y4mWriter()
+		: fp_(NULL)
+		, isPipe_(false)
+		, width_(0)
+		, height_(0)
+		, frames_(0) {
+	}
+
+	virtual ~Y4mWriter() {
+		close();
+	}
+
+	bool open(const std::string &target, int width, int height, int fps = 30) {
+		close();
+
+		if (target == "-") {
+			fp_ = stdout;
+		}
+		else if (!target.empty() && target[0] == '|') {
+#if !defined(_WIN32)
+			fp_ = popen(target.c_str() + 1, "w");
+#else
+			fp_ = _popen(target.c_str() + 1, "wb");
+#endif
+			isPipe_ = true;
+		}
+		else {
+			fp_ = fopen(target.c_str(), "wb");
+		}
+
+		if (fp_ == NULL) {
+			fprintf(stderr, "Failed to open a video output: %s\n", target.c_str());
+			isPipe_ = false;
+			return false;
+		}
+
+		width_ = width;
+		height_ = height;
+		frames_ = 0;
+		fprintf(fp_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width_, height_, fps);
+		planes_.resize((size_t)width_ * height_ * 3);
+		return true;
+	}
+
+	bool isOpen() const {
+		return fp_ != NULL;
+	}
+
+	// RGB画像を1フレームとして書き出す (BT.601, 限定範囲)
+	bool write(const uint8_t *rgb) {
+		if (fp_ == NULL) {
+			return false;
+		}
+
+		const size_t numPixels = (size_t)width_ * height_;
+		uint8_t *Y = &planes_[0];
+		uint8_t *U = Y + numPixels;
+		uint8_t *V = U + numPixels;
+		parallelFor(0, height_, [&](int lo, int hi) {
+			for (size_t i = (size_t)lo * width_; i < (size_t)hi * width_; i++) {
+				const int r = rgb[i * 3 + 0];
+				const int g = rgb[i * 3 + 1];
+				const int b = rgb[i * 3 + 2];
+				Y[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				U[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				V[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		});
+
+		fputs("FRAME\n", fp_);
+		if (fwrite(&planes_[0], 1, planes_.size(), fp_) != planes_.size()) {
+			fprintf(stderr, "Failed to write a video frame!\n");
+			return false;
+		}
+		frames_++;
+		return true;
+	}
+
+	void close() {
+		if (fp_ == NULL) {
+			return;
+		}
+
+		if (isPipe_) {
+#if !defined(_WIN32)
+			pclose(fp_);
+#else
+			_pclose(fp_);
+#endif
+		}
+		else if (fp_ == stdout) {
+			fflush(fp_);
+		}
+		else {
+			fclose(fp_);
+		}
+		fp_ = NULL;
+		isPipe_ = false;
+	}
+
+	int numFrames() const {
+		return frames_;
+	}
+
+private:
+	Y4mWriter(const Y4mWriter &);
+	Y4mWriter & operator=(const Y4mWriter &);
+
+	FILE *fp_;
+	bool isPipe_;
+	int width_, height_;
+	int frames_;
+	std::vector<uint8_t> planes_;
+};
+
+#endif  // _Y4M_WRITER_H_
@@ -0,0 +1,291 @@
+#ifndef _ADVECTION_DIFFUSION_H_
+#define _ADVECTION_DIFFUSION_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ADVECTION_USE_SSE2
+#endif
+
+#include "../grid.h"
+#include "../parallel.h"
+#include "diffusion_eq.h"
+
+// 速度場で運ばれる物質の移流拡散 (セミラグランジュ法の移流 + 拡散方程式の更新)
+//
+// 移流は各セルから速度の逆向きにたどった位置の値を双線形補間で取る (セミラグランジュ法)。
+// 値は前の値の補間にしかならないので、c dt / dx が1を超えても安定している (CFL条件がない)。
+// たどる位置は中点法 (2段のルンゲ・クッタ法) で求める: dt/2 戻った位置の速度で dt 戻る。
+// 拡散は持っている拡散方程式 (DiffEquationなど) の step() をそのまま使う。
+// 2つを分けて進める方法 (演算子分割) は選べる:
+//   SPLITTING_LIE     移流(dt) → 拡散(dt)                 時間について1次精度
+//   SPLITTING_STRANG  移流(dt/2) → 拡散(dt) → 移流(dt/2)  時間について2次精度 (既定)
+// 拡散係数Dは setParams() で渡し、拡散方程式の diff_num (1回の step() での D dt' / dx^2) は
+// 1/4を超えないように拡散を substeps 回に分けて dt' = dt / substeps にする。
+//
+// 移流の行は parallelFor で分ける。たどった位置と補間の重みは行ごとにまとめて計算し
+// (SSE2なら2セルずつ)、その後で4点を読んで補間する。
+// 境界は拡散方程式の方針に合わせ、周期境界の向きは反対側に回り込み、それ以外は格子の端 (ゴーストセル) で止める。
+static const double ADVECTION_MAX_DIFF_NUM = 0.25;   // 5点の陽解法の拡散が安定な D dt / dx^2 の上限
+
+enum SplittingScheme {
+	SPLITTING_LIE = 0,
+	SPLITTING_STRANG
+};
+
+template <class Diffusion>
+class BasicAdvectionDiffusion {
+public:
+	explicit BasicAdvectionDiffusion(Diffusion &diffusion)
+		: diffusion_(diffusion)
+		, dx_(1.0)
+		, dt_(0.0)
+		, substeps_(1)
+		, splitting_(SPLITTING_STRANG)
+		, steps_(0) {
+	}
+
+	virtual ~BasicAdvectionDiffusion() {
+	}
+
+	// セルの大きさと時間刻み、拡散係数D、1ステップで拡散を最低何回に分けるか
+	// (拡散方程式の大きさを決めてから呼ぶ。拡散方程式の diff_num を置き換え、速度は0で初期化される)
+	void setParams(double dx, double dt, double diffusivity, int minSubsteps = 1) {
+		dx_ = dx;
+		dt_ = dt;
+		const double diffNum = diffusivity * dt / (dx * dx);
+		substeps_ = std::max(std::max(1, minSubsteps), (int)std::ceil(diffNum / ADVECTION_MAX_DIFF_NUM));
+		diffusion_.setDiffNum(diffNum / substeps_);
+		const int W = diffusion_.xCells();
+		const int H = diffusion_.yCells();
+		vx_.allocate(W, H);
+		vy_.allocate(W, H);
+		scratch_.allocate(W, H);
+		steps_ = 0;
+	}
+
+	// 1ステップで拡散を何回進めるか
+	int substeps() const {
+		return substeps_;
+	}
+
+	void setSplitting(SplittingScheme splitting) {
+		splitting_ = splitting;
+	}
+
+	SplittingScheme splitting() const {
+		return splitting_;
+	}
+
+	// セル (x, y) の速度 (長さ / 時間。xが右、yが下に進む向き)
+	void setVelocity(int x, int y, double vx, double vy) {
+		vx_.at(x, y) = vx;
+		vy_.at(x, y) = vy;
+	}
+
+	// func(x, y, vx, vy) で全セルの速度を設定する
+	template <class Func>
+	void setVelocityField(Func func) {
+		for (int y = 0; y < vx_.yCells(); y++) {
+			for (int x = 0; x < vx_.xCells(); x++) {
+				func(x, y, vx_.at(x, y), vy_.at(x, y));
+			}
+		}
+	}
+
+	// 速度の最大値でのクーラン数 (|v| dt / dx。1を超えていても安定)
+	double maxCourant() const {
+		double vmax = 0.0;
+		for (int y = 0; y < vx_.yCells(); y++) {
+			for (int x = 0; x < vx_.xCells(); x++) {
+				vmax = std::max(vmax, std::sqrt(vx_.at(x, y) * vx_.at(x, y) + vy_.at(x, y) * vy_.at(x, y)));
+			}
+		}
+		return vmax * dt_ / dx_;
+	}
+
+	void step() {
+		if (splitting_ == SPLITTING_STRANG) {
+			advect(0.5 * dt_);
+			diffuse();
+			advect(0.5 * dt_);
+		}
+		else {
+			advect(dt_);
+			diffuse();
+		}
+		steps_++;
+	}
+
+	Diffusion &diffusion() {
+		return diffusion_;
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+private:
+	BasicAdvectionDiffusion(const BasicAdvectionDiffusion &);
+	BasicAdvectionDiffusion & operator=(const BasicAdvectionDiffusion &);
+
+	void diffuse() {
+		for (int i = 0; i < substeps_; i++) {
+			diffusion_.step();
+		}
+	}
+
+	// 1つの軸のたどった位置の扱い
+	struct Axis {
+		double lo, hi;    // 位置の範囲 (周期なら [lo, hi) に回り込む)
+		double period;    // 周期 (0なら端で止める)
+		int maxIndex;     // 補間の左 (上) の点の最大値
+	};
+
+	static Axis makeAxis(int cells, bool periodic) {
+		Axis axis;
+		axis.lo = periodic ? 1.0 : 0.0;
+		axis.hi = cells - 1.0;
+		axis.period = periodic ? cells - 2.0 : 0.0;
+		axis.maxIndex = cells - 2;
+		return axis;
+	}
+
+	// 現在の値を速度場で dt だけ運ぶ
+	void advect(double dt) {
+		const int W = diffusion_.xCells();
+		const int H = diffusion_.yCells();
+		const int P = diffusion_.pitch();
+		const double *src = diffusion_.heights();
+		const double scale = dt / dx_;
+		const EdgeBoundary &boundary = diffusion_.boundary();
+		const Axis ax = makeAxis(W, boundary.kind(EDGE_LEFT) == BOUNDARY_PERIODIC);
+		const Axis ay = makeAxis(H, boundary.kind(EDGE_TOP) == BOUNDARY_PERIODIC);
+
+		parallelFor(1, H - 1, [&](int y0, int y1) {
+			Trace trace(W);
+			for (int y = y0; y < y1; y++) {
+				backtrace(y, 1, W - 1, scale, ax, ay, trace);
+
+				double *dst = scratch_.row(y);
+				for (int x = 1; x < W - 1; x++) {
+					dst[x] = interpolate(src + (size_t)trace.iy[x] * P + trace.ix[x], P, trace.fx[x], trace.fy[x]);
+				}
+			}
+		});
+
+		// ゴーストセルは今の値をそのまま残す (assign() が埋め直すのはノイマン・ディリクレ・周期だけで、
+		// 符号の反転などは拡散のステップで書いた値を使い続ける)
+		std::memcpy(scratch_.row(0), src, sizeof(double) * W);
+		std::memcpy(scratch_.row(H - 1), src + (size_t)(H - 1) * P, sizeof(double) * W);
+		for (int y = 1; y < H - 1; y++) {
+			scratch_.row(y)[0] = src[(size_t)y * P];
+			scratch_.row(y)[W - 1] = src[(size_t)y * P + W - 1];
+		}
+		diffusion_.assign(scratch_);
+	}
+
+	// 周期の軸は [lo, hi) に回り込ませ、それ以外は [lo, hi] に収める
+	static double wrap(double p, const Axis &axis) {
+		if (axis.period > 0.0) {
+			p -= axis.period * std::floor((p - axis.lo) / axis.period);
+		}
+		return std::min(std::max(p, axis.lo), axis.hi);
+	}
+
+	// 行ごとのたどった位置 (位置と、補間に使う左上の点と重み)
+	struct Trace {
+		std::vector<double> px, py;
+		std::vector<int> ix, iy;
+		std::vector<double> fx, fy;
+
+		explicit Trace(int cells)
+			: px(cells), py(cells), ix(cells), iy(cells), fx(cells), fy(cells) {
+		}
+	};
+
+	// pから右と下の4点を双線形補間する
+	static double interpolate(const double *p, int pitch, double fx, double fy) {
+		const double top = p[0] + fx * (p[1] - p[0]);
+		const double bottom = p[pitch] + fx * (p[pitch + 1] - p[pitch]);
+		return top + fy * (bottom - top);
+	}
+
+	// セル [x0, x1) から速度の逆向きにたどった位置 (中点法)
+	void backtrace(int y, int x0, int x1, double scale, const Axis &ax, const Axis &ay, Trace &t) const {
+		const double *vx = vx_.row(y);
+		const double *vy = vy_.row(y);
+		const double half = 0.5 * scale;
+		for (int x = x0; x < x1; x++) {
+			t.px[x] = x - vx[x] * half;
+			t.py[x] = y - vy[x] * half;
+		}
+		locate(x0, x1, ax, ay, t);
+
+		// 中点の速度で全体をたどる
+		const int pitch = vx_.pitch();
+		for (int x = x0; x < x1; x++) {
+			const size_t i = (size_t)t.iy[x] * pitch + t.ix[x];
+			t.px[x] = x - interpolate(vx_.row(0) + i, pitch, t.fx[x], t.fy[x]) * scale;
+			t.py[x] = y - interpolate(vy_.row(0) + i, pitch, t.fx[x], t.fy[x]) * scale;
+		}
+		locate(x0, x1, ax, ay, t);
+	}
+
+	// 位置 (px, py) を格子に収め、補間に使う左上の点と重みを求める
+	static void locate(int x0, int x1, const Axis &ax, const Axis &ay, Trace &t) {
+		int x = x0;
+
+#if defined(ADVECTION_USE_SSE2)
+		// 周期でない軸は2セルずつ計算する (位置は0以上なので切り捨てが床関数になる)
+		if (ax.period == 0.0 && ay.period == 0.0) {
+			const __m128d xlo = _mm_set1_pd(ax.lo), xhi = _mm_set1_pd(ax.hi);
+			const __m128d ylo = _mm_set1_pd(ay.lo), yhi = _mm_set1_pd(ay.hi);
+			const __m128i xmax = _mm_set1_epi32(ax.maxIndex), ymax = _mm_set1_epi32(ay.maxIndex);
+			for (; x + 2 <= x1; x += 2) {
+				const __m128d bx = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(&t.px[x]), xlo), xhi);
+				const __m128d by = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(&t.py[x]), ylo), yhi);
+
+				// min(floor(b), maxIndex) (SSE2には32ビット整数のminがないので比較で選ぶ)
+				__m128i jx = _mm_cvttpd_epi32(bx);
+				__m128i jy = _mm_cvttpd_epi32(by);
+				const __m128i gx = _mm_cmpgt_epi32(jx, xmax);
+				const __m128i gy = _mm_cmpgt_epi32(jy, ymax);
+				jx = _mm_or_si128(_mm_and_si128(gx, xmax), _mm_andnot_si128(gx, jx));
+				jy = _mm_or_si128(_mm_and_si128(gy, ymax), _mm_andnot_si128(gy, jy));
+
+				_mm_storeu_pd(&t.fx[x], _mm_sub_pd(bx, _mm_cvtepi32_pd(jx)));
+				_mm_storeu_pd(&t.fy[x], _mm_sub_pd(by, _mm_cvtepi32_pd(jy)));
+				_mm_storel_epi64((__m128i *)&t.ix[x], jx);
+				_mm_storel_epi64((__m128i *)&t.iy[x], jy);
+			}
+		}
+#endif
+
+		for (; x < x1; x++) {
+			const double bx = wrap(t.px[x], ax);
+			const double by = wrap(t.py[x], ay);
+			t.ix[x] = std::min((int)bx, ax.maxIndex);
+			t.iy[x] = std::min((int)by, ay.maxIndex);
+			t.fx[x] = bx - t.ix[x];
+			t.fy[x] = by - t.iy[x];
+		}
+	}
+
+	Diffusion &diffusion_;
+	double dx_, dt_;
+	int substeps_;
+	SplittingScheme splitting_;
+	Grid2D<double> vx_, vy_;   // セルごとの速度
+	Grid2D<double> scratch_;   // 移流の結果 (拡散方程式の現在の値に戻す)
+	unsigned long long steps_;
+};
+
+typedef BasicAdvectionDiffusion<DiffEquation> AdvectionDiffusion;
+
+#endif  // _ADVECTION_DIFFUSION_H_
@@ -1,9 +1,19 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
-static const char *DATA_DIRECTORY = "C://graphics/resource/";
+#include <cstdlib>
+
+// 環境変数が設定されていればそちらを使う
+inline const char *directoryFromEnv(const char *name, const char *fallback) {
+	const char *value = getenv(name);
+	return value != NULL ? value : fallback;
+}
+
+// 既定では拡散視覚化ディレクトリで実行したときの相対パス
+// (GRAPHICS_DATA_DIR, GRAPHICS_SHADER_DIRで変更できる。末尾の/も含めて指定する)
+static const char *DATA_DIRECTORY = directoryFromEnv("GRAPHICS_DATA_DIR", "../");
 //static const char *SHADER_DIRECTORY = "C://graphics/src/final/Diffusion/shaders";
-static const char *SHADER_DIRECTORY = "C://graphics/src/diffusion_visualization/shaders/";
+static const char *SHADER_DIRECTORY = directoryFromEnv("GRAPHICS_SHADER_DIR", "シェーダ/");
 
 
 //static const char *SHADER_DIRECTORY = "C://graphics/libs/class/shaders/";
@@ -3,188 +3,254 @@
 
 #include <cstdio>
 #include <cstring>
+#include <vector>
+#include <algorithm>
 
-class DiffEquation {
-	int texWidth_, texHeight_;
+#include "../snapshot.h"
+#include "../stencil.h"
+
+// 空間の差分はWeightsで選ぶ (stencil.h。通常は DiffEquation = 5点のラプラシアン)
+template <class Weights>
+class BasicDiffEquation {
+public:
+	typedef Stencil<Weights, EdgeBoundary> Grid;
+
+private:
 	double diff_num_;
-	double *fcurr_;//現在の流れ//メモリのぽいんた
-	double *fnext_;//次の流れ
-	double *fprev_;//前の流れ
+	Grid grid_;//現在・次・前の流れ (スナップショットから再開したときのマップ領域も持つ)
+	unsigned long long steps_;//ステップ数
+	int dirtyTilesX_, dirtyTilesY_;
+	std::vector<unsigned char> dirty_;//前回clearDirtyしてから値が変わったタイル
 
 public:
-	DiffEquation()
-		: texWidth_(0)
-		, texHeight_(0)
-		, diff_num_(0.0)
-		, fcurr_(NULL)
-		, fnext_(NULL)
-		, fprev_(NULL) {
-	}
-
-	DiffEquation(int texWidth, int texHeight, double diff_num = 0.25)
-		: texWidth_(texWidth)
-		, texHeight_(texHeight)
-		, diff_num_(diff_num)
-		, fcurr_(NULL)
-		, fnext_(NULL)
-		, fprev_(NULL) {
-
-		initmemory();
-	}
-
-	DiffEquation(const DiffEquation &diff)
-		: texWidth_(0)
-		, texHeight_(0)
-		, diff_num_(0.0)
-		, fcurr_(NULL)
-		, fnext_(NULL)
-		, fprev_(NULL) {
-		this->operator=(diff);
+	// 変更を記録するタイルの1辺のセル数
+	static const int DIRTY_TILE = 32;
+
+	BasicDiffEquation()
+		: diff_num_(0.0)
+		, steps_(0)
+		, dirtyTilesX_(0)
+		, dirtyTilesY_(0) {
 	}
 
-	//代入演算子
-	DiffEquation & operator=(const DiffEquation &diff) {
-		texWidth_ = diff.texWidth_;
-		texHeight_ = diff.texHeight_;
-		diff_num_ = diff.diff_num_;
+	BasicDiffEquation(int texWidth, int texHeight, double diff_num = 0.25)
+		: diff_num_(diff_num)
+		, steps_(0)
+		, dirtyTilesX_(0)
+		, dirtyTilesY_(0) {
 
-		delete[] fcurr_;
-		delete[] fprev_;
-
-		if (diff.fcurr_ != NULL) {
-			fcurr_ = new double[texWidth_ * texHeight_];
-			std::memcpy(fcurr_, diff.fcurr_, sizeof(double) * texWidth_ * texHeight_);
-		}
-		else {
-			fcurr_ = NULL;
-		}
+		initmemory(texWidth, texHeight);
+	}
 
-		if (diff.fnext_ != NULL) {
-			fnext_ = new double[texWidth_ * texHeight_];
-			std::memcpy(fnext_, diff.fnext_, sizeof(double) * texWidth_ * texHeight_);
-		}
-		else {
-			fnext_ = NULL;
-		}
+	BasicDiffEquation(const BasicDiffEquation &diff)
+		: diff_num_(0.0)
+		, steps_(0)
+		, dirtyTilesX_(0)
+		, dirtyTilesY_(0) {
+		this->operator=(diff);
+	}
 
-		if (diff.fprev_ != NULL) {
-			fprev_ = new double[texWidth_ * texHeight_];
-			std::memcpy(fprev_, diff.fprev_, sizeof(double) * texWidth_ * texHeight_);
-		}
-		else {
-			fprev_ = NULL;
-		}
+	virtual ~BasicDiffEquation() {
+	}
 
+	//代入演算子
+	BasicDiffEquation & operator=(const BasicDiffEquation &diff) {
+		diff_num_ = diff.diff_num_;
+		grid_ = diff.grid_;
+		steps_ = diff.steps_;
+		resetDirty();
 		return *this;
 	}
 
 	// 拡散方程式シミュレーションの初期化
 	//それぞれの変数の初期化
 	void initParams(int texWidth, int texHeight, double diff_num) {
-		texWidth_ = texWidth;
-		texHeight_ = texHeight;
 		diff_num_ = diff_num;
 
-		initmemory();
+		initmemory(texWidth, texHeight);
+	}
+
+	// 1回の step() での D dt / dx^2 (値はそのままで変えられる)
+	double diffNum() const {
+		return diff_num_;
+	}
+
+	void setDiffNum(double diff_num) {
+		diff_num_ = diff_num;
 	}
 
 	//initVAOの中：Vertex配列の作成のあとに呼び出し
 	void start() {
-		//memcpy:メモリfcurr_からメモリfprev_へのコピーのための最も高速なライブラリルーチン
-		std::memcpy(fprev_, fcurr_, sizeof(double) * texWidth_ * texHeight_);
+		grid_.initializeBoundary();
+		grid_.syncPrevious();
+		steps_ = 0;
 	}
 
 	//animate関数内で呼び出し
 	// データの更新
 	void step() {
-		static const int NN = 4;
-		static const int dx[] = { -1, 1, 0, 0 };
-		static const int dy[] = { 0, 0, -1, 1 };
-
-		for (int y = 1; y < texHeight_ - 1; y++) {
-			for (int x = 1; x < texWidth_ - 1; x++) {
+		const int texWidth = grid_.xCells();
+		const double *fcurr = grid_.current();
+		const double diff_num = diff_num_;
+		unsigned char *dirty = &dirty_[0];
+		const int dirtyTilesX = dirtyTilesX_;
+
+		// タイルの行ごとにまとめて並列に処理するので、同じタイルに書き込むのは1つのスレッドだけ
+		grid_.sweep([=](int x, int y, int i, double sum) {
+			const double next = fcurr[i] + diff_num * sum;
+
+			// 値が変わったセルのタイルを記録する
+			if (next != fcurr[i]) {
+				dirty[(y / DIRTY_TILE) * dirtyTilesX + x / DIRTY_TILE] = 1;
+			}
+			return next;
+		}, DIRTY_TILE);
 
-				double sum = 0.0;
+		// 境界のセルの変更を記録する
+		for (int x = 0; x < texWidth; x++) {
+			markIfChanged(x, 0);
+			markIfChanged(x, grid_.yCells() - 1);
+		}
+		for (int y = 0; y < grid_.yCells(); y++) {
+			markIfChanged(0, y);
+			markIfChanged(texWidth - 1, y);
+		}
 
-				for (int i = 0; i < NN; i++) {
-					if (x < 0 || y < 0 || x >= texWidth_ || y >= texHeight_) {
-						continue;
-					}
-					sum += fcurr_[(y + dy[i]) * texWidth_ + x + dx[i]] - fcurr_[y * texWidth_ + x];
-				}
+		// 前・現在・次の配列を入れ替える (コピーはしない)
+		grid_.rotate();
+		steps_++;
+	}
 
-				fnext_[y * texWidth_ + x] = fcurr_[y * texWidth_ + x] + diff_num_ * sum;
+	// 頂点データの初期化で使う
+	void set(int x, int y, double height) {
+		grid_.current()[y * grid_.pitch() + x] = height;
+		dirty_[(y / DIRTY_TILE) * dirtyTilesX_ + x / DIRTY_TILE] = 1;
+	}
 
-			}
+	// 現在の値をsrc (同じ大きさの格子) で置き換える (移流など、拡散以外の処理の結果を戻すときに使う)
+	// ゴーストセルもsrcの値を使う (ノイマン・ディリクレ・周期の辺だけは今の方針で埋め直す)。全体を変更扱いにする
+	void assign(const Grid2D<double> &src) {
+		double *dst = grid_.current();
+		const int pitch = grid_.pitch();
+		for (int y = 0; y < grid_.yCells(); y++) {
+			std::memcpy(dst + (size_t)y * pitch, src.row(y), sizeof(double) * grid_.xCells());
 		}
+		grid_.initializeBoundary();
+		std::fill(dirty_.begin(), dirty_.end(), 1);
+	}
+
+	//updateのなかでの頂点データの初期化
+	double get(int x, int y) const {
+		return grid_.current()[y * grid_.pitch() + x];
+	}
 
-		int boundary = 1;
+	// セル (x, y) の値は heights()[y * pitch() + x]
+	double * const heights() const {
+		return grid_.current();
+	}
 
-		if (boundary = 0) {
-			// 基本境界条件
-			for (int x = 0; x < texWidth_; x++) {
-				fnext_[0 * texWidth_ + x] = 0;
-				fnext_[(texHeight_ - 1) * texWidth_ + x] = 0;
-			}
+	// 境界の扱い (辺ごとに設定できる。既定はこれまでの自然境界条件 = 符号の反転。吸収境界は使えない)
+	EdgeBoundary &boundary() {
+		return grid_.boundary();
+	}
 
-			for (int y = 0; y < texHeight_; y++) {
-				fnext_[y * texWidth_ + 0] = 0;
-				fnext_[y * texWidth_ + (texWidth_ - 1)] = 0;
-			}
-		}
-		else {
-			// 自然境界条件
-			for (int x = 0; x < texWidth_; x++) {
-				fnext_[0 * texWidth_ + x] = -fnext_[1 * texWidth_ + x];
-				fnext_[(texHeight_ - 1) * texWidth_ + x] = -fnext_[(texHeight_ - 2) * texWidth_ + x];
-			}
+	int xCells() const {
+		return grid_.xCells();
+	}
 
-			for (int y = 0; y < texHeight_; y++) {
-				fnext_[y * texWidth_ + 0] = -fnext_[y * texWidth_ + 1];
-				fnext_[y * texWidth_ + (texWidth_ - 1)] = -fnext_[y * texWidth_ + (texWidth_ - 2)];
-			}
+	int yCells() const {
+		return grid_.yCells();
+	}
 
+	// 行の間隔 (xCellsより大きいことがある)
+	int pitch() const {
+		return grid_.pitch();
+	}
 
-		}
+	// 現在の値を xCells * yCells の詰めた配列にコピーする
+	void copyHeights(double *heights) const {
+		grid_.currentGrid().pack(heights);
+	}
 
-		//memcpy:メモリfcurr_からメモリfprev_へのコピーのための最も高速なライブラリルーチン
-		//メモリ先：fprev_　メモリ元：fcurr_
-		std::memcpy(fprev_, fcurr_, sizeof(double) * texWidth_ * texHeight_);
-		std::memcpy(fcurr_, fnext_, sizeof(double) * texWidth_ * texHeight_);
+	unsigned long long stepCount() const {
+		return steps_;
 	}
 
-	// 頂点データの初期化で使う
-	void set(int x, int y, double height) {
-		fcurr_[y * texWidth_ + x] = height;
+	// 変更の記録 (DIRTY_TILE x DIRTY_TILEセルのタイル単位)
+	//描画側はisDirtyなタイルだけを転送してからclearDirtyを呼ぶ
+	int dirtyTilesX() const {
+		return dirtyTilesX_;
 	}
 
-	//updateのなかでの頂点データの初期化
-	double get(int x, int y) const {
-		return fcurr_[y * texWidth_ + x];
+	int dirtyTilesY() const {
+		return dirtyTilesY_;
 	}
 
-	double * const heights() const {
-		return fcurr_;
+	bool isDirty(int tx, int ty) const {
+		return dirty_[ty * dirtyTilesX_ + tx] != 0;
 	}
 
-private:
-	void initmemory() {
-		//メモリの開放
-		delete[] fcurr_;
-		delete[] fnext_;
-		delete[] fprev_;
+	void clearDirty() {
+		std::fill(dirty_.begin(), dirty_.end(), 0);
+	}
+
+	// スナップショットの保存
+	bool saveSnapshot(const char *filename) const {
+		SnapshotHeader header = makeSnapshotHeader(SNAPSHOT_KIND_DIFFUSION, xCells(), yCells(), 2,
+			grid_.pitch(), grid_.currentGrid().lead());
+		header.step = steps_;
+		header.diff_num = diff_num_;
+
+		const double *arrays[] = { grid_.currentGrid().data(), grid_.previousGrid().data() };
+		return writeSnapshot(filename, header, arrays);
+	}
+
+	// スナップショットからの再開
+	//ファイルをmmapした領域をそのまま現在・前の流れとして使う
+	bool loadSnapshot(const char *filename) {
+		SnapshotMapping *mapping = new SnapshotMapping();
+		if (!mapping->open(filename)) {
+			delete mapping;
+			return false;
+		}
 
-		fcurr_ = new double[texWidth_ * texHeight_];//長方形の面積
-		fnext_ = new double[texWidth_ * texHeight_];
-		fprev_ = new double[texWidth_ * texHeight_];
+		const SnapshotHeader &header = mapping->header();
+		if (header.kind != SNAPSHOT_KIND_DIFFUSION || header.numArrays != 2) {
+			fprintf(stderr, "Not a diffusion equation snapshot: %s\n", filename);
+			delete mapping;
+			return false;
+		}
 
-		//memset:メモリに指定バイト数分の値をセットする
-		std::memset(fcurr_, 0, sizeof(double) * texWidth_ * texHeight_);
-		std::memset(fnext_, 0, sizeof(double) * texWidth_ * texHeight_);
-		std::memset(fprev_, 0, sizeof(double) * texWidth_ * texHeight_);
+		diff_num_ = header.diff_num;
+		steps_ = header.step;
+		grid_.adopt(mapping);
+		resetDirty();
+		return true;
 	}
 
+private:
+	void initmemory(int texWidth, int texHeight) {
+		grid_.resize(texWidth, texHeight);
+		steps_ = 0;
+		resetDirty();
+	}
 
+	// 格子の大きさに合わせて記録を作り直す (最初は全体を変更扱いにする)
+	void resetDirty() {
+		dirtyTilesX_ = (grid_.xCells() + DIRTY_TILE - 1) / DIRTY_TILE;
+		dirtyTilesY_ = (grid_.yCells() + DIRTY_TILE - 1) / DIRTY_TILE;
+		dirty_.assign(dirtyTilesX_ * dirtyTilesY_, 1);
+	}
+
+	// 境界処理の後 (入れ替える前) に呼ぶ
+	void markIfChanged(int x, int y) {
+		const int i = y * grid_.pitch() + x;
+		if (grid_.next()[i] != grid_.current()[i]) {
+			dirty_[(y / DIRTY_TILE) * dirtyTilesX_ + x / DIRTY_TILE] = 1;
+		}
+	}
 };
 
+typedef BasicDiffEquation<FivePointLaplacian> DiffEquation;
+
 #endif  // _DIFF_EQUATION_H_
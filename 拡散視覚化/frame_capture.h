@@ -0,0 +1,295 @@
+#ifndef _FRAME_CAPTURE_H_
+#define _FRAME_CAPTURE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <glad/gl.h>
+
+#include "../png_writer.h"
+#include "../y4m_writer.h"
+
+enum CaptureFormat {
+	CAPTURE_FORMAT_PNG = 0,
+	CAPTURE_FORMAT_Y4M = 1
+};
+
+// 描画結果を録画するクラス
+//
+// glReadPixelsの読み出し先をピクセルバッファオブジェクト (PBO) にして、
+// フェンスで転送完了を確認してから数フレーム後にマップする。
+// こうするとglReadPixelsがGPUの処理を待たずに戻るので、描画が止まらない。
+// マップした画像は別スレッドでPNGかY4Mに書き出す。
+class FrameCapture {
+public:
+	FrameCapture()
+		: width_(0)
+		, height_(0)
+		, format_(CAPTURE_FORMAT_PNG)
+		, head_(0)
+		, pending_(0)
+		, frameIndex_(0)
+		, stopping_(false)
+		, framesCaptured_(0)
+		, framesDropped_(0)
+		, captureSeconds_(0.0) {
+	}
+
+	virtual ~FrameCapture() {
+		stop();
+	}
+
+	// target: PNGならファイル名の前半、Y4Mならファイル名 ("-"や"|コマンド"も可)
+	// ringSize: PBOの数 (このフレーム数だけ遅れてマップする)
+	bool start(const std::string &target, CaptureFormat format, int width, int height,
+		int ringSize = 3, int maxQueued = 4) {
+		stop();
+
+		target_ = target;
+		format_ = format;
+		width_ = width;
+		height_ = height;
+		head_ = 0;
+		pending_ = 0;
+		frameIndex_ = 0;
+		framesCaptured_ = 0;
+		framesDropped_ = 0;
+		captureSeconds_ = 0.0;
+
+		if (format_ == CAPTURE_FORMAT_Y4M && !y4mWriter_.open(target_, width_, height_)) {
+			return false;
+		}
+
+		const size_t bytes = (size_t)width_ * height_ * 4;
+		pbos_.resize(ringSize);
+		fences_.assign(ringSize, (GLsync)0);
+		glGenBuffers(ringSize, &pbos_[0]);
+		for (int i = 0; i < ringSize; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos_[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		for (int i = 0; i < maxQueued; i++) {
+			freeList_.push_back(new std::vector<uint8_t>(bytes));
+		}
+
+		stopping_ = false;
+		thread_ = std::thread(&FrameCapture::run, this);
+		return true;
+	}
+
+	bool isRecording() const {
+		return !pbos_.empty();
+	}
+
+	// 描画が終わった後 (glfwSwapBuffersの前) に呼ぶ
+	void capture() {
+		if (!isRecording()) {
+			return;
+		}
+
+		const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		const int ringSize = (int)pbos_.size();
+
+		// 一番古いPBOが使われていれば、転送が終わるのを待って回収する
+		if (pending_ == ringSize) {
+			collect((head_ + ringSize - pending_) % ringSize, true);
+		}
+
+		// 今のフレームの読み出しを開始する (PBOが読み出し先なのですぐに戻る)
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos_[head_]);
+		glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences_[head_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		head_ = (head_ + 1) % ringSize;
+		pending_++;
+
+		// 転送が終わっているものがあれば待たずに回収する
+		while (pending_ > 1) {
+			const int oldest = (head_ + ringSize - pending_) % ringSize;
+			if (!collect(oldest, false)) {
+				break;
+			}
+		}
+
+		captureSeconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	// 残りのフレームを書き出して録画を終了する
+	void stop() {
+		if (!isRecording()) {
+			return;
+		}
+
+		const int ringSize = (int)pbos_.size();
+		while (pending_ > 0) {
+			collect((head_ + ringSize - pending_) % ringSize, true);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		readyCond_.notify_one();
+		thread_.join();
+
+		glDeleteBuffers(ringSize, &pbos_[0]);
+		pbos_.clear();
+		fences_.clear();
+
+		for (size_t i = 0; i < freeList_.size(); i++) {
+			delete freeList_[i];
+		}
+		freeList_.clear();
+		y4mWriter_.close();
+
+		fprintf(stderr, "Captured %d frames (%d dropped), %.3f ms/frame on the render thread\n",
+			framesCaptured_, framesDropped_,
+			framesCaptured_ + framesDropped_ > 0 ? 1000.0 * captureSeconds_ / (framesCaptured_ + framesDropped_) : 0.0);
+	}
+
+private:
+	FrameCapture(const FrameCapture &);
+	FrameCapture & operator=(const FrameCapture &);
+
+	struct Frame {
+		std::vector<uint8_t> *pixels;
+		int index;
+	};
+
+	// PBOの中身をCPU側のバッファにコピーして書き出しスレッドに渡す
+	// waitがfalseで転送が終わっていなければfalseを返す
+	bool collect(int slot, bool wait) {
+		const GLuint64 timeout = wait ? 1000000000ull : 0;
+		const GLenum status = glClientWaitSync(fences_[slot], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED && !wait) {
+			return false;
+		}
+		glDeleteSync(fences_[slot]);
+		fences_[slot] = (GLsync)0;
+		pending_--;
+
+		std::vector<uint8_t> *pixels = NULL;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!freeList_.empty()) {
+				pixels = freeList_.front();
+				freeList_.pop_front();
+			}
+		}
+
+		// 書き出しが追いつかなければフレームを捨てる (描画は止めない)
+		if (pixels == NULL) {
+			framesDropped_++;
+			frameIndex_++;
+			return true;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos_[slot]);
+		const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels->size(), GL_MAP_READ_BIT);
+		if (mapped != NULL) {
+			std::memcpy(&(*pixels)[0], mapped, pixels->size());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		Frame frame;
+		frame.pixels = pixels;
+		frame.index = frameIndex_++;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (mapped != NULL) {
+				readyQueue_.push_back(frame);
+			}
+			else {
+				freeList_.push_back(pixels);
+			}
+		}
+		readyCond_.notify_one();
+
+		if (mapped != NULL) {
+			framesCaptured_++;
+		}
+		else {
+			framesDropped_++;
+		}
+		return true;
+	}
+
+	// 書き出しスレッド
+	void run() {
+		std::vector<uint8_t> rgb((size_t)width_ * height_ * 3);
+		for (;;) {
+			Frame frame;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				readyCond_.wait(lock, [this] { return !readyQueue_.empty() || stopping_; });
+				if (readyQueue_.empty()) {
+					return;
+				}
+				frame = readyQueue_.front();
+				readyQueue_.pop_front();
+			}
+
+			// OpenGLの画像は下の行から並んでいるので上下を反転する
+			const uint8_t *rgba = &(*frame.pixels)[0];
+			for (int y = 0; y < height_; y++) {
+				const uint8_t *src = rgba + (size_t)(height_ - 1 - y) * width_ * 4;
+				uint8_t *dst = &rgb[(size_t)y * width_ * 3];
+				for (int x = 0; x < width_; x++) {
+					dst[x * 3 + 0] = src[x * 4 + 0];
+					dst[x * 3 + 1] = src[x * 4 + 1];
+					dst[x * 3 + 2] = src[x * 4 + 2];
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				freeList_.push_back(frame.pixels);
+			}
+
+			if (format_ == CAPTURE_FORMAT_Y4M) {
+				y4mWriter_.write(&rgb[0]);
+			}
+			else {
+				char filename[32];
+				sprintf(filename, "%06d.png", frame.index);
+				writePNG(target_ + filename, &rgb[0], width_, height_, 3);
+			}
+		}
+	}
+
+	std::string target_;
+	int width_, height_;
+	CaptureFormat format_;
+
+	std::vector<GLuint> pbos_;
+	std::vector<GLsync> fences_;
+	int head_;
+	int pending_;
+	int frameIndex_;
+
+	Y4mWriter y4mWriter_;
+	std::deque<std::vector<uint8_t> *> freeList_;
+	std::deque<Frame> readyQueue_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable readyCond_;
+	bool stopping_;
+
+	int framesCaptured_;
+	int framesDropped_;
+	double captureSeconds_;
+};
+
+#endif  // _FRAME_CAPTURE_H_
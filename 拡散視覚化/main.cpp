@@ -16,12 +16,24 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../stb_image_write.h"
 
 #include "common.h"
-#include "diff_equation.h"
+#include "diffusion_eq.h"
+#include "frame_capture.h"
+#include "reaction_diffusion.h"
+#include "advection_diffusion.h"
+#include "../grid_mesh.h"
+#include "../gpu_solver.h"
+#include "../shader_program.h"
+#include "../shader_manager.h"
+#include "../gpu_timer.h"
+#include "../topology.h"
 
 static int WIN_WIDTH = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT = 500;                       // ウィンドウの高さ
@@ -31,16 +43,37 @@ static const std::string TEX_FILE = std::string(DATA_DIRECTORY) + "hue.png";
 
 static const std::string VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.vert";
 static const std::string FRAG_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.frag";
+static const std::string SSBO_VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render_ssbo.vert";
+static const std::string DIFF_COMP_SHADER_FILE = std::string(SHADER_DIRECTORY) + "diffusion_step.comp";
 
 // VAO関連の変数
 GLuint vaoId;
 GLuint vboId;
 GLuint iboId;
+GLsizei indexCount;
+GLenum indexType;
 
 // シェーダを参照する番号
 GLuint vertShaderId;
 GLuint fragShaderId;
 GLuint programId;
+ShaderProgram program;
+
+// シェーダのファイルが変わったら読み込み直す
+ShaderManager shaderManager;
+int renderProgram = -1;
+int computeProgram = -1;
+
+// 視点に関するデータ (シェーダのViewDataブロック、視点が変わったときだけ更新する)
+struct ViewData {
+	glm::mat4 mvpMat;
+};
+static const GLuint VIEW_DATA_BINDING = 0;
+UniformBuffer viewBuffer;
+static bool viewDirty = true;
+
+// 描画にかかったGPUの時間
+GpuTimer drawTimer;
 
 // テクスチャ
 GLuint textureId;
@@ -57,9 +90,51 @@ float diff_num = 0.25;
 float clip_near = 0.1f;
 float clip_far = 10.0f;
 
+// 録画の設定 (コマンドライン引数で指定、Rキーで開始・終了)
+FrameCapture frameCapture;
+static std::string recordTarget = "capture_";      // PNGならファイル名の前半、Y4Mならファイル名
+static CaptureFormat recordFormat = CAPTURE_FORMAT_PNG;
+static bool recordOnStart = false;
+static int maxFrames = 0;                           // 0より大きければこのフレーム数で終了する
+
+// コンピュートシェーダで計算する (コマンドライン引数で切り替え、OpenGL 4.3が必要)
+static bool useGpu = false;
+GpuSolver gpuSolver;
+
+// Sキーで保存するスナップショット
+static std::string snapshotFile = "diffusion.snap";
+
+// 境界の扱い (コマンドライン引数 --boundary で指定。既定は符号の反転)
+static EdgeBoundary boundaryPolicy;
+static bool customBoundary = false;
+
+// 反応拡散 (コマンドライン引数 --model gray-scott|fhn で選ぶ。空なら拡散方程式)
+// 模様ができるまでに多くのステップが要るので、1フレームに reactionStepsPerFrame ステップ進める
+static std::string reactionModel;
+static int reactionStepsPerFrame = 20;
+static double grayScottFeed = 0.037;
+static double grayScottKill = 0.06;
+ReactionDiffusion<GrayScottModel> grayScott;
+ReactionDiffusion<FitzHughNagumoModel> fitzHughNagumo;
+
+// 移流拡散 (コマンドライン引数 --advect vortex|shear で速度場を選ぶ。空なら拡散だけ)
+// 速度は格子の単位 (1ステップで進むセル数) で、最大の速さを --velocity で指定する (1を超えてもよい)
+static std::string advectionField;
+static double advectionSpeed = 2.0;
+static SplittingScheme advectionSplitting = SPLITTING_STRANG;
+AdvectionDiffusion advection(diffEqn);
+
+// スレッドを固定するCPU (コマンドライン引数 --affinity で指定。既定は固定しない)
+static std::string affinity = "none";
+
 // 頂点のデータ
 std::vector<glm::vec3> positions;
 
+// 頂点の転送量の計測 (変更のあったタイルだけを転送する)
+static unsigned long long uploadBytesTotal = 0;
+static size_t uploadBytesLastFrame = 0;
+static int uploadFrames = 0;
+
 // Arcballコントロールのための変数
 bool isDragging = false;
 
@@ -83,6 +158,7 @@ float acScale = 1.0f;
 
 void initVAO() {
 	// 頂点データの初期化
+	positions.reserve((size_t)texWidth * texHeight);
 	for (int i = 0; i < texHeight; i++) {
 		for (int j = 0; j < texWidth; j++) {
 			double vx = (i - texWidth / 2) * dx;
@@ -107,138 +183,170 @@ void initVAO() {
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
 
-	std::vector<unsigned int> indices;
-	for (int y = 0; y < texHeight - 1; y++) {
-		for (int x = 0; x < texWidth - 1; x++) {
-			const int i0 = y * texWidth + x;
-			const int i1 = y * texWidth + (x + 1);
-			const int i2 = (y + 1) * texWidth + x;
-			const int i3 = (y + 1) * texWidth + (x + 1);
-
-			indices.push_back(i0);
-			indices.push_back(i1);
-			indices.push_back(i3);
-			indices.push_back(i0);
-			indices.push_back(i3);
-			indices.push_back(i2);
-		}
-	}
-
+	// インデックスの用意 (三角形ストリップ + プリミティブリスタート)
+	// 頂点数が少なければ16ビットのインデックスを使う
 	glGenBuffers(1, &iboId);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		sizeof(unsigned int) * indices.size(),
-		&indices[0], GL_STATIC_DRAW);
+	if (texWidth * texHeight < 65535) {
+		std::vector<unsigned short> indices;
+		buildGridStripIndices(texWidth, texHeight, indices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			sizeof(unsigned short) * indices.size(),
+			&indices[0], GL_STATIC_DRAW);
+		indexCount = (GLsizei)indices.size();
+		indexType = GL_UNSIGNED_SHORT;
+	}
+	else {
+		std::vector<unsigned int> indices;
+		buildGridStripIndices(texWidth, texHeight, indices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			sizeof(unsigned int) * indices.size(),
+			&indices[0], GL_STATIC_DRAW);
+		indexCount = (GLsizei)indices.size();
+		indexType = GL_UNSIGNED_INT;
+	}
+
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(indexType == GL_UNSIGNED_SHORT ? 0xffff : 0xffffffff);
 
 	glBindVertexArray(0);
 
 }
 
-//myGLSLに実装
-GLuint compileShader(const std::string &filename, GLuint type) {
-	// シェーダの作成
-	GLuint shaderId = glCreateShader(type);
-
-	// ファイルの読み込み
-	std::ifstream reader;
-	size_t codeSize;
-	std::string code;
-
-	// ファイルを開く
-	reader.open(filename.c_str(), std::ios::in);
-	if (!reader.is_open()) {
-		// ファイルを開けなかったらエラーを出して終了
-		fprintf(stderr, "Failed to load a shader: %s\n", VERT_SHADER_FILE.c_str());
-		exit(1);
+// 反応拡散の初期化 (境界は --boundary を指定しなければノイマン境界)
+void initReaction() {
+	if (reactionModel == "gray-scott") {
+		grayScott.model() = GrayScottModel(grayScottFeed, grayScottKill);
+		grayScott.setParams(texWidth, texHeight, 0.16, 0.08, 1.0);
+		if (customBoundary) {
+			grayScott.boundary() = boundaryPolicy;
+		}
+
+		// 中央の正方形にvを置く (少しずらして対称性を崩す)
+		for (int y = texHeight / 2 - 10; y < texHeight / 2 + 10; y++) {
+			for (int x = texWidth / 2 - 10; x < texWidth / 2 + 10; x++) {
+				grayScott.set(x, y, 0.5, 0.25 + 0.01 * ((x * 7 + y * 13) % 5));
+			}
+		}
+		grayScott.start();
 	}
+	else {
+		fitzHughNagumo.setParams(texWidth, texHeight, 1.0, 0.0, 0.05);
+		if (customBoundary) {
+			fitzHughNagumo.boundary() = boundaryPolicy;
+		}
 
-	// ファイルをすべて読んで変数に格納 (やや難)
-	reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-	codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-	code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-	reader.seekg(0);                            // ファイルの読み取り位置を先頭に移動
-	reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-	// ファイルを閉じる
-	reader.close();
-
-	// コードのコンパイル
-	const char *codeChars = code.c_str();
-	glShaderSource(shaderId, 1, &codeChars, NULL);
-	glCompileShader(shaderId);
-
-	// コンパイルの成否を判定する
-	GLint compileStatus;
-	glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-	if (compileStatus == GL_FALSE) {
-		// コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-		fprintf(stderr, "Failed to compile a shader!\n");
-
-		// エラーメッセージの長さを取得する
-		GLint logLength;
-		glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-		if (logLength > 0) {
-			// エラーメッセージを取得する
-			GLsizei length;
-			std::string errMsg;
-			errMsg.resize(logLength);
-			glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-			// エラーメッセージとソースコードの出力
-			fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-			fprintf(stderr, "%s\n", code.c_str());
+		// 左下を興奮させ、その上を回復中にしておくと、波の切れ端がらせん波になる
+		const FitzHughNagumoModel &model = fitzHughNagumo.model();
+		for (int y = 1; y < texHeight - 1; y++) {
+			for (int x = 1; x < texWidth / 2; x++) {
+				if (y < texHeight / 2) {
+					fitzHughNagumo.set(x, y, 1.5, model.restV());
+				}
+				else if (y < texHeight / 2 + texHeight / 8) {
+					fitzHughNagumo.set(x, y, model.restU(), 1.0);
+				}
+			}
 		}
-		exit(1);
+		fitzHughNagumo.start();
 	}
+}
 
-	return shaderId;
+// クリックした位置に物質を置く (Gray-Scottはv、FitzHugh-Nagumoは興奮)
+void seedReaction(int x, int y) {
+	if (reactionModel == "gray-scott") {
+		grayScott.set(x, y, 0.5, 0.25);
+	}
+	else {
+		fitzHughNagumo.set(x, y, 1.5, fitzHughNagumo.model().restV());
+	}
 }
 
-//myGLSLの中に実装
-GLuint buildShaderProgram(const std::string &vShaderFile, const std::string &fShaderFile) {
-	// シェーダの作成
-	GLuint vertShaderId = compileShader(vShaderFile, GL_VERTEX_SHADER);
-	GLuint fragShaderId = compileShader(fShaderFile, GL_FRAGMENT_SHADER);
-
-	// シェーダプログラムのリンク
-	GLuint programId = glCreateProgram();
-	glAttachShader(programId, vertShaderId);
-	glAttachShader(programId, fragShaderId);
-	glLinkProgram(programId);
-
-	// リンクの成否を判定する
-	GLint linkState;
-	glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-	if (linkState == GL_FALSE) {
-		// リンクに失敗したらエラーメッセージを表示して終了
-		fprintf(stderr, "Failed to link shaders!\n");
-
-		// エラーメッセージの長さを取得する
-		GLint logLength;
-		glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-		if (logLength > 0) {
-			// エラーメッセージを取得する
-			GLsizei length;
-			std::string errMsg;
-			errMsg.resize(logLength);
-			glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-			// エラーメッセージを出力する
-			fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
+// 反応拡散を進めて頂点を更新する
+// ほぼすべてのセルが毎フレーム変わるので、タイルを調べずに全体を転送する
+template <class Solver>
+void animateReaction(Solver &solver) {
+	for (int i = 0; i < reactionStepsPerFrame; i++) {
+		solver.step();
+	}
+
+	for (int y = 0; y < texHeight; y++) {
+		for (int x = 0; x < texWidth; x++) {
+			positions[y * texWidth + x].z = (float)solver.display(x, y);
 		}
-		exit(1);
 	}
 
-	// シェーダを無効化した後にIDを返す
-	glUseProgram(0);
-	return programId;
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * positions.size(), &positions[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	uploadBytesLastFrame = sizeof(glm::vec3) * positions.size();
+	uploadBytesTotal += uploadBytesLastFrame;
+	uploadFrames++;
 }
 
+//myGLSLに実装
+void setupRenderProgram();
+
 // シェーダの初期化
 void initShaders() {
-	programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);//shaders1
+	// GPUで計算する場合は頂点シェーダがSSBOから値を読む
+	// (最初の読み込みに失敗したときは使えるプログラムがないので終了する)
+	renderProgram = shaderManager.add(useGpu ? SSBO_VERT_SHADER_FILE : VERT_SHADER_FILE, FRAG_SHADER_FILE);//shaders1
+	if (renderProgram < 0) {
+		exit(1);
+	}
+	if (useGpu) {
+		computeProgram = shaderManager.addCompute(DIFF_COMP_SHADER_FILE);
+		if (computeProgram < 0) {
+			exit(1);
+		}
+	}
+
+	viewBuffer.create(sizeof(ViewData), VIEW_DATA_BINDING);
+	setupRenderProgram();
 }
 
+// 描画用のプログラムの準備 (読み込み直したときにも呼ぶ)
+void setupRenderProgram() {
+	programId = shaderManager.program(renderProgram);
+
+	// uniform変数の場所を調べて、描画中に変わらない値はここで設定しておく
+	program.attach(programId);
+	program.bindBlock("ViewData", VIEW_DATA_BINDING);
+
+	glUseProgram(programId);
+	glUniform1i(program.location("u_texture"), 0);
+	if (useGpu) {
+		glUniform1i(program.location("u_xCells"), texWidth);
+		glUniform1i(program.location("u_yCells"), texHeight);
+		glUniform1f(program.location("u_dx"), (float)dx);
+	}
+	glUseProgram(0);
+}
+
+
+// 移流拡散の初期化 (vortexは中心の周りの回転、shearは上下で向きの変わる横向きの流れ)
+void initAdvection() {
+	advection.setParams(1.0, 1.0, diff_num);
+	advection.setSplitting(advectionSplitting);
+	const double cx = 0.5 * (texWidth - 1);
+	const double cy = 0.5 * (texHeight - 1);
+	const double radius = 0.5 * std::min(texWidth, texHeight);
+	advection.setVelocityField([&](int x, int y, double &vx, double &vy) {
+		if (advectionField == "vortex") {
+			const double omega = advectionSpeed / radius;
+			vx = -omega * (y - cy);
+			vy = omega * (x - cx);
+		}
+		else {
+			vx = advectionSpeed * std::sin(2.0 * glm::pi<double>() * y / texHeight);
+			vy = 0.0;
+		}
+	});
+	fprintf(stderr, "advection: %s, max Courant number %.2f, %s splitting\n", advectionField.c_str(), advection.maxCourant(),
+		advectionSplitting == SPLITTING_STRANG ? "Strang" : "Lie");
+}
 
 // OpenGLの初期化関数
 void initializeGL() {
@@ -250,10 +358,28 @@ void initializeGL() {
 
 	// 拡散方程式シミュレーションの初期化
 	diffEqn.initParams(texWidth, texHeight, diff_num);
+	diffEqn.boundary() = boundaryPolicy;
 
 	// VAOの初期化
 	initVAO();
 
+	if (!reactionModel.empty()) {
+		initReaction();
+	}
+	if (!advectionField.empty()) {
+		initAdvection();
+	}
+
+	// GPUで計算する場合は初期値を行を詰めて転送する (以降はGPU上で更新する)
+	if (useGpu) {
+		std::vector<double> initial((size_t)texWidth * texHeight);
+		diffEqn.copyHeights(&initial[0]);
+		if (!gpuSolver.initDiffusion(shaderManager.program(computeProgram), texWidth, texHeight,
+			&initial[0], diff_num, diffEqn.stepCount())) {
+			exit(1);
+		}
+	}
+
 	// シェーダの用意
 	initShaders();
 
@@ -292,14 +418,30 @@ void initializeGL() {
 		glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
 		glm::vec3(1.0f, 0.0f, 0.0f));  // 視界の上方向
 
+	// 描画時間の計測の用意
+	drawTimer.init();
 }
 
 // OpenGLの描画関数
 void paintGL() {
+	// シェーダのファイルが変わっていれば読み込み直す (失敗したら前のものを使い続ける)
+	if (shaderManager.poll()) {
+		setupRenderProgram();
+		if (useGpu) {
+			gpuSolver.setProgram(shaderManager.program(computeProgram));
+		}
+	}
+
 	// 背景色と深度値のクリア
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glm::mat4 mvpMat = projMat * viewMat *modelMat * acRotMat;
+	// 視点が変わったときだけ行列をシェーダに渡す
+	if (viewDirty) {
+		ViewData view;
+		view.mvpMat = projMat * viewMat *modelMat * acRotMat;
+		viewBuffer.update(&view);
+		viewDirty = false;
+	}
 
 	// VAOの有効化
 	glBindVertexArray(vaoId);
@@ -311,16 +453,14 @@ void paintGL() {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_1D, textureId);
 
-	// Uniform変数の転送
-	GLuint uid;
-	uid = glGetUniformLocation(programId, "u_mvpMat");
-	glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-
-	uid = glGetUniformLocation(programId, "u_texture");
-	glUniform1i(uid, 0);
+	if (useGpu) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuSolver.currentBuffer());
+	}
 
 	// 三角形の描画
-	glDrawElements(GL_TRIANGLES, 3 * (texHeight - 1) * (texWidth - 1) * 2, GL_UNSIGNED_INT, 0);
+	drawTimer.begin();
+	glDrawElements(GL_TRIANGLE_STRIP, indexCount, indexType, 0);
+	drawTimer.end();
 
 	// VAOの無効化
 	glBindVertexArray(0);
@@ -354,23 +494,86 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 	// ビューポート変換の更新
 	glViewport(0, 0, renderBufferWidth, renderBufferHeight);
+	viewDirty = true;
 }
 
 // アニメーションのためのアップデート
 void animate() {
+	// GPUで計算する場合は描画もSSBOから行うので転送はない
+	if (useGpu) {
+		gpuSolver.step();
+		return;
+	}
 
-	// 波動データの更新
-	diffEqn.step();
+	if (reactionModel == "gray-scott") {
+		animateReaction(grayScott);
+		return;
+	}
+	if (reactionModel == "fhn") {
+		animateReaction(fitzHughNagumo);
+		return;
+	}
 
-	for (int y = 0; y < texHeight; y++) {
-		for (int x = 0; x < texWidth; x++) {
-			positions[y * texWidth + x].z = diffEqn.get(x, y);
+	// 波動データの更新 (移流があれば移流と拡散を合わせて進める。全体が変更扱いになる)
+	if (!advectionField.empty()) {
+		advection.step();
+	}
+	else {
+		diffEqn.step();
+	}
+
+	// 変更のあったタイルの範囲だけ頂点を更新して転送する
+	// 行の中で連続するタイルはまとめ、前の範囲と連続していればさらにつなげる
+	const int tile = DiffEquation::DIRTY_TILE;
+	size_t rangeBegin = 0, rangeEnd = 0;
+	uploadBytesLastFrame = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	for (int ty = 0; ty < diffEqn.dirtyTilesY(); ty++) {
+		const int y0 = ty * tile;
+		const int y1 = std::min(y0 + tile, texHeight);
+		for (int tx = 0; tx < diffEqn.dirtyTilesX(); ) {
+			if (!diffEqn.isDirty(tx, ty)) {
+				tx++;
+				continue;
+			}
+			int tx1 = tx;
+			while (tx1 < diffEqn.dirtyTilesX() && diffEqn.isDirty(tx1, ty)) {
+				tx1++;
+			}
+			const int x0 = tx * tile;
+			const int x1 = std::min(tx1 * tile, texWidth);
+
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					positions[y * texWidth + x].z = diffEqn.get(x, y);
+				}
+
+				const size_t begin = (size_t)y * texWidth + x0;
+				const size_t end = (size_t)y * texWidth + x1;
+				if (begin != rangeEnd) {
+					if (rangeEnd > rangeBegin) {
+						glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * rangeBegin,
+							sizeof(glm::vec3) * (rangeEnd - rangeBegin), &positions[rangeBegin]);
+						uploadBytesLastFrame += sizeof(glm::vec3) * (rangeEnd - rangeBegin);
+					}
+					rangeBegin = begin;
+				}
+				rangeEnd = end;
+			}
+			tx = tx1;
 		}
 	}
+	if (rangeEnd > rangeBegin) {
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * rangeBegin,
+			sizeof(glm::vec3) * (rangeEnd - rangeBegin), &positions[rangeBegin]);
+		uploadBytesLastFrame += sizeof(glm::vec3) * (rangeEnd - rangeBegin);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	diffEqn.clearDirty();
 
-	glBindVertexArray(vaoId);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * positions.size(), &positions[0]);
-	glBindVertexArray(0);
+	uploadBytesTotal += uploadBytesLastFrame;
+	uploadFrames++;
 }
 
 bool Press = false;
@@ -437,7 +640,7 @@ void mouseEvent(GLFWwindow *window, int button, int action, int mods) {
 			for (int i = -radiusInit; i <= radiusInit; i++) {
 				for (int j = -radiusInit; j <= radiusInit; j++) {
 
-					if (x + i < 0 || y + j < 0) {
+					if (x + i < 0 || y + j < 0 || x + i >= texWidth || y + j >= texHeight) {
 						continue;
 					}
 
@@ -445,19 +648,29 @@ void mouseEvent(GLFWwindow *window, int button, int action, int mods) {
 					float r = sqrt(i * i + j * j);
 
 					//初期中心温度（濃度）半径内のとき
-					if (r < radiusInit) diffEqn.set(x + i, y + j, heatInit);//物理量
+					if (r < radiusInit) {
+						if (useGpu) {
+							gpuSolver.set(x + i, y + j, heatInit);
+						}
+						else if (!reactionModel.empty()) {
+							seedReaction(x + i, y + j);
+						}
+						else {
+							diffEqn.set(x + i, y + j, heatInit);//物理量
+						}
+					}
 
 				}
 
 			}
-			std::cout << "Mouse position:" << gx << " , " << gy << std::endl;
+			fprintf(stderr, "Mouse position:%d , %d\n", gx, gy);
 		}
 		else if (button == GLFW_MOUSE_BUTTON_RIGHT) {
 			arcballMode = ARCBALL_MODE_ROTATE;
 			Press_button = "RIGHT";
 		}
 
-		std::cout << "Press button: " << Press_button << std::endl;
+		fprintf(stderr, "Press button: %s\n", Press_button);
 
 		if (!isDragging) {
 			isDragging = true;
@@ -519,11 +732,13 @@ void updateRotate() {
 
 	// 回転行列の更新
 	acRotMat = glm::rotate((float)(4.0 * angle), rotAxisObjSpace) * acRotMat;
+	viewDirty = true;
 }
 
 
 void updateScale() {
 	acScaleMat = glm::scale(glm::vec3(acScale, acScale, acScale));
+	viewDirty = true;
 }
 
 void updateMouse() {
@@ -567,7 +782,139 @@ void wheelEvent(GLFWwindow *window, double xpos, double ypos) {
 	updateScale();
 }
 
+// 録画の開始・終了
+void toggleRecording(GLFWwindow *window) {
+	if (frameCapture.isRecording()) {
+		frameCapture.stop();
+		return;
+	}
+
+	int renderBufferWidth, renderBufferHeight;
+	glfwGetFramebufferSize(window, &renderBufferWidth, &renderBufferHeight);
+	if (frameCapture.start(recordTarget, recordFormat, renderBufferWidth, renderBufferHeight)) {
+		fprintf(stderr, "Recording started: %s\n", recordTarget.c_str());
+	}
+}
+
+void keyboardEvent(GLFWwindow *window, int key, int scancode, int action, int mods) {
+	if (action == GLFW_PRESS && key == GLFW_KEY_R) {
+		toggleRecording(window);
+	}
+
+	// スナップショットの保存 (GPUで計算している場合はここでだけCPUに読み出す)
+	if (action == GLFW_PRESS && key == GLFW_KEY_S && reactionModel.empty()) {
+		const bool ok = useGpu ? gpuSolver.saveSnapshot(snapshotFile.c_str()) : diffEqn.saveSnapshot(snapshotFile.c_str());
+		if (ok) {
+			fprintf(stderr, "Snapshot saved: %s\n", snapshotFile.c_str());
+		}
+	}
+}
+
 int main(int argc, char **argv) {
+	// コマンドライン引数の処理
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--record-png" && i + 1 < argc) {
+			recordTarget = argv[++i];
+			recordFormat = CAPTURE_FORMAT_PNG;
+			recordOnStart = true;
+		}
+		else if (arg == "--record-y4m" && i + 1 < argc) {
+			recordTarget = argv[++i];
+			recordFormat = CAPTURE_FORMAT_Y4M;
+			recordOnStart = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			maxFrames = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--gpu") {
+			useGpu = true;
+		}
+		else if (arg == "--snapshot" && i + 1 < argc) {
+			snapshotFile = argv[++i];
+		}
+		else if (arg == "--affinity" && i + 1 < argc) {
+			affinity = argv[++i];
+		}
+		else if (arg == "--boundary" && i + 1 < argc) {
+			if (!parseEdgeBoundary(argv[++i], boundaryPolicy)) {
+				fprintf(stderr, "Invalid boundary: %s\n", argv[i]);
+				return 1;
+			}
+			customBoundary = true;
+		}
+		else if (arg == "--model" && i + 1 < argc) {
+			reactionModel = argv[++i];
+			if (reactionModel != "gray-scott" && reactionModel != "fhn") {
+				fprintf(stderr, "Unknown model: %s (gray-scott or fhn)\n", reactionModel.c_str());
+				return 1;
+			}
+		}
+		else if (arg == "--steps-per-frame" && i + 1 < argc) {
+			reactionStepsPerFrame = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--feed" && i + 1 < argc) {
+			grayScottFeed = atof(argv[++i]);
+		}
+		else if (arg == "--kill" && i + 1 < argc) {
+			grayScottKill = atof(argv[++i]);
+		}
+		else if (arg == "--advect" && i + 1 < argc) {
+			advectionField = argv[++i];
+			if (advectionField != "vortex" && advectionField != "shear") {
+				fprintf(stderr, "Unknown velocity field: %s (vortex or shear)\n", advectionField.c_str());
+				return 1;
+			}
+		}
+		else if (arg == "--velocity" && i + 1 < argc) {
+			advectionSpeed = atof(argv[++i]);
+		}
+		else if (arg == "--splitting" && i + 1 < argc) {
+			const std::string splitting = argv[++i];
+			if (splitting == "lie") {
+				advectionSplitting = SPLITTING_LIE;
+			}
+			else if (splitting == "strang") {
+				advectionSplitting = SPLITTING_STRANG;
+			}
+			else {
+				fprintf(stderr, "Unknown splitting: %s (lie or strang)\n", splitting.c_str());
+				return 1;
+			}
+		}
+		else {
+			fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	if (useGpu && !reactionModel.empty()) {
+		fprintf(stderr, "--model is not supported with --gpu\n");
+		return 1;
+	}
+	if (!advectionField.empty() && (useGpu || !reactionModel.empty())) {
+		fprintf(stderr, "--advect cannot be combined with --gpu or --model\n");
+		return 1;
+	}
+
+	// 吸収境界は波動方程式用、GPUでの計算はこれまでの境界だけに対応している
+	for (int e = 0; e < 4; e++) {
+		const BoundaryKind kind = boundaryPolicy.kind((BoundaryEdge)e);
+		if (kind == BOUNDARY_ABSORBING) {
+			fprintf(stderr, "The absorbing boundary is only for the wave equation\n");
+			return 1;
+		}
+		if (useGpu && kind != BOUNDARY_MIRROR_NEGATE) {
+			fprintf(stderr, "--gpu only supports the default boundary\n");
+			return 1;
+		}
+	}
+
+	// 格子を確保する前にスレッドを固定する
+	if (!setupThreadAffinity(affinity, stderr)) {
+		return 1;
+	}
+
 	// OpenGLを初期化する
 	if (glfwInit() == GL_FALSE) {
 		fprintf(stderr, "Initialization failed!\n");
@@ -575,8 +922,9 @@ int main(int argc, char **argv) {
 	}
 
 	// OpenGLのバージョン指定
+	// コンピュートシェーダには4.3が必要
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, useGpu ? 3 : 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -596,6 +944,7 @@ int main(int argc, char **argv) {
 	glfwSetMouseButtonCallback(window, mouseEvent);
 	glfwSetCursorPosCallback(window, mouseMoveEvent);
 	glfwSetScrollCallback(window, wheelEvent);
+	glfwSetKeyCallback(window, keyboardEvent);
 
 	// OpenGL 3.x/4.xの関数をロードする (glfwMakeContextCurrentの後でないといけない)
 	const int version = gladLoadGL(glfwGetProcAddress);
@@ -605,7 +954,7 @@ int main(int argc, char **argv) {
 	}
 
 	// バージョンを出力する
-	printf("Load OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
+	fprintf(stderr, "Load OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
 
 	// ウィンドウのリサイズを扱う関数の登録
 	glfwSetWindowSizeCallback(window, resizeGL);
@@ -613,16 +962,49 @@ int main(int argc, char **argv) {
 	// OpenGLを初期化
 	initializeGL();
 
+	if (recordOnStart) {
+		toggleRecording(window);
+	}
+
 	// メインループ
+	int frames = 0;
 	while (glfwWindowShouldClose(window) == GL_FALSE) {
 		// 描画
 		paintGL();
 
+		// 録画
+		frameCapture.capture();
+
 		// アニメーション
 		animate();
 
 		// 描画用バッファの切り替え
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		// 頂点の転送量をタイトルに表示する
+		frames++;
+		if (frames % 30 == 0) {
+			char title[128];
+			sprintf(title, "%s (upload %.1f KB/frame, draw %.3f ms)", WIN_TITLE,
+				uploadBytesLastFrame / 1024.0, drawTimer.lastMilliseconds());
+			glfwSetWindowTitle(window, title);
+		}
+
+		if (maxFrames > 0 && frames >= maxFrames) {
+			break;
+		}
+	}
+
+	// 録画中のフレームを書き出す
+	frameCapture.stop();
+
+	// 頂点の転送量
+	if (uploadFrames > 0) {
+		fprintf(stderr, "Vertex upload: %.1f KB/frame (full upload: %.1f KB/frame)\n",
+			uploadBytesTotal / 1024.0 / uploadFrames,
+			sizeof(glm::vec3) * positions.size() / 1024.0);
 	}
+	fprintf(stderr, "Draw: %.3f ms/frame on the GPU (%llu frames measured)\n",
+		drawTimer.averageMilliseconds(), drawTimer.samples());
 }
@@ -0,0 +1,290 @@
+#ifndef _REACTION_DIFFUSION_H_
+#define _REACTION_DIFFUSION_H_
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "../grid.h"
+#include "../parallel.h"
+#include "../stencil.h"
+#include "../simd.h"
+
+// 2種類の物質 u, v の反応拡散方程式
+//
+//   du/dt = Du ∇^2u + f(u, v)
+//   dv/dt = Dv ∇^2v + g(u, v)
+//
+// 反応項 f, g はModelで選ぶ (GrayScottModel, FitzHughNagumoModel)。
+// u, vはそれぞれ別のGrid2D (SoA) に持ち、現在・次の2組を入れ替えて使う。
+// step() は1回の走査で両方のラプラシアンと反応項を計算して次の値を書き込むので (拡散と反応を分けない)、
+// 1ステップで各配列を1回ずつ読み書きするだけで済む。Model::react() はSSE2の2要素の型 (Double2) でも
+// 呼べるようにしてあり (simd.h)、5点のラプラシアンなら2セルずつまとめて計算する (結果はスカラーで計算した場合と同じ)。
+// 行は parallelFor で分ける。
+// 境界の扱いは両方の物質で共通 (既定はノイマン境界。吸収境界は使えない)。
+
+// Gray-Scottモデル (供給率feed, 除去率kill)
+//   f = -uv^2 + feed (1 - u)
+//   g =  uv^2 - (feed + kill) v
+// 一様な状態 u = 1, v = 0 に v を少し置くと、feedとkillに応じた模様 (斑点・縞など) ができる
+struct GrayScottModel {
+	double feed;
+	double kill;
+
+	GrayScottModel(double feed = 0.037, double kill = 0.06)
+		: feed(feed)
+		, kill(kill) {
+	}
+
+	template <class T>
+	void react(const T &u, const T &v, T &fu, T &fv) const {
+		const T uvv = u * v * v;
+		fu = -uvv + feed * (1.0 - u);
+		fv = uvv - (feed + kill) * v;
+	}
+
+	// 一様な状態
+	double restU() const {
+		return 1.0;
+	}
+
+	double restV() const {
+		return 0.0;
+	}
+
+	// 描画に使う値 ([0, 1]。hue.pngの色になる)
+	double display(double, double v) const {
+		return std::min(1.0, 2.0 * v);
+	}
+};
+
+// FitzHugh-Nagumoモデル (興奮性の媒質。uが膜電位、vが回復変数)
+//   f = u - u^3 / 3 - v
+//   g = epsilon (u + a - b v)
+// 静止状態から u を持ち上げると興奮が広がり、らせん波などができる
+struct FitzHughNagumoModel {
+	double a;
+	double b;
+	double epsilon;
+
+	FitzHughNagumoModel(double a = 0.7, double b = 0.8, double epsilon = 0.08)
+		: a(a)
+		, b(b)
+		, epsilon(epsilon) {
+	}
+
+	template <class T>
+	void react(const T &u, const T &v, T &fu, T &fv) const {
+		fu = u - u * u * u * (1.0 / 3.0) - v;
+		fv = epsilon * (u + a - b * v);
+	}
+
+	// 静止状態 (u - u^3 / 3 - v = 0, u + a - b v = 0 の解の近似)
+	double restU() const {
+		return -1.1994;
+	}
+
+	double restV() const {
+		return -0.6243;
+	}
+
+	double display(double u, double) const {
+		return std::min(1.0, std::max(0.0, (u + 2.0) * 0.25));
+	}
+};
+
+template <class Model, class Weights = FivePointLaplacian>
+class ReactionDiffusion {
+public:
+	ReactionDiffusion()
+		: du_(0.0)
+		, dv_(0.0)
+		, dt_(0.0)
+		, dx_(1.0)
+		, curr_(0)
+		, steps_(0) {
+		boundary_.setAll(BOUNDARY_NEUMANN);
+	}
+
+	virtual ~ReactionDiffusion() {
+	}
+
+	// 格子の大きさと拡散係数・時間刻み (安定には max(Du, Dv) dt / dx^2 <= 1/4 が必要)
+	// 値はModelの一様な状態で初期化される
+	void setParams(int xCells, int yCells, double du, double dv, double dt, double dx = 1.0) {
+		du_ = du;
+		dv_ = dv;
+		dt_ = dt;
+		dx_ = dx;
+		for (int i = 0; i < 2; i++) {
+			u_[i].allocate(xCells, yCells);
+			v_[i].allocate(xCells, yCells);
+		}
+		curr_ = 0;
+		steps_ = 0;
+		fill(model_.restU(), model_.restV());
+	}
+
+	// すべてのセルを同じ値にする
+	void fill(double u, double v) {
+		for (int y = 0; y < yCells(); y++) {
+			std::fill(u_[curr_].row(y), u_[curr_].row(y) + xCells(), u);
+			std::fill(v_[curr_].row(y), v_[curr_].row(y) + xCells(), v);
+		}
+	}
+
+	void set(int x, int y, double u, double v) {
+		u_[curr_].at(x, y) = u;
+		v_[curr_].at(x, y) = v;
+	}
+
+	double u(int x, int y) const {
+		return u_[curr_].at(x, y);
+	}
+
+	double v(int x, int y) const {
+		return v_[curr_].at(x, y);
+	}
+
+	// 描画に使う値 (Model::display)
+	double display(int x, int y) const {
+		return model_.display(u(x, y), v(x, y));
+	}
+
+	void start() {
+		boundary_.initialize(u_[curr_].origin(), pitch(), xCells(), yCells());
+		boundary_.initialize(v_[curr_].origin(), pitch(), xCells(), yCells());
+		steps_ = 0;
+	}
+
+	void step() {
+		typedef typename Weights::Edge Edge;
+		const int R = Weights::RADIUS;
+		const int W = xCells();
+		const int H = yCells();
+		const int P = pitch();
+		const double *uc = u_[curr_].origin();
+		const double *vc = v_[curr_].origin();
+		double *un = u_[1 - curr_].origin();
+		double *vn = v_[1 - curr_].origin();
+		const double cu = du_ * dt_ / (dx_ * dx_);
+		const double cv = dv_ * dt_ / (dx_ * dx_);
+		const double dt = dt_;
+		const Model model = model_;
+		const EdgeBoundary &boundary = boundary_;
+
+		parallelFor(1, H - 1, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				const size_t offset = (size_t)y * P;
+				if (y >= R && y < H - R) {
+					reactRow<Edge>(model, uc + offset, vc + offset, un + offset, vn + offset, P, 1, R, cu, cv, dt);
+					reactRow<Weights>(model, uc + offset, vc + offset, un + offset, vn + offset, P, R, W - R, cu, cv, dt);
+					reactRow<Edge>(model, uc + offset, vc + offset, un + offset, vn + offset, P, W - R, W - 1, cu, cv, dt);
+				}
+				else {
+					reactRow<Edge>(model, uc + offset, vc + offset, un + offset, vn + offset, P, 1, W - 1, cu, cv, dt);
+				}
+				boundary.applyRow(un, uc, P, W, y);
+				boundary.applyRow(vn, vc, P, W, y);
+			}
+		});
+		boundary_.applyTopBottom(un, uc, P, W, H);
+		boundary_.applyTopBottom(vn, vc, P, W, H);
+
+		curr_ = 1 - curr_;
+		steps_++;
+	}
+
+	// 現在の値 (セル (x, y) は [y * pitch() + x])。species = 0 なら u、1 なら v
+	const double *species(int s) const {
+		return (s == 0 ? u_[curr_] : v_[curr_]).origin();
+	}
+
+	Model &model() {
+		return model_;
+	}
+
+	EdgeBoundary &boundary() {
+		return boundary_;
+	}
+
+	int xCells() const {
+		return u_[curr_].xCells();
+	}
+
+	int yCells() const {
+		return u_[curr_].yCells();
+	}
+
+	int pitch() const {
+		return u_[curr_].pitch();
+	}
+
+	unsigned long long stepCount() const {
+		return steps_;
+	}
+
+private:
+	ReactionDiffusion(const ReactionDiffusion &);
+	ReactionDiffusion & operator=(const ReactionDiffusion &);
+
+	// 1行の [x0, x1) を計算する (各ポインタは行の先頭のセル)
+	template <class Laplacian>
+	static void reactRow(const Model &model, const double *__restrict uc, const double *__restrict vc,
+		double *__restrict un, double *__restrict vn, int P, int x0, int x1, double cu, double cv, double dt) {
+		int x = reactPairs((const Laplacian *)NULL, model, uc, vc, un, vn, P, x0, x1, cu, cv, dt);
+		for (; x < x1; x++) {
+			const double u = uc[x];
+			const double v = vc[x];
+			double fu, fv;
+			model.react(u, v, fu, fv);
+			un[x] = u + cu * Laplacian::apply(uc + x, P) + dt * fu;
+			vn[x] = v + cv * Laplacian::apply(vc + x, P) + dt * fv;
+		}
+	}
+
+	// 2セルずつ計算して、計算し終えた位置を返す (5点のラプラシアンのみ。他はスカラーで計算する)
+	template <class Laplacian>
+	static int reactPairs(const Laplacian *, const Model &, const double *, const double *, double *, double *,
+		int, int x0, int, double, double, double) {
+		return x0;
+	}
+
+#if defined(SIMD_USE_SSE2)
+	static int reactPairs(const FivePointLaplacian *, const Model &model, const double *uc, const double *vc,
+		double *un, double *vn, int P, int x0, int x1, double cu, double cv, double dt) {
+		int x = x0;
+		for (; x + 2 <= x1; x += 2) {
+			const Double2 u = Double2::load(uc + x);
+			const Double2 v = Double2::load(vc + x);
+			Double2 fu(0.0), fv(0.0);
+			model.react(u, v, fu, fv);
+
+			// FivePointLaplacian::apply() と同じ順番で足す
+			Double2 lu = Double2::load(uc + x - 1) - u;
+			lu = lu + (Double2::load(uc + x + 1) - u);
+			lu = lu + (Double2::load(uc + x - P) - u);
+			lu = lu + (Double2::load(uc + x + P) - u);
+			Double2 lv = Double2::load(vc + x - 1) - v;
+			lv = lv + (Double2::load(vc + x + 1) - v);
+			lv = lv + (Double2::load(vc + x - P) - v);
+			lv = lv + (Double2::load(vc + x + P) - v);
+
+			(u + cu * lu + dt * fu).store(un + x);
+			(v + cv * lv + dt * fv).store(vn + x);
+		}
+		return x;
+	}
+#endif
+
+	Model model_;
+	EdgeBoundary boundary_;
+	double du_, dv_;
+	double dt_, dx_;
+	Grid2D<double> u_[2];  // 現在と次 (curr_が現在)
+	Grid2D<double> v_[2];
+	int curr_;
+	unsigned long long steps_;
+};
+
+#endif  // _REACTION_DIFFUSION_H_
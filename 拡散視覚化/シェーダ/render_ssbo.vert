@@ -0,0 +1,24 @@
+#version 430
+
+// コンピュートシェーダで計算した値 (SSBO) から直接頂点を作る
+// (頂点の位置はmain.cppのinitVAOと同じ並べ方にする)
+layout(std430, binding = 0) readonly buffer Heights { float heights[]; };
+
+out float fragHeight;
+
+// 視点に関するデータ (視点が変わったときだけ更新される)
+layout(std140) uniform ViewData {
+    mat4 u_mvpMat;
+};
+uniform int u_xCells;
+uniform int u_yCells;
+uniform float u_dx;
+
+void main() {
+    int i = gl_VertexID / u_xCells;
+    int j = gl_VertexID % u_xCells;
+    vec3 position = vec3(float(i - u_xCells / 2) * u_dx, float(j - u_yCells / 2) * u_dx, heights[gl_VertexID]);
+
+    gl_Position = u_mvpMat * vec4(position, 1.0);
+    fragHeight = position.z;
+}